@@ -0,0 +1,824 @@
+#include "bvh.hpp"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "threadPool.hpp"
+#include "vertex.hpp"
+#include "debugUtils.h"
+
+#define BVH_TASK_THRESHOLD 4096
+#define BVH_PARALLEL_BIN_THRESHOLD 65536
+#define BVH_MAX_BIN_JOBS 16
+
+typedef struct
+{
+    glm::vec3 min;
+    glm::vec3 max;
+}
+Bounds;
+
+typedef struct
+{
+    glm::vec3 min;
+    uint32_t tri;
+    glm::vec3 max;
+    uint32_t pad;
+}
+BuildRef;
+
+typedef struct
+{
+    Bounds bounds;
+    Bounds centroids;
+    uint32_t count;
+}
+Bin;
+
+typedef struct
+{
+    Bounds bounds;
+    Bounds centroids;
+    uint32_t first;
+    uint32_t count;
+    uint32_t left;
+    uint32_t depth;
+}
+BuildNode;
+
+typedef struct
+{
+    BVH* bvh;
+    ThreadPool* pool;
+    BuildRef* refs;
+    BuildNode* nodes;
+    std::atomic<uint32_t> numNodes;
+    std::atomic<int32_t> pending;
+}
+BuildState;
+
+typedef struct
+{
+    BuildState* state;
+    uint32_t node;
+}
+BuildTask;
+
+typedef struct
+{
+    BuildState* state;
+    const BuildNode* node;
+    uint32_t first;
+    uint32_t count;
+    Bin bins[3][BVH_NUM_BINS];
+}
+BinJob;
+
+static inline void boundsReset(Bounds* bounds)
+{
+    bounds->min = glm::vec3(1e30f);
+    bounds->max = glm::vec3(-1e30f);
+}
+
+static inline void boundsGrow(Bounds* bounds, glm::vec3 min, glm::vec3 max)
+{
+    bounds->min = glm::min(bounds->min, min);
+    bounds->max = glm::max(bounds->max, max);
+}
+
+static inline void binsReset(Bin bins[3][BVH_NUM_BINS])
+{
+    for(int32_t axis = 0; axis < 3; ++axis)
+    {
+        for(int32_t i = 0; i < BVH_NUM_BINS; ++i)
+        {
+            boundsReset(&bins[axis][i].bounds);
+            boundsReset(&bins[axis][i].centroids);
+            bins[axis][i].count = 0;
+        }
+    }
+}
+
+static inline glm::vec3 centroid(const BuildRef* ref)
+{
+    return (ref->min + ref->max) * 0.5f;
+}
+
+/*Levels of median splits below a node of count primitives until every leaf fits*/
+static inline uint32_t medianLevels(uint32_t count)
+{
+    uint32_t levels = 0;
+    
+    for(uint32_t leaves = (count + BVH_MAX_LEAF_TRIS - 1) / BVH_MAX_LEAF_TRIS; leaves > 1; leaves = (leaves + 1) / 2)
+    {
+        ++levels;
+    }
+    
+    return levels;
+}
+
+static inline glm::vec3 binScale(const BuildNode* node)
+{
+    glm::vec3 extent = node->centroids.max - node->centroids.min;
+    glm::vec3 scale;
+    
+    for(int32_t axis = 0; axis < 3; ++axis)
+    {
+        scale[axis] = extent[axis] > 0 ? (BVH_NUM_BINS * 0.9999f) / extent[axis] : 0;
+    }
+    
+    return scale;
+}
+
+static inline uint32_t binIndex(const BuildNode* node, glm::vec3 scale, glm::vec3 c, int32_t axis)
+{
+    uint32_t bin = (uint32_t)((c[axis] - node->centroids.min[axis]) * scale[axis]);
+    return bin < BVH_NUM_BINS ? bin : BVH_NUM_BINS - 1;
+}
+
+static void binTris(BuildState* state, const BuildNode* node, uint32_t first, uint32_t count, Bin bins[3][BVH_NUM_BINS])
+{
+    glm::vec3 scale = binScale(node);
+    
+    binsReset(bins);
+    
+    for(uint32_t i = first; i < first + count; ++i)
+    {
+        const BuildRef* ref = &state->refs[i];
+        glm::vec3 c = centroid(ref);
+        
+        for(int32_t axis = 0; axis < 3; ++axis)
+        {
+            Bin* bin = &bins[axis][binIndex(node, scale, c, axis)];
+            boundsGrow(&bin->bounds, ref->min, ref->max);
+            boundsGrow(&bin->centroids, c, c);
+            bin->count += 1;
+        }
+    }
+}
+
+static void binJobMain(void* data)
+{
+    BinJob* job = (BinJob*)data;
+    binTris(job->state, job->node, job->first, job->count, job->bins);
+}
+    
+static void binNode(BuildState* state, const BuildNode* node, Bin bins[3][BVH_NUM_BINS])
+{
+    BinJob jobs[BVH_MAX_BIN_JOBS];
+    std::atomic<int32_t> remaining(0);
+    uint32_t numJobs;
+    uint32_t chunk;
+    
+    if(!state->pool || node->count < BVH_PARALLEL_BIN_THRESHOLD)
+    {
+        binTris(state, node, node->first, node->count, bins);
+        return;
+    }
+    
+    numJobs = std::min(state->pool->numThreads + 1, (uint32_t)BVH_MAX_BIN_JOBS);
+    chunk = (node->count + numJobs - 1) / numJobs;
+    
+    for(uint32_t i = 0; i < numJobs; ++i)
+    {
+        jobs[i].state = state;
+        jobs[i].node = node;
+        jobs[i].first = node->first + std::min(i * chunk, node->count);
+        jobs[i].count = std::min(chunk, node->count - std::min(i * chunk, node->count));
+        threadPoolSubmit(state->pool, binJobMain, &jobs[i], &remaining);
+    }
+    
+    threadPoolWait(state->pool, &remaining);
+    
+    binsReset(bins);
+    for(uint32_t i = 0; i < numJobs; ++i)
+    {
+        for(int32_t axis = 0; axis < 3; ++axis)
+        {
+            for(int32_t j = 0; j < BVH_NUM_BINS; ++j)
+            {
+                boundsGrow(&bins[axis][j].bounds, jobs[i].bins[axis][j].bounds.min, jobs[i].bins[axis][j].bounds.max);
+                boundsGrow(&bins[axis][j].centroids, jobs[i].bins[axis][j].centroids.min, jobs[i].bins[axis][j].centroids.max);
+                bins[axis][j].count += jobs[i].bins[axis][j].count;
+            }
+        }
+    }
+}
+
+static inline void initChild(BuildNode* child, const Bin* bins, int32_t begin, int32_t end, uint32_t first)
+{
+    boundsReset(&child->bounds);
+    boundsReset(&child->centroids);
+    child->first = first;
+    child->count = 0;
+    
+    for(int32_t i = begin; i < end; ++i)
+    {
+        boundsGrow(&child->bounds, bins[i].bounds.min, bins[i].bounds.max);
+        boundsGrow(&child->centroids, bins[i].centroids.min, bins[i].centroids.max);
+        child->count += bins[i].count;
+    }
+}
+
+static inline void initChildFromTris(BuildState* state, BuildNode* child, uint32_t first, uint32_t count)
+{
+    boundsReset(&child->bounds);
+    boundsReset(&child->centroids);
+    child->first = first;
+    child->count = count;
+    
+    for(uint32_t i = first; i < first + count; ++i)
+    {
+        glm::vec3 c = centroid(&state->refs[i]);
+        boundsGrow(&child->bounds, state->refs[i].min, state->refs[i].max);
+        boundsGrow(&child->centroids, c, c);
+    }
+}
+
+static bool splitNode(BuildState* state, BuildNode* node, BuildNode* children)
+{
+    Bin bins[3][BVH_NUM_BINS];
+    float leftArea[BVH_NUM_BINS - 1];
+    uint32_t leftCount[BVH_NUM_BINS - 1];
+    float nodeArea = bvhSurfaceArea(node->bounds.min, node->bounds.max);
+    float invArea = nodeArea > 0 ? 1.0f / nodeArea : 0;
+    float bestCost = 1e30f;
+    float leafCost = BVH_INTERSECT_COST * node->count;
+    int32_t bestAxis = -1;
+    int32_t bestSplit = 0;
+    uint32_t bestLeftCount = 0;
+    glm::vec3 extent = node->centroids.max - node->centroids.min;
+    glm::vec3 scale;
+    BuildRef* refBegin;
+    BuildRef* refMid;
+    
+    if(node->count <= 1) return false;
+    
+    binNode(state, node, bins);
+    
+    for(int32_t axis = 0; axis < 3; ++axis)
+    {
+        Bounds bounds;
+        uint32_t count = 0;
+        
+        if(extent[axis] <= 0) continue;
+        
+        boundsReset(&bounds);
+        for(int32_t i = 0; i < BVH_NUM_BINS - 1; ++i)
+        {
+            boundsGrow(&bounds, bins[axis][i].bounds.min, bins[axis][i].bounds.max);
+            count += bins[axis][i].count;
+            leftArea[i] = count ? bvhSurfaceArea(bounds.min, bounds.max) : 0;
+            leftCount[i] = count;
+        }
+        
+        boundsReset(&bounds);
+        count = 0;
+        for(int32_t i = BVH_NUM_BINS - 1; i > 0; --i)
+        {
+            boundsGrow(&bounds, bins[axis][i].bounds.min, bins[axis][i].bounds.max);
+            count += bins[axis][i].count;
+            
+            if(!count || !leftCount[i - 1]) continue;
+            
+            float cost = BVH_TRAVERSAL_COST + BVH_INTERSECT_COST * invArea *
+                (leftArea[i - 1] * leftCount[i - 1] + bvhSurfaceArea(bounds.min, bounds.max) * count);
+            
+            if(cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = i;
+                bestLeftCount = leftCount[i - 1];
+            }
+        }
+    }
+    
+    if(bestAxis < 0)
+    {
+        if(node->count <= BVH_MAX_LEAF_TRIS) return false;
+    
+        initChildFromTris(state, &children[0], node->first, node->count / 2);
+        initChildFromTris(state, &children[1], node->first + node->count / 2, node->count - node->count / 2);
+        return true;
+    }
+    
+    if(bestCost >= leafCost && node->count <= BVH_MAX_LEAF_TRIS) return false;
+    
+    /*Every node keeps depth + medianLevels(count) <= BVH_STACK_SIZE.  A split too lopsided for
+      the levels left falls back to the centroid median on the longest axis, which halves the
+      count and so always fits, and a node with no levels left is a leaf.*/
+    if(node->depth + 1 + medianLevels(std::max(bestLeftCount, node->count - bestLeftCount)) > BVH_STACK_SIZE)
+    {
+        if(node->count <= BVH_MAX_LEAF_TRIS) return false;
+        
+        int32_t axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+        
+        refBegin = state->refs + node->first;
+        std::nth_element(refBegin, refBegin + node->count / 2, refBegin + node->count,
+            [axis](const BuildRef& a, const BuildRef& b)
+            {
+                return a.min[axis] + a.max[axis] < b.min[axis] + b.max[axis];
+            });
+        
+        initChildFromTris(state, &children[0], node->first, node->count / 2);
+        initChildFromTris(state, &children[1], node->first + node->count / 2, node->count - node->count / 2);
+        return true;
+    }
+    
+    scale = binScale(node);
+    refBegin = state->refs + node->first;
+    refMid = std::partition(refBegin, refBegin + node->count,
+        [node, scale, bestAxis, bestSplit](const BuildRef& ref)
+        {
+            return binIndex(node, scale, centroid(&ref), bestAxis) < (uint32_t)bestSplit;
+        });
+    
+    initChild(&children[0], bins[bestAxis], 0, bestSplit, node->first);
+    initChild(&children[1], bins[bestAxis], bestSplit, BVH_NUM_BINS, node->first + (uint32_t)(refMid - refBegin));
+    
+    return true;
+}
+
+static void subdivide(BuildState* state, uint32_t root);
+
+static void buildTaskMain(void* data)
+{
+    BuildTask* task = (BuildTask*)data;
+    subdivide(task->state, task->node);
+    free(task);
+}
+
+static void subdivide(BuildState* state, uint32_t root)
+{
+    std::vector<uint32_t> stack;
+    BuildNode children[2];
+    
+    stack.push_back(root);
+    
+    while(!stack.empty())
+    {
+        uint32_t nodeIndex = stack.back();
+        BuildNode* node = &state->nodes[nodeIndex];
+        stack.pop_back();
+        
+        node->left = 0;
+        if(!splitNode(state, node, children)) continue;
+        
+        uint32_t pair = state->numNodes.fetch_add(2);
+        children[0].depth = node->depth + 1;
+        children[1].depth = node->depth + 1;
+        state->nodes[pair] = children[0];
+        state->nodes[pair + 1] = children[1];
+        node->left = pair;
+        node->count = 0;
+        
+        if(state->pool && children[1].count > BVH_TASK_THRESHOLD)
+        {
+            BuildTask* task = (BuildTask*)malloc(sizeof(BuildTask));
+            task->state = state;
+            task->node = pair + 1;
+            threadPoolSubmit(state->pool, buildTaskMain, task, &state->pending);
+        }
+        else
+        {
+            stack.push_back(pair + 1);
+        }
+        
+        stack.push_back(pair);
+    }
+}
+
+static void flatten(BuildState* state)
+{
+    BVH* bvh = state->bvh;
+    std::vector<uint32_t> stack;
+    uint32_t next = 1;
+    
+    stack.push_back(0);
+    stack.push_back(0);
+    
+    while(!stack.empty())
+    {
+        uint32_t out = stack.back();
+        stack.pop_back();
+        const BuildNode* node = &state->nodes[stack.back()];
+        stack.pop_back();
+        
+        bvh->nodes[out].min = node->bounds.min;
+        bvh->nodes[out].max = node->bounds.max;
+        
+        if(node->count)
+        {
+            bvh->nodes[out].leftFirst = node->first;
+            bvh->nodes[out].count = node->count;
+            continue;
+        }
+        
+        bvh->nodes[out].leftFirst = next;
+        bvh->nodes[out].count = 0;
+        
+        stack.push_back(node->left + 1);
+        stack.push_back(next + 1);
+        stack.push_back(node->left);
+        stack.push_back(next);
+        next += 2;
+    }
+    
+    bvh->numNodes = next;
+}
+
+/*Builds the nodes over refs and writes the primitive of every leaf slot to triIndices*/
+static int32_t buildNodes(BVH* bvh, BuildRef* refs, uint32_t numPrims, ThreadPool* pool)
+{
+    BuildState state;
+    
+    bvh->numTris = numPrims;
+    bvh->numNodes = 1;
+    bvh->nodes = (BVHNode*)malloc(bvhMaxNodes(numPrims) * sizeof(BVHNode));
+    bvh->triIndices = (uint32_t*)malloc(numPrims * sizeof(uint32_t));
+    if(!bvh->nodes || !bvh->triIndices) return -1;
+    
+    state.bvh = bvh;
+    state.pool = pool;
+    state.refs = refs;
+    state.numNodes = 1;
+    state.pending = 0;
+    state.nodes = (BuildNode*)malloc(bvhMaxNodes(numPrims) * sizeof(BuildNode));
+    if(!state.nodes) return -2;
+    
+    initChildFromTris(&state, &state.nodes[0], 0, numPrims);
+    state.nodes[0].depth = 0;
+    
+    if(numPrims)
+    {
+        subdivide(&state, 0);
+        threadPoolWait(pool, &state.pending);
+        flatten(&state);
+    }
+    else
+    {
+        bvh->nodes[0].min = glm::vec3(1e30f);
+        bvh->nodes[0].max = glm::vec3(-1e30f);
+        bvh->nodes[0].leftFirst = 0;
+        bvh->nodes[0].count = 0;
+    }
+    
+    for(uint32_t i = 0; i < numPrims; ++i)
+    {
+        bvh->triIndices[i] = refs[i].tri;
+    }
+    
+    free(state.nodes);
+    
+    return 0;
+}
+
+int32_t bvhBuild(BVH* bvh, const Vertex* vertices, const uint32_t* indices, uint32_t numTris, ThreadPool* pool)
+{
+    BuildRef* refs;
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    
+    bvh->triangles = (uint32_t*)malloc(4 * numTris * sizeof(uint32_t));
+    refs = (BuildRef*)malloc(numTris * sizeof(BuildRef));
+    if(!bvh->triangles || !refs) return -1;
+    
+    for(uint32_t i = 0; i < numTris; ++i)
+    {
+        glm::vec3 v0 = glm::vec3(vertices[indices[3 * i]].position);
+        glm::vec3 v1 = glm::vec3(vertices[indices[3 * i + 1]].position);
+        glm::vec3 v2 = glm::vec3(vertices[indices[3 * i + 2]].position);
+        
+        refs[i].min = glm::min(glm::min(v0, v1), v2);
+        refs[i].max = glm::max(glm::max(v0, v1), v2);
+        refs[i].tri = i;
+    }
+    
+    if(buildNodes(bvh, refs, numTris, pool))
+    {
+        free(refs);
+        return -2;
+    }
+    
+    for(uint32_t i = 0; i < numTris; ++i)
+    {
+        bvh->triangles[4 * i] = indices[3 * bvh->triIndices[i]];
+        bvh->triangles[4 * i + 1] = indices[3 * bvh->triIndices[i] + 1];
+        bvh->triangles[4 * i + 2] = indices[3 * bvh->triIndices[i] + 2];
+        bvh->triangles[4 * i + 3] = 0;
+    }
+    
+    free(refs);
+    
+    bvh->buildMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    bvh->sahCost = bvhSAHCost(bvh);
+    
+    return 0;
+}
+
+int32_t bvhBuildBounds(BVH* bvh, const glm::vec3* mins, const glm::vec3* maxs, uint32_t numPrims, ThreadPool* pool)
+{
+    BuildRef* refs;
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    
+    bvh->triangles = NULL;
+    refs = (BuildRef*)malloc(numPrims * sizeof(BuildRef));
+    if(!refs) return -1;
+    
+    for(uint32_t i = 0; i < numPrims; ++i)
+    {
+        refs[i].min = mins[i];
+        refs[i].max = maxs[i];
+        refs[i].tri = i;
+    }
+    
+    if(buildNodes(bvh, refs, numPrims, pool))
+    {
+        free(refs);
+        return -2;
+    }
+    
+    free(refs);
+    
+    bvh->buildMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    bvh->sahCost = bvhSAHCost(bvh);
+    
+    return 0;
+}
+
+float bvhSAHCost(const BVH* bvh)
+{
+    float rootArea = bvhSurfaceArea(bvh->nodes[0].min, bvh->nodes[0].max);
+    float cost = 0;
+    
+    if(rootArea <= 0) return 0;
+    
+    for(uint32_t i = 0; i < bvh->numNodes; ++i)
+    {
+        float area = bvhSurfaceArea(bvh->nodes[i].min, bvh->nodes[i].max);
+        cost += bvh->nodes[i].count ? BVH_INTERSECT_COST * area * bvh->nodes[i].count : BVH_TRAVERSAL_COST * area;
+    }
+    
+    return cost / rootArea;
+}
+
+/*Opens the interior child with the largest surface area until the wide node is full, so
+  children[0] starting as the binary node itself also covers a leaf root.  Traversal pushes
+  all but one interior child, so an opening is skipped if an interior child would no longer
+  fit its binary height into the stack entries left.  heights[index] <= budget holds for every
+  node collapsed, and any tree does by binary opening alone.*/
+static uint32_t collapseNode(const BVH* bvh, uint32_t index, BVHWideNode* wideNodes, uint32_t* numWide, int32_t nodeOffset, int32_t triOffset,
+    const uint32_t* heights, uint32_t budget)
+{
+    const BVHNode* node = &bvh->nodes[index];
+    uint32_t wideIndex = (*numWide)++;
+    BVHWideNode* wide = &wideNodes[wideIndex];
+    uint32_t children[BVH_WIDTH];
+    uint32_t numChildren = 1;
+    uint32_t numInterior = 0;
+    glm::vec3 step;
+    
+    children[0] = index;
+    
+    while(numChildren < BVH_WIDTH)
+    {
+        int32_t best = -1;
+        float bestArea = -1.0f;
+        uint32_t opened[BVH_WIDTH];
+        uint32_t numOpened = 0;
+        bool fits = true;
+        
+        for(uint32_t i = 0; i < numChildren; ++i)
+        {
+            const BVHNode* child = &bvh->nodes[children[i]];
+            float area = bvhSurfaceArea(child->min, child->max);
+            
+            if(!child->count && area > bestArea)
+            {
+                best = (int32_t)i;
+                bestArea = area;
+            }
+        }
+        
+        if(best < 0) break;
+        
+        for(uint32_t i = 0; i < numChildren; ++i)
+        {
+            if(i != (uint32_t)best) opened[numOpened++] = children[i];
+        }
+        
+        opened[numOpened++] = bvh->nodes[children[best]].leftFirst;
+        opened[numOpened++] = bvh->nodes[children[best]].leftFirst + 1;
+        numInterior = 0;
+        
+        for(uint32_t i = 0; i < numOpened; ++i)
+        {
+            if(!bvh->nodes[opened[i]].count) ++numInterior;
+        }
+        
+        for(uint32_t i = 0; i < numOpened; ++i)
+        {
+            if(!bvh->nodes[opened[i]].count && heights[opened[i]] + numInterior - 1 > budget) fits = false;
+        }
+        
+        if(!fits) break;
+        
+        children[numChildren++] = bvh->nodes[children[best]].leftFirst + 1;
+        children[best] = bvh->nodes[children[best]].leftFirst;
+    }
+    
+    numInterior = 0;
+    
+    for(uint32_t i = 0; i < numChildren; ++i)
+    {
+        if(!bvh->nodes[children[i]].count) ++numInterior;
+    }
+    
+    *wide = {};
+    wide->origin = node->min;
+    wide->numChildren = numChildren;
+    
+    //254 leaves a step of slack for rounding at the top of the range
+    for(int32_t axis = 0; axis < 3; ++axis)
+    {
+        int32_t exponent;
+        
+        frexpf((node->max[axis] - node->min[axis]) / 254.0f, &exponent);
+        exponent = glm::clamp(exponent, -126, 127);
+        step[axis] = ldexpf(1.0f, exponent);
+        wide->exponents |= (uint32_t)(exponent + 127) << (8 * axis);
+    }
+    
+    for(uint32_t i = 0; i < BVH_WIDTH; ++i)
+    {
+        wide->children[i] = -1;
+    }
+    
+    for(uint32_t i = 0; i < numChildren; ++i)
+    {
+        const BVHNode* child = &bvh->nodes[children[i]];
+        
+        for(int32_t axis = 0; axis < 3; ++axis)
+        {
+            float lo = floorf((child->min[axis] - wide->origin[axis]) / step[axis]);
+            float hi = ceilf((child->max[axis] - wide->origin[axis]) / step[axis]);
+            
+            //Keep the decoded bounds conservative
+            if(wide->origin[axis] + lo * step[axis] > child->min[axis]) lo -= 1.0f;
+            if(wide->origin[axis] + hi * step[axis] < child->max[axis]) hi += 1.0f;
+            
+            wide->qlo[axis] |= (uint32_t)glm::clamp(lo, 0.0f, 255.0f) << (8 * i);
+            wide->qhi[axis] |= (uint32_t)glm::clamp(hi, 0.0f, 255.0f) << (8 * i);
+        }
+        
+        if(child->count)
+        {
+            wide->children[i] = child->leftFirst + triOffset;
+            wide->leafCounts |= (uint32_t)child->count << (8 * i);
+        }
+        else
+        {
+            wide->children[i] = (int32_t)collapseNode(bvh, children[i], wideNodes, numWide, nodeOffset, triOffset, heights,
+                budget - (numInterior - 1)) + nodeOffset;
+        }
+    }
+    
+    return wideIndex;
+}
+
+uint32_t bvhCollapseWide(const BVH* bvh, BVHWideNode* wideNodes, int32_t nodeOffset, int32_t triOffset)
+{
+    std::vector<uint32_t> heights(bvh->numNodes, 0);
+    uint32_t numWide = 0;
+    
+    //Children are flattened after their parents
+    for(uint32_t i = bvh->numNodes; i-- > 0 && bvh->numNodes > 1;)
+    {
+        const BVHNode* node = &bvh->nodes[i];
+        
+        if(!node->count) heights[i] = 1 + std::max(heights[node->leftFirst], heights[node->leftFirst + 1]);
+    }
+    
+    collapseNode(bvh, 0, wideNodes, &numWide, nodeOffset, triOffset, heights.data(), BVH_STACK_SIZE);
+    
+    return numWide;
+}
+
+void bvhDestroy(BVH* bvh)
+{
+    free(bvh->nodes);
+    free(bvh->triIndices);
+    free(bvh->triangles);
+    
+    bvh->nodes = NULL;
+    bvh->triIndices = NULL;
+    bvh->triangles = NULL;
+    bvh->numNodes = 0;
+    bvh->numTris = 0;
+}
+
+int32_t bvhBuildImage(BLASImage* image, const Vertex* vertices, const uint32_t* const* indices, const uint32_t* numTris,
+    uint32_t numMeshes, ThreadPool* pool)
+{
+    BVH blas = {};
+    uint32_t maxNodes = 0;
+    uint32_t maxTris = 0;
+    int32_t res = 0;
+    
+    *image = {};
+    
+    for(uint32_t i = 0; i < numMeshes; ++i)
+    {
+        maxNodes += bvhMaxNodes(numTris[i]);
+        maxTris += numTris[i];
+    }
+    
+    image->triangles = (uint32_t*)malloc(4 * maxTris * sizeof(uint32_t));
+    image->records = (TriangleRecord*)malloc(maxTris * sizeof(TriangleRecord));
+    image->nodes = (BVHNode*)malloc(maxNodes * sizeof(BVHNode));
+    image->wideNodes = (BVHWideNode*)malloc(maxNodes * sizeof(BVHWideNode));
+    image->ranges = (BLASRange*)malloc(numMeshes * sizeof(BLASRange));
+    image->numMeshes = numMeshes;
+    
+    if(!image->triangles || !image->records || !image->nodes || !image->wideNodes || !image->ranges)
+    {
+        bvhDestroyImage(image);
+        return -1;
+    }
+    
+    for(uint32_t i = 0; i < numMeshes; ++i)
+    {
+        BLASRange* range = &image->ranges[i];
+        
+        if(bvhBuild(&blas, vertices, indices[i], numTris[i], pool))
+        {
+            res = -2;
+            break;
+        }
+        
+        DEBUG_PRINT("BLAS %u: %u triangles, %u nodes, SAH cost %f, built in %f ms\n", i, blas.numTris, blas.numNodes, blas.sahCost, blas.buildMs);
+        
+        for(uint32_t j = 0; j < blas.numNodes; ++j)
+        {
+            image->nodes[image->numNodes + j] = blas.nodes[j];
+            image->nodes[image->numNodes + j].leftFirst += blas.nodes[j].count ? image->numTris : image->numNodes;
+        }
+        
+        memcpy(&image->triangles[4 * image->numTris], blas.triangles, 4 * blas.numTris * sizeof(uint32_t));
+        
+        for(uint32_t j = image->numTris; j < image->numTris + blas.numTris; ++j)
+        {
+            uint32_t* tri = &image->triangles[4 * j];
+            glm::vec3 p0 = glm::vec3(vertices[tri[0]].position);
+            glm::vec3 e1 = glm::vec3(vertices[tri[1]].position) - p0;
+            glm::vec3 e2 = glm::vec3(vertices[tri[2]].position) - p0;
+            glm::vec3 vertexNormals = glm::vec3(vertices[tri[0]].normal + vertices[tri[1]].normal + vertices[tri[2]].normal);
+            float facing = 1.0f;
+            
+            if(glm::dot(glm::cross(e1, e2), vertexNormals) < 0)
+            {
+                tri[3] |= TRIANGLE_FLIPPED;
+                facing = -1.0f;
+            }
+            
+            image->records[j].v0 = glm::vec4(p0, facing);
+            image->records[j].e1 = glm::vec4(e1, 0.0f);
+            image->records[j].e2 = glm::vec4(e2, 0.0f);
+        }
+        
+        range->min = blas.nodes[0].min;
+        range->root = image->numNodes;
+        range->max = blas.nodes[0].max;
+        range->numTris = blas.numTris;
+        range->firstTri = image->numTris;
+        range->wideRoot = image->numWideNodes;
+        
+        image->numWideNodes += bvhCollapseWide(&blas, &image->wideNodes[image->numWideNodes], image->numWideNodes, image->numTris);
+        image->numNodes += blas.numNodes;
+        image->numTris += blas.numTris;
+        bvhDestroy(&blas);
+    }
+    
+    bvhDestroy(&blas);
+    
+    if(res) bvhDestroyImage(image);
+    
+    return res;
+}
+
+void bvhDestroyImage(BLASImage* image)
+{
+    free(image->triangles);
+    free(image->records);
+    free(image->nodes);
+    free(image->wideNodes);
+    free(image->ranges);
+    
+    *image = {};
+}
@@ -0,0 +1,155 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <stdint.h>
+#include <glm/glm.hpp>
+
+#include "threadPool.hpp"
+#include "vertex.hpp"
+
+#define BVH_MAX_LEAF_TRIS 4
+/*Traversal stack entries in the shaders.  No leaf is built deeper than this and wide nodes are
+  collapsed so their pushes fit, so nodes are never dropped.  Must match trace.glsl.*/
+#define BVH_STACK_SIZE 32
+#define BVH_NUM_BINS 16
+#define BVH_TRAVERSAL_COST 1.0f
+#define BVH_INTERSECT_COST 1.0f
+#define BVH_WIDTH 4
+/*Set in BVHInstance::blasRoot when it indexes the wide BLAS nodes.  Must match trace.glsl.*/
+#define BLAS_ROOT_WIDE 0x80000000
+
+/*Matches BVHNode in the shaders (std430).  Interior nodes have count == 0 and store
+  their two children next to each other starting at leftFirst.  Leaves store the first
+  triangle in leftFirst.*/
+typedef struct
+{
+    glm::vec3 min;
+    int32_t leftFirst;
+    glm::vec3 max;
+    int32_t count;
+}
+BVHNode;
+
+/*Matches WideBVHNode in the shaders (std430).  Up to BVH_WIDTH children whose bounds are
+  quantized to bytes relative to the node's bounds.  Byte i of qlo and qhi holds child i on
+  that axis in steps of 2^(exponent - 127), with the exponents packed one byte per axis, so
+  a child spans origin + qlo * step to origin + qhi * step.  Leaf children have their
+  triangle count in byte i of leafCounts and the first triangle in children[i], interior
+  children a count of 0 and their node index.  Unused slots hold -1.*/
+typedef struct
+{
+    glm::vec3 origin;
+    uint32_t exponents;
+    uint32_t qlo[3];
+    uint32_t leafCounts;
+    uint32_t qhi[3];
+    uint32_t numChildren;
+    int32_t children[BVH_WIDTH];
+}
+BVHWideNode;
+
+/*Matches Instance in the shaders (std430).  min and max are the object space bounds of the
+  mesh BLAS starting at node blasRoot, whose leaves hold triangles firstTri to
+  firstTri + numTris - 1.  reflectivity and roughness are the object's material so
+  reflection hits can keep bouncing off reflective surfaces only.*/
+typedef struct
+{
+    glm::mat4 objectToWorld;
+    glm::mat4 worldToObject;
+    glm::vec3 min;
+    uint32_t blasRoot;
+    glm::vec3 max;
+    int32_t textureUnit;
+    uint32_t firstTri;
+    uint32_t numTris;
+    float reflectivity;
+    float roughness;
+}
+BVHInstance;
+
+/*nodes are flattened depth first and triangles holds the vertex indices of each triangle
+  in leaf order laid out like Triangle in the shaders, so both can be uploaded as is.
+  triIndices holds the source primitive of every leaf slot.  Trees built from bounds have
+  no triangles, their leaves index whatever the bounds came from in triIndices order.*/
+typedef struct
+{
+    BVHNode* nodes;
+    uint32_t* triIndices;
+    uint32_t* triangles;
+    uint32_t numNodes;
+    uint32_t numTris;
+    
+    float sahCost;
+    float buildMs;
+}
+BVH;
+
+/*Where one mesh's BLAS lies in a BLASImage.  min and max are its object space bounds, root and
+  wideRoot its binary and wide root nodes and its leaves hold triangles firstTri to
+  firstTri + numTris - 1.*/
+typedef struct
+{
+    glm::vec3 min;
+    uint32_t root;
+    glm::vec3 max;
+    uint32_t numTris;
+    uint32_t firstTri;
+    uint32_t wideRoot;
+}
+BLASRange;
+
+/*The BLAS of several meshes back to back, laid out like the shared triangle, triangle record,
+  node and wide node buffers.  Child and triangle indices are offset so every BLAS indexes the
+  whole buffers directly.*/
+typedef struct
+{
+    uint32_t* triangles;
+    TriangleRecord* records;
+    BVHNode* nodes;
+    BVHWideNode* wideNodes;
+    BLASRange* ranges;
+    uint32_t numTris;
+    uint32_t numNodes;
+    uint32_t numWideNodes;
+    uint32_t numMeshes;
+}
+BLASImage;
+
+int32_t bvhBuild(BVH* bvh, const Vertex* vertices, const uint32_t* indices, uint32_t numTris, ThreadPool* pool);
+int32_t bvhBuildBounds(BVH* bvh, const glm::vec3* mins, const glm::vec3* maxs, uint32_t numPrims, ThreadPool* pool);
+float bvhSAHCost(const BVH* bvh);
+/*Collapses a triangle BVH into BVH_WIDTH wide nodes starting at wideNodes, which needs room
+  for bvh->numNodes nodes, and returns how many were written.  Child node and triangle
+  indices are offset by nodeOffset and triOffset so several trees can share a buffer.  Nodes
+  are opened less eagerly where traversing them could push more than BVH_STACK_SIZE children.*/
+uint32_t bvhCollapseWide(const BVH* bvh, BVHWideNode* wideNodes, int32_t nodeOffset, int32_t triOffset);
+void bvhDestroy(BVH* bvh);
+/*Builds the BLAS of mesh i from the numTris[i] triangles of global vertex indices in indices[i]*/
+int32_t bvhBuildImage(BLASImage* image, const Vertex* vertices, const uint32_t* const* indices, const uint32_t* numTris,
+    uint32_t numMeshes, ThreadPool* pool);
+void bvhDestroyImage(BLASImage* image);
+
+static inline uint32_t bvhMaxNodes(uint32_t numTris)
+{
+    return numTris ? 2 * numTris - 1 : 1;
+}
+
+static inline float bvhSurfaceArea(glm::vec3 min, glm::vec3 max)
+{
+    glm::vec3 d = glm::max(max - min, glm::vec3(0.0f));
+    return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+static inline void bvhTransformBounds(glm::vec3 min, glm::vec3 max, const glm::mat4& transform, glm::vec3* outMin, glm::vec3* outMax)
+{
+    glm::vec3 center = glm::vec3(transform * glm::vec4((min + max) * 0.5f, 1.0f));
+    glm::vec3 extent = (max - min) * 0.5f;
+    glm::vec3 worldExtent = glm::abs(glm::vec3(transform[0])) * extent.x +
+        glm::abs(glm::vec3(transform[1])) * extent.y +
+        glm::abs(glm::vec3(transform[2])) * extent.z;
+    
+    *outMin = center - worldExtent;
+    *outMax = center + worldExtent;
+}
+
+#endif //BVH_H
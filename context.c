@@ -99,7 +99,7 @@ static inline VkResult createInstance(Context* context)
     vkEnumerateInstanceExtensionProperties(NULL, &supportedExtensionCount, NULL);
     VkExtensionProperties extensionsAvailable[supportedExtensionCount];
     vkEnumerateInstanceExtensionProperties(NULL, &supportedExtensionCount, extensionsAvailable);
-
+    
     uint32_t foundExtensions = 0;
     for(uint32_t i = 0; i < supportedExtensionCount; ++i)
     {
@@ -119,7 +119,7 @@ static inline VkResult createInstance(Context* context)
     appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
     appInfo.pApplicationName = "Ray";
     appInfo.engineVersion = 1;
-    appInfo.apiVersion = VK_MAKE_VERSION(1, 0, 0);
+    appInfo.apiVersion = VK_MAKE_VERSION(1, 1, 0);
     
     return vkCreateInstance(&createInfo, NULL, &context->_instance);
 }
@@ -129,6 +129,9 @@ static inline int32_t pickPhysicalDevice(VkPhysicalDevice* devices, int32_t numD
     VkPhysicalDeviceProperties deviceProperties;
     VkPhysicalDeviceMemoryProperties memoryProperties;
     VkPhysicalDeviceFeatures deviceFeatures;
+    VkPhysicalDeviceProperties2 deviceProperties2 = {};
+    VkPhysicalDeviceSubgroupProperties subgroupProperties = {};
+    VkSubgroupFeatureFlags subgroupOps = VK_SUBGROUP_FEATURE_BALLOT_BIT | VK_SUBGROUP_FEATURE_ARITHMETIC_BIT;
     uint64_t deviceMemory = 0;
     int isDiscrete = 0;
     int32_t physicalDeviceIndex = -1;
@@ -143,6 +146,18 @@ static inline int32_t pickPhysicalDevice(VkPhysicalDevice* devices, int32_t numD
         
         
         vkGetPhysicalDeviceProperties(devices[i], &deviceProperties);
+        
+        /*triCast.frag adds up its ray counters with subgroup ballots and sums*/
+        if(deviceProperties.apiVersion < VK_MAKE_VERSION(1, 1, 0)) continue;
+        
+        subgroupProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES;
+        deviceProperties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        deviceProperties2.pNext = &subgroupProperties;
+        vkGetPhysicalDeviceProperties2(devices[i], &deviceProperties2);
+        
+        if(!(subgroupProperties.supportedStages & VK_SHADER_STAGE_FRAGMENT_BIT)) continue;
+        if((subgroupProperties.supportedOperations & subgroupOps) != subgroupOps) continue;
+        
         if(deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU)
         {
             isDiscrete = 1;
@@ -157,7 +172,6 @@ static inline int32_t pickPhysicalDevice(VkPhysicalDevice* devices, int32_t numD
         }
         
         
-        
         vkGetPhysicalDeviceQueueFamilyProperties(devices[i], &numQueueFamilies, NULL);
         VkQueueFamilyProperties queueFamilyProperties[numQueueFamilies];
         vkGetPhysicalDeviceQueueFamilyProperties(devices[i], &numQueueFamilies, queueFamilyProperties);
@@ -192,6 +206,11 @@ static inline int32_t pickPhysicalDevice(VkPhysicalDevice* devices, int32_t numD
     return physicalDeviceIndex;
 }
 
+static inline uint64_t timestampMask(uint32_t validBits)
+{
+    return validBits >= 64 ? ~(uint64_t)0 : ((uint64_t)1 << validBits) - 1;
+}
+
 static inline void pickQueueFamilies(Context* context)
 {
     uint32_t numQueueFamilies;
@@ -229,6 +248,9 @@ static inline void pickQueueFamilies(Context* context)
         if(!context->_tfrFamily && queueFamilyProperties[i].queueFlags & VK_QUEUE_TRANSFER_BIT) context->_tfrFamily = i;
         if(context->_gfxFamily && context->_cmpFamily && context->_tfrFamily) break;
     }
+    
+    context->gfxTimestampMask = timestampMask(queueFamilyProperties[context->_gfxFamily].timestampValidBits);
+    context->cmpTimestampMask = timestampMask(queueFamilyProperties[context->_cmpFamily].timestampValidBits);
 }
 
 static inline VkResult createDevice(Context* context)
@@ -259,6 +281,7 @@ static inline VkResult createDevice(Context* context)
     vkGetPhysicalDeviceMemoryProperties(devices[physicalDeviceIndex], &context->physicalDeviceMemory);
     vkGetPhysicalDeviceFeatures(devices[physicalDeviceIndex], &context->_physicalDeviceFeatures);
     context->_physicalDevice = devices[physicalDeviceIndex];
+    context->timestampPeriod = context->_physicalDeviceProperties.limits.timestampPeriod;
     
     DEBUG_PRINT("GPU selected: %d\nIs discrete GPU: %d\n", physicalDeviceIndex, context->_physicalDeviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU);
     
@@ -386,7 +409,7 @@ int32_t bindWindowContext(Context* context, void* window)
     {
         numDesiredImages = surfaceCapabilities.maxImageCount;
     }
-
+    
     surfaceResolution = surfaceCapabilities.currentExtent;
     if(surfaceResolution.width == -1)
     {
@@ -398,7 +421,11 @@ int32_t bindWindowContext(Context* context, void* window)
         context->width = surfaceResolution.width;
         context->height = surfaceResolution.height;
     }
-
+    
+    /*Transfer lets the compute reflection path blit its output to the back buffer*/
+    context->presentUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+        (surfaceCapabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+    
     preTransform = surfaceCapabilities.currentTransform;
     if(surfaceCapabilities.supportedTransforms & VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR)
     {
@@ -427,7 +454,7 @@ int32_t bindWindowContext(Context* context, void* window)
     swapchainInfo.imageColorSpace = colorSpace;
     swapchainInfo.imageExtent = surfaceResolution;
     swapchainInfo.imageArrayLayers = 1;
-    swapchainInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    swapchainInfo.imageUsage = context->presentUsage;
     swapchainInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
     swapchainInfo.preTransform = preTransform;
     swapchainInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
@@ -504,10 +531,10 @@ int32_t setupRender(Context* context)
             transitionBarrier.image = context->presentImages[i];
             VkImageSubresourceRange resourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
             transitionBarrier.subresourceRange = resourceRange;
-
+            
             vkCmdPipelineBarrier(context->setupCmdBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
                 VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, 0, NULL, 0, NULL, 1, &transitionBarrier);
-
+            
         }
         vkEndCommandBuffer(context->setupCmdBuffer);
         
@@ -10,7 +10,7 @@ extern "C"
 #else /*__cplusplus*/
 #include <stdbool.h>    
 #endif /*__cplusplus*/
-
+    
 /*Do not modify any of the values in here.  Values not prefixed with an underscore may be read externally*/
 typedef struct
 {
@@ -47,10 +47,15 @@ typedef struct
     VkPhysicalDevice _physicalDevice;
     VkPhysicalDeviceProperties _physicalDeviceProperties;
     VkPhysicalDeviceMemoryProperties physicalDeviceMemory;
+    float timestampPeriod;
+    /*Bits of a timestamp written on the graphics or compute queue that hold the time*/
+    uint64_t gfxTimestampMask;
+    uint64_t cmpTimestampMask;
     VkPhysicalDeviceFeatures _physicalDeviceFeatures;
     VkSurfaceKHR _surface;
     VkSwapchainKHR _swapchain;
     VkFormat colorFormat;
+    VkImageUsageFlags presentUsage;
     
     VkSemaphore presentSemaphore;
     
@@ -62,15 +67,15 @@ typedef struct
 #endif /*NDEUBG*/
 }
 Context;
-
+    
 int32_t createContext(Context* context);
 int32_t bindWindowContext(Context* context, void* window);
 int32_t setupRender(Context* context);
-
+    
 void cleanupRender(Context* context);
 void unbindWindowContext(Context* context);
 void destroyContext(Context* context);
-
+    
 static inline uint32_t getFamilies(Context* context, uint32_t* families)
 {
     families[0] = context->_gfxFamily;
@@ -79,9 +84,15 @@ static inline uint32_t getFamilies(Context* context, uint32_t* families)
     
     return context->_numFamilies;
 }
-
+    
+/*Images and buffers used from more than one queue family are shared concurrently instead of transferring ownership*/
+static inline VkSharingMode getSharingMode(Context* context)
+{
+    return context->_numFamilies > 1 ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE;
+}
+    
 static inline void waitIdle(Context* context){vkDeviceWaitIdle(context->device);}
-
+    
 static inline uint32_t getNextImage(Context* context, VkSemaphore semaphore)
 {
     uint32_t nextImage;
@@ -89,7 +100,7 @@ static inline uint32_t getNextImage(Context* context, VkSemaphore semaphore)
     
     return nextImage;
 }
-
+    
 static inline void swapBuffers(Context* context, uint32_t nextImage, VkSemaphore* waitSemaphores, uint32_t numWaitSemaphores)
 {
     VkPresentInfoKHR presentInfo = {};    
@@ -103,12 +114,12 @@ static inline void swapBuffers(Context* context, uint32_t nextImage, VkSemaphore
     presentInfo.pResults = NULL;
     vkQueuePresentKHR(context->gfxQueue, &presentInfo);
 }
-
+    
 static inline uint32_t getAtomSize(Context* context)
 {
     return context->_physicalDeviceProperties.limits.nonCoherentAtomSize;
 }
-
+    
 #ifdef __cplusplus
 };
 #endif /*__cplusplus*/
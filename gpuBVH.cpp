@@ -0,0 +1,338 @@
+#include "gpuBVH.hpp"
+
+#include <stdint.h>
+#include <string.h>
+#include <vulkan/vulkan.h>
+
+#include "bvh.hpp"
+#include "context.h"
+#include "shaderStorageBuffer.hpp"
+#include "utilMacros.h"
+
+static inline int32_t createBuffers(GPUBVHBuilder* builder, Context* context)
+{
+    uint32_t numPrims = builder->numPrims;
+    
+    if(shaderStorageBufferCreate(&builder->_sceneBounds, context, 8 * sizeof(uint32_t))) return -1;
+    
+    for(int32_t i = 0; i < 2; ++i)
+    {
+        if(shaderStorageBufferCreate(&builder->_keys[i], context, numPrims * sizeof(uint32_t))) return -1;
+        if(shaderStorageBufferCreate(&builder->_values[i], context, numPrims * sizeof(uint32_t))) return -1;
+    }
+    
+    if(shaderStorageBufferCreate(&builder->_histogram, context, (1 << GPU_BVH_RADIX_BITS) * builder->_numGroups * sizeof(uint32_t))) return -1;
+    if(shaderStorageBufferCreate(&builder->_parents, context, bvhMaxNodes(numPrims) * sizeof(int32_t))) return -1;
+    if(shaderStorageBufferCreate(&builder->_slots, context, 2 * numPrims * sizeof(int32_t))) return -1;
+    if(shaderStorageBufferCreate(&builder->_flags, context, bvhMaxNodes(numPrims) * sizeof(uint32_t))) return -1;
+    if(shaderStorageBufferCreate(&builder->_refitState, context, sizeof(GPUBVHRefitState), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT)) return -1;
+    if(shaderStorageBufferCreate(&builder->_sahPartials, context, builder->_numNodeGroups * sizeof(float))) return -1;
+    
+    return 0;
+}
+
+static inline int32_t createDescriptors(GPUBVHBuilder* builder, Context* context)
+{
+    VkDescriptorSetLayoutBinding bindings[11] = {};
+    VkDescriptorSetLayoutCreateInfo setLayoutInfo = {};
+    VkDescriptorPoolSize poolSize = {};
+    VkDescriptorPoolCreateInfo descriptorPoolInfo = {};
+    VkDescriptorSetAllocateInfo descriptorAllocInfo = {};
+    VkDescriptorBufferInfo descriptorBufferInfos[11] = {};
+    VkWriteDescriptorSet writeDescriptor = {};
+    ShaderStorageBuffer* buffers[11] =
+    {
+        &builder->_sceneBounds,
+        &builder->_keys[0],
+        &builder->_values[0],
+        &builder->_keys[1],
+        &builder->_values[1],
+        &builder->_histogram,
+        &builder->_parents,
+        &builder->_slots,
+        &builder->_flags,
+        &builder->_refitState,
+        &builder->_sahPartials
+    };
+    VkResult result;
+    
+    for(int32_t i = 0; i < LENGTH_OF(bindings); ++i)
+    {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+    
+    setLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    setLayoutInfo.bindingCount = LENGTH_OF(bindings);
+    setLayoutInfo.pBindings = bindings;
+    
+    result = vkCreateDescriptorSetLayout(context->device, &setLayoutInfo, NULL, &builder->_descLayout);
+    if(result != VK_SUCCESS) return -1;
+    
+    poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSize.descriptorCount = LENGTH_OF(bindings);
+    
+    descriptorPoolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descriptorPoolInfo.maxSets = 1;
+    descriptorPoolInfo.poolSizeCount = 1;
+    descriptorPoolInfo.pPoolSizes = &poolSize;
+    
+    result = vkCreateDescriptorPool(context->device, &descriptorPoolInfo, NULL, &builder->_descPool);
+    if(result != VK_SUCCESS) return -2;
+    
+    descriptorAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    descriptorAllocInfo.descriptorPool = builder->_descPool;
+    descriptorAllocInfo.descriptorSetCount = 1;
+    descriptorAllocInfo.pSetLayouts = &builder->_descLayout;
+    
+    result = vkAllocateDescriptorSets(context->device, &descriptorAllocInfo, &builder->_descSet);
+    if(result != VK_SUCCESS) return -3;
+    
+    for(int32_t i = 0; i < LENGTH_OF(buffers); ++i)
+    {
+        descriptorBufferInfos[i].buffer = buffers[i]->buffer;
+        descriptorBufferInfos[i].offset = 0;
+        descriptorBufferInfos[i].range = buffers[i]->size;
+    }
+    
+    writeDescriptor.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writeDescriptor.dstSet = builder->_descSet;
+    writeDescriptor.dstBinding = 0;
+    writeDescriptor.dstArrayElement = 0;
+    writeDescriptor.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writeDescriptor.descriptorCount = LENGTH_OF(descriptorBufferInfos);
+    writeDescriptor.pBufferInfo = descriptorBufferInfos;
+    
+    vkUpdateDescriptorSets(context->device, 1, &writeDescriptor, 0, NULL);
+    
+    return 0;
+}
+
+int32_t gpuBVHBuilderCreate(GPUBVHBuilder* builder, Context* context, const char* src, uint32_t len,
+    VkDescriptorSetLayout sharedLayout, const uint32_t* specData)
+{
+    VkShaderModuleCreateInfo shaderInfo = {};
+    VkPipelineLayoutCreateInfo layoutInfo = {};
+    VkDescriptorSetLayout descLayouts[2] = {};
+    VkPushConstantRange pushConstantRange = {};
+    VkComputePipelineCreateInfo pipelineInfo = {};
+    VkSpecializationInfo specMap = {};
+    VkSpecializationMapEntry specEntries[6] = {};
+    uint32_t stageSpecData[6] = {specData[0], specData[1], specData[2], GPU_BVH_GROUP_SIZE, 0, 0};
+    float refitThreshold = GPU_BVH_REFIT_THRESHOLD;
+    VkResult result;
+    
+    memcpy(&stageSpecData[5], &refitThreshold, sizeof(float));
+    
+    builder->numPrims = specData[0];
+    builder->_numGroups = (builder->numPrims + GPU_BVH_GROUP_SIZE - 1) / GPU_BVH_GROUP_SIZE;
+    builder->_numNodeGroups = (bvhMaxNodes(builder->numPrims) + GPU_BVH_GROUP_SIZE - 1) / GPU_BVH_GROUP_SIZE;
+    
+    if(createBuffers(builder, context)) return -1;
+    if(createDescriptors(builder, context)) return -2;
+    
+    shaderInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    shaderInfo.codeSize = len;
+    shaderInfo.pCode = (uint32_t*)src;
+    
+    result = vkCreateShaderModule(context->device, &shaderInfo, NULL, &builder->_shader);
+    if(result != VK_SUCCESS) return -3;
+    
+    descLayouts[0] = builder->_descLayout;
+    descLayouts[1] = sharedLayout;
+    
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(GPUBVHSortPass);
+    
+    layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    layoutInfo.setLayoutCount = 2;
+    layoutInfo.pSetLayouts = descLayouts;
+    layoutInfo.pushConstantRangeCount = 1;
+    layoutInfo.pPushConstantRanges = &pushConstantRange;
+    
+    result = vkCreatePipelineLayout(context->device, &layoutInfo, NULL, &builder->_pipelineLayout);
+    if(result != VK_SUCCESS) return -4;
+    
+    for(int32_t i = 0; i < LENGTH_OF(specEntries); ++i)
+    {
+        specEntries[i].constantID = i;
+        specEntries[i].offset = i * sizeof(uint32_t);
+        specEntries[i].size = sizeof(uint32_t);
+    }
+    
+    specMap.mapEntryCount = LENGTH_OF(specEntries);
+    specMap.pMapEntries = specEntries;
+    specMap.dataSize = sizeof(stageSpecData);
+    specMap.pData = stageSpecData;
+    
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = builder->_shader;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.stage.pSpecializationInfo = &specMap;
+    pipelineInfo.layout = builder->_pipelineLayout;
+    pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+    pipelineInfo.basePipelineIndex = 0;
+    
+    /*Every stage is the same module specialized on constant 4*/
+    for(uint32_t i = 0; i < GPU_BVH_NUM_STAGES; ++i)
+    {
+        stageSpecData[4] = i;
+        result = vkCreateComputePipelines(context->device, VK_NULL_HANDLE, 1, &pipelineInfo, NULL, &builder->_pipelines[i]);
+        if(result != VK_SUCCESS) return -5;
+    }
+    
+    return 0;
+}
+
+static inline void computeBarrier(VkCommandBuffer cmdBuffer, VkPipelineStageFlags srcStage, VkAccessFlags srcAccess)
+{
+    VkMemoryBarrier barrier = {};
+    
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    
+    vkCmdPipelineBarrier(cmdBuffer, srcStage, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+}
+
+static inline void dispatchStage(GPUBVHBuilder* builder, VkCommandBuffer cmdBuffer, uint32_t stage, uint32_t numGroups)
+{
+    vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, builder->_pipelines[stage]);
+    vkCmdDispatch(cmdBuffer, numGroups, 1, 1);
+    computeBarrier(cmdBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+}
+
+/*Indirect rebuild stages take their group counts from dispatchArgs[argIndex]*/
+static inline void dispatchRebuildStage(GPUBVHBuilder* builder, VkCommandBuffer cmdBuffer, uint32_t stage,
+    uint32_t numGroups, uint32_t argIndex, bool indirect)
+{
+    vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, builder->_pipelines[stage]);
+    
+    if(indirect)
+    {
+        vkCmdDispatchIndirect(cmdBuffer, builder->_refitState.buffer, argIndex * sizeof(VkDispatchIndirectCommand));
+    }
+    else
+    {
+        vkCmdDispatch(cmdBuffer, numGroups, 1, 1);
+    }
+    
+    if(stage != GPU_BVH_STAGE_BOUNDS)
+    {
+        computeBarrier(cmdBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+    }
+}
+
+static inline void beginRecord(GPUBVHBuilder* builder, VkCommandBuffer cmdBuffer, VkDescriptorSet sharedSet)
+{
+    vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+        builder->_pipelineLayout, 0, 1, &builder->_descSet, 0, NULL);
+    vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+        builder->_pipelineLayout, 1, 1, &sharedSet, 0, NULL);
+}
+
+static inline void recordRebuild(GPUBVHBuilder* builder, VkCommandBuffer cmdBuffer, bool indirect)
+{
+    GPUBVHSortPass sortPass;
+    uint32_t hierarchyGroups = (builder->numPrims + GPU_BVH_GROUP_SIZE - 2) / GPU_BVH_GROUP_SIZE;
+    
+    vkCmdFillBuffer(cmdBuffer, builder->_sceneBounds.buffer, 0, 4 * sizeof(uint32_t), 0xffffffff);
+    vkCmdFillBuffer(cmdBuffer, builder->_sceneBounds.buffer, 4 * sizeof(uint32_t), 4 * sizeof(uint32_t), 0);
+    computeBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+    
+    dispatchRebuildStage(builder, cmdBuffer, GPU_BVH_STAGE_SCENE_BOUNDS, builder->_numGroups, 0, indirect);
+    dispatchRebuildStage(builder, cmdBuffer, GPU_BVH_STAGE_MORTON, builder->_numGroups, 0, indirect);
+    
+    /*Even number of passes so the sorted keys end up back in _keys[0]*/
+    for(uint32_t i = 0; i < GPU_BVH_SORT_PASSES; ++i)
+    {
+        sortPass.shift = i * GPU_BVH_RADIX_BITS;
+        sortPass.flip = i & 1;
+        vkCmdPushConstants(cmdBuffer, builder->_pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(sortPass), &sortPass);
+        
+        dispatchRebuildStage(builder, cmdBuffer, GPU_BVH_STAGE_SORT_COUNT, builder->_numGroups, 0, indirect);
+        dispatchRebuildStage(builder, cmdBuffer, GPU_BVH_STAGE_SORT_SCAN, 1, 1, indirect);
+        dispatchRebuildStage(builder, cmdBuffer, GPU_BVH_STAGE_SORT_SCATTER, builder->_numGroups, 0, indirect);
+    }
+    
+    if(indirect || builder->numPrims > 1)
+    {
+        dispatchRebuildStage(builder, cmdBuffer, GPU_BVH_STAGE_HIERARCHY, hierarchyGroups, 2, indirect);
+    }
+    
+    dispatchRebuildStage(builder, cmdBuffer, GPU_BVH_STAGE_BOUNDS, builder->_numGroups, 0, indirect);
+}
+
+void gpuBVHBuilderRecord(GPUBVHBuilder* builder, VkCommandBuffer cmdBuffer, VkDescriptorSet sharedSet)
+{
+    beginRecord(builder, cmdBuffer, sharedSet);
+    recordRebuild(builder, cmdBuffer, false);
+}
+
+void gpuBVHBuilderRecordRefit(GPUBVHBuilder* builder, VkCommandBuffer cmdBuffer, VkDescriptorSet sharedSet)
+{
+    VkMemoryBarrier indirectBarrier = {};
+    
+    beginRecord(builder, cmdBuffer, sharedSet);
+    
+    dispatchStage(builder, cmdBuffer, GPU_BVH_STAGE_REFIT_LINKS, builder->_numNodeGroups);
+    dispatchStage(builder, cmdBuffer, GPU_BVH_STAGE_REFIT, builder->_numNodeGroups);
+    dispatchStage(builder, cmdBuffer, GPU_BVH_STAGE_SAH, builder->_numNodeGroups);
+    
+    vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, builder->_pipelines[GPU_BVH_STAGE_REFIT_DECIDE]);
+    vkCmdDispatch(cmdBuffer, 1, 1, 1);
+    
+    indirectBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    indirectBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    indirectBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    
+    vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &indirectBarrier, 0, NULL, 0, NULL);
+    
+    recordRebuild(builder, cmdBuffer, true);
+}
+
+int32_t gpuBVHBuilderResetRefit(GPUBVHBuilder* builder, Context* context, uint32_t numNodes)
+{
+    GPUBVHRefitState state = {};
+    
+    state.resetReference = 1;
+    state.numNodes = numNodes;
+    
+    return shaderStorageBufferWrite(&builder->_refitState, context, &state, sizeof(state));
+}
+
+void gpuBVHBuilderDestroy(GPUBVHBuilder* builder, Context* context)
+{
+    for(uint32_t i = 0; i < GPU_BVH_NUM_STAGES; ++i)
+    {
+        vkDestroyPipeline(context->device, builder->_pipelines[i], NULL);
+    }
+    
+    vkDestroyPipelineLayout(context->device, builder->_pipelineLayout, NULL);
+    vkDestroyShaderModule(context->device, builder->_shader, NULL);
+    
+    vkResetDescriptorPool(context->device, builder->_descPool, 0);
+    vkDestroyDescriptorPool(context->device, builder->_descPool, NULL);
+    vkDestroyDescriptorSetLayout(context->device, builder->_descLayout, NULL);
+    
+    shaderStorageBufferDestroy(&builder->_sceneBounds, context);
+    
+    for(int32_t i = 0; i < 2; ++i)
+    {
+        shaderStorageBufferDestroy(&builder->_keys[i], context);
+        shaderStorageBufferDestroy(&builder->_values[i], context);
+    }
+    
+    shaderStorageBufferDestroy(&builder->_histogram, context);
+    shaderStorageBufferDestroy(&builder->_parents, context);
+    shaderStorageBufferDestroy(&builder->_slots, context);
+    shaderStorageBufferDestroy(&builder->_flags, context);
+    shaderStorageBufferDestroy(&builder->_refitState, context);
+    shaderStorageBufferDestroy(&builder->_sahPartials, context);
+}
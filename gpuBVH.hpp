@@ -0,0 +1,96 @@
+#ifndef GPU_BVH_H
+#define GPU_BVH_H
+
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+#include "context.h"
+#include "shaderStorageBuffer.hpp"
+
+#define GPU_BVH_GROUP_SIZE 128
+#define GPU_BVH_RADIX_BITS 4
+#define GPU_BVH_SORT_PASSES 8
+#define GPU_BVH_REFIT_THRESHOLD 1.5f
+
+/*Must match the stage constants in lbvh.comp*/
+#define GPU_BVH_STAGE_SCENE_BOUNDS 0
+#define GPU_BVH_STAGE_MORTON 1
+#define GPU_BVH_STAGE_SORT_COUNT 2
+#define GPU_BVH_STAGE_SORT_SCAN 3
+#define GPU_BVH_STAGE_SORT_SCATTER 4
+#define GPU_BVH_STAGE_HIERARCHY 5
+#define GPU_BVH_STAGE_BOUNDS 6
+#define GPU_BVH_STAGE_REFIT_LINKS 7
+#define GPU_BVH_STAGE_REFIT 8
+#define GPU_BVH_STAGE_SAH 9
+#define GPU_BVH_STAGE_REFIT_DECIDE 10
+#define GPU_BVH_NUM_STAGES 11
+
+typedef struct
+{
+    uint32_t shift;
+    uint32_t flip;
+}
+GPUBVHSortPass;
+
+/*Matches RefitState in lbvh.comp.  dispatchArgs are the group counts of the per instance,
+  single group and hierarchy rebuild stages, or zero when the refit tree is still good.*/
+typedef struct
+{
+    VkDispatchIndirectCommand dispatchArgs[3];
+    float referenceSAH;
+    float currentSAH;
+    uint32_t resetReference;
+    uint32_t rebuilds;
+    uint32_t numNodes;
+}
+GPUBVHRefitState;
+
+/*Linear BVH over the instances built on the device every frame as the TLAS.  The world
+  bounds of every instance come from its transform and BLAS bounds in the InstanceBuffer.
+  Instances are sorted by the Morton code of their centroid and the hierarchy is emitted in
+  the same layout bvhBuild uses (children of internal node i at 1 + 2i), so the reflection
+  pass traverses either one without changes.  Leaves hold one instance each and index the
+  InstanceBuffer as it is, so it is never reordered.
+  
+  Refitting keeps the current topology, whichever builder made it, and only recomputes
+  the bounds bottom up.  The SAH cost of the refit tree is compared on the device against
+  the cost right after the last rebuild and the rebuild stages are dispatched indirectly
+  once it grows past GPU_BVH_REFIT_THRESHOLD times that.*/
+typedef struct
+{
+    VkShaderModule _shader;
+    VkDescriptorSetLayout _descLayout;
+    VkDescriptorPool _descPool;
+    VkDescriptorSet _descSet;
+    VkPipelineLayout _pipelineLayout;
+    VkPipeline _pipelines[GPU_BVH_NUM_STAGES];
+    
+    ShaderStorageBuffer _sceneBounds;
+    ShaderStorageBuffer _keys[2];
+    ShaderStorageBuffer _values[2];
+    ShaderStorageBuffer _histogram;
+    ShaderStorageBuffer _parents;
+    ShaderStorageBuffer _slots;
+    ShaderStorageBuffer _flags;
+    ShaderStorageBuffer _refitState;
+    ShaderStorageBuffer _sahPartials;
+    
+    uint32_t numPrims;
+    uint32_t _numGroups;
+    uint32_t _numNodeGroups;
+}
+GPUBVHBuilder;
+
+/*specData holds numObjs, numVerts and numTris like the graphics pipelines and the TLAS is
+  built over the numObjs instances.  sharedLayout is bound as set 1 and its TLAS and
+  instance bindings must be visible to the compute stage.*/
+int32_t gpuBVHBuilderCreate(GPUBVHBuilder* builder, Context* context, const char* src, uint32_t len,
+    VkDescriptorSetLayout sharedLayout, const uint32_t* specData);
+void gpuBVHBuilderRecord(GPUBVHBuilder* builder, VkCommandBuffer cmdBuffer, VkDescriptorSet sharedSet);
+void gpuBVHBuilderRecordRefit(GPUBVHBuilder* builder, VkCommandBuffer cmdBuffer, VkDescriptorSet sharedSet);
+/*Call after uploading a tree of numNodes nodes to refit, before the first refit frame*/
+int32_t gpuBVHBuilderResetRefit(GPUBVHBuilder* builder, Context* context, uint32_t numNodes);
+void gpuBVHBuilderDestroy(GPUBVHBuilder* builder, Context* context);
+
+#endif //GPU_BVH_H
@@ -0,0 +1,361 @@
+#include "gpuPrimitives.hpp"
+
+#include <stdint.h>
+#include <string.h>
+#include <vulkan/vulkan.h>
+
+#include "context.h"
+#include "shaderStorageBuffer.hpp"
+#include "utilMacros.h"
+
+static inline int32_t createBuffers(GPUPrimitives* prims, Context* context)
+{
+    uint32_t maxElements = prims->maxElements;
+    uint32_t scanSize = GPU_PRIMITIVES_RADIX_SIZE * gpuPrimitivesNumGroups(maxElements);
+    
+    /*The scan buffer also holds the digit major histogram of every sort group*/
+    if(scanSize < maxElements) scanSize = maxElements;
+    
+    for(int32_t i = 0; i < 2; ++i)
+    {
+        if(shaderStorageBufferCreate(&prims->keys[i], context, maxElements * sizeof(uint32_t))) return -1;
+        if(shaderStorageBufferCreate(&prims->values[i], context, maxElements * sizeof(uint32_t))) return -1;
+    }
+    
+    if(shaderStorageBufferCreate(&prims->scan, context, scanSize * sizeof(uint32_t))) return -1;
+    if(shaderStorageBufferCreate(&prims->_groupSums, context, gpuPrimitivesNumGroups(scanSize) * sizeof(uint32_t))) return -1;
+    if(shaderStorageBufferCreate(&prims->total, context, sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_SRC_BIT)) return -1;
+    
+    return 0;
+}
+
+static inline int32_t createDescriptors(GPUPrimitives* prims, Context* context, VkBuffer camPosBuffer, VkBuffer gatherSrc, VkBuffer gatherDst)
+{
+    VkDescriptorSetLayoutBinding bindings[10] = {};
+    VkDescriptorSetLayoutCreateInfo setLayoutInfo = {};
+    VkDescriptorPoolSize poolSizes[2] = {};
+    VkDescriptorPoolCreateInfo descriptorPoolInfo = {};
+    VkDescriptorSetAllocateInfo descriptorAllocInfo = {};
+    VkDescriptorBufferInfo descriptorBufferInfos[9] = {};
+    VkDescriptorBufferInfo camPosInfo = {};
+    VkWriteDescriptorSet writeDescriptors[2] = {};
+    VkBuffer buffers[9] =
+    {
+        prims->keys[0].buffer,
+        prims->values[0].buffer,
+        prims->keys[1].buffer,
+        prims->values[1].buffer,
+        prims->scan.buffer,
+        prims->_groupSums.buffer,
+        prims->total.buffer,
+        gatherSrc,
+        gatherDst
+    };
+    VkResult result;
+    
+    /*Keys and values ping pong, scan, group sums, total, gather source and destination and the camera*/
+    for(int32_t i = 0; i < LENGTH_OF(bindings); ++i)
+    {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+    
+    bindings[9].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    
+    setLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    setLayoutInfo.bindingCount = LENGTH_OF(bindings);
+    setLayoutInfo.pBindings = bindings;
+    
+    result = vkCreateDescriptorSetLayout(context->device, &setLayoutInfo, NULL, &prims->_descLayout);
+    if(result != VK_SUCCESS) return -1;
+    
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[0].descriptorCount = LENGTH_OF(buffers);
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    poolSizes[1].descriptorCount = 1;
+    
+    descriptorPoolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descriptorPoolInfo.maxSets = 1;
+    descriptorPoolInfo.poolSizeCount = LENGTH_OF(poolSizes);
+    descriptorPoolInfo.pPoolSizes = poolSizes;
+    
+    result = vkCreateDescriptorPool(context->device, &descriptorPoolInfo, NULL, &prims->_descPool);
+    if(result != VK_SUCCESS) return -2;
+    
+    descriptorAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    descriptorAllocInfo.descriptorPool = prims->_descPool;
+    descriptorAllocInfo.descriptorSetCount = 1;
+    descriptorAllocInfo.pSetLayouts = &prims->_descLayout;
+    
+    result = vkAllocateDescriptorSets(context->device, &descriptorAllocInfo, &prims->_descSet);
+    if(result != VK_SUCCESS) return -3;
+    
+    for(int32_t i = 0; i < LENGTH_OF(buffers); ++i)
+    {
+        descriptorBufferInfos[i].buffer = buffers[i];
+        descriptorBufferInfos[i].offset = 0;
+        descriptorBufferInfos[i].range = VK_WHOLE_SIZE;
+    }
+    
+    camPosInfo.buffer = camPosBuffer;
+    camPosInfo.offset = 0;
+    camPosInfo.range = VK_WHOLE_SIZE;
+    
+    for(int32_t i = 0; i < LENGTH_OF(writeDescriptors); ++i)
+    {
+        writeDescriptors[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writeDescriptors[i].dstSet = prims->_descSet;
+        writeDescriptors[i].dstArrayElement = 0;
+    }
+    
+    writeDescriptors[0].dstBinding = 0;
+    writeDescriptors[0].descriptorCount = LENGTH_OF(descriptorBufferInfos);
+    writeDescriptors[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writeDescriptors[0].pBufferInfo = descriptorBufferInfos;
+    
+    writeDescriptors[1].dstBinding = 9;
+    writeDescriptors[1].descriptorCount = 1;
+    writeDescriptors[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    writeDescriptors[1].pBufferInfo = &camPosInfo;
+    
+    vkUpdateDescriptorSets(context->device, LENGTH_OF(writeDescriptors), writeDescriptors, 0, NULL);
+    
+    return 0;
+}
+
+int32_t gpuPrimitivesCreate(GPUPrimitives* prims, Context* context, const char* src, uint32_t len, VkDescriptorSetLayout sharedLayout,
+    const uint32_t* specData, uint32_t maxElements, VkBuffer camPosBuffer, VkBuffer gatherSrc, VkBuffer gatherDst)
+{
+    VkShaderModuleCreateInfo shaderInfo = {};
+    VkPipelineLayoutCreateInfo layoutInfo = {};
+    VkDescriptorSetLayout descLayouts[2] = {};
+    VkPushConstantRange pushConstantRange = {};
+    VkComputePipelineCreateInfo pipelineInfo = {};
+    VkSpecializationInfo specMap = {};
+    VkSpecializationMapEntry specEntries[5] = {};
+    uint32_t stageSpecData[5] = {specData[0], specData[1], specData[2], GPU_PRIMITIVES_GROUP_SIZE, 0};
+    VkResult result;
+    
+    prims->maxElements = maxElements;
+    prims->_numObjs = specData[0];
+    prims->_numTris = specData[2];
+    
+    if(createBuffers(prims, context)) return -1;
+    if(createDescriptors(prims, context, camPosBuffer, gatherSrc, gatherDst)) return -2;
+    
+    shaderInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    shaderInfo.codeSize = len;
+    shaderInfo.pCode = (uint32_t*)src;
+    
+    result = vkCreateShaderModule(context->device, &shaderInfo, NULL, &prims->_shader);
+    if(result != VK_SUCCESS) return -3;
+    
+    descLayouts[0] = prims->_descLayout;
+    descLayouts[1] = sharedLayout;
+    
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(GPUPrimitivesParams);
+    
+    layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    layoutInfo.setLayoutCount = 2;
+    layoutInfo.pSetLayouts = descLayouts;
+    layoutInfo.pushConstantRangeCount = 1;
+    layoutInfo.pPushConstantRanges = &pushConstantRange;
+    
+    result = vkCreatePipelineLayout(context->device, &layoutInfo, NULL, &prims->_pipelineLayout);
+    if(result != VK_SUCCESS) return -4;
+    
+    for(int32_t i = 0; i < LENGTH_OF(specEntries); ++i)
+    {
+        specEntries[i].constantID = i;
+        specEntries[i].offset = i * sizeof(uint32_t);
+        specEntries[i].size = sizeof(uint32_t);
+    }
+    
+    specMap.mapEntryCount = LENGTH_OF(specEntries);
+    specMap.pMapEntries = specEntries;
+    specMap.dataSize = sizeof(stageSpecData);
+    specMap.pData = stageSpecData;
+    
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = prims->_shader;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.stage.pSpecializationInfo = &specMap;
+    pipelineInfo.layout = prims->_pipelineLayout;
+    pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+    pipelineInfo.basePipelineIndex = 0;
+    
+    /*Every stage is the same module specialized on constant 4*/
+    for(uint32_t i = 0; i < GPU_PRIMITIVES_NUM_STAGES; ++i)
+    {
+        stageSpecData[4] = i;
+        result = vkCreateComputePipelines(context->device, VK_NULL_HANDLE, 1, &pipelineInfo, NULL, &prims->_pipelines[i]);
+        if(result != VK_SUCCESS) return -5;
+    }
+    
+    return 0;
+}
+
+static inline void computeBarrier(VkCommandBuffer cmdBuffer)
+{
+    VkMemoryBarrier barrier = {};
+    
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    
+    vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+}
+
+static inline void dispatchStage(GPUPrimitives* prims, VkCommandBuffer cmdBuffer, uint32_t stage, const GPUPrimitivesParams* params, uint32_t numGroups)
+{
+    vkCmdPushConstants(cmdBuffer, prims->_pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(*params), params);
+    vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, prims->_pipelines[stage]);
+    vkCmdDispatch(cmdBuffer, numGroups, 1, 1);
+    computeBarrier(cmdBuffer);
+}
+
+/*Inputs written by transfers or earlier stages must be visible before the first stage*/
+static inline void beginRecord(GPUPrimitives* prims, VkCommandBuffer cmdBuffer)
+{
+    VkMemoryBarrier inputBarrier = {};
+    
+    inputBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    inputBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    inputBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    
+    vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &inputBarrier, 0, NULL, 0, NULL);
+    
+    vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+        prims->_pipelineLayout, 0, 1, &prims->_descSet, 0, NULL);
+}
+
+/*Reduce every group to _groupSums, scan those in one group and add them back to each group's own scan*/
+static inline void recordScan(GPUPrimitives* prims, VkCommandBuffer cmdBuffer, uint32_t count)
+{
+    GPUPrimitivesParams params = {};
+    uint32_t numGroups = gpuPrimitivesNumGroups(count);
+    
+    params.count = count;
+    
+    dispatchStage(prims, cmdBuffer, GPU_PRIMITIVES_STAGE_SCAN_REDUCE, &params, numGroups);
+    dispatchStage(prims, cmdBuffer, GPU_PRIMITIVES_STAGE_SCAN_GROUPS, &params, 1);
+    dispatchStage(prims, cmdBuffer, GPU_PRIMITIVES_STAGE_SCAN_DOWNSWEEP, &params, numGroups);
+}
+
+static inline void recordSort(GPUPrimitives* prims, VkCommandBuffer cmdBuffer, uint32_t count, uint32_t keyBits)
+{
+    GPUPrimitivesParams params = {};
+    uint32_t numGroups = gpuPrimitivesNumGroups(count);
+    uint32_t numPasses = (keyBits + GPU_PRIMITIVES_RADIX_BITS - 1) / GPU_PRIMITIVES_RADIX_BITS;
+    
+    /*Even number of passes so the sorted pairs end up back in keys[0] and values[0]*/
+    numPasses += numPasses & 1;
+    params.count = count;
+    
+    for(uint32_t i = 0; i < numPasses; ++i)
+    {
+        params.shift = i * GPU_PRIMITIVES_RADIX_BITS;
+        params.flip = i & 1;
+        
+        dispatchStage(prims, cmdBuffer, GPU_PRIMITIVES_STAGE_SORT_COUNT, &params, numGroups);
+        recordScan(prims, cmdBuffer, GPU_PRIMITIVES_RADIX_SIZE * numGroups);
+        dispatchStage(prims, cmdBuffer, GPU_PRIMITIVES_STAGE_SORT_SCATTER, &params, numGroups);
+    }
+}
+
+static inline void recordGather(GPUPrimitives* prims, VkCommandBuffer cmdBuffer, uint32_t count,
+    uint32_t srcStride, uint32_t dstStride, uint32_t words)
+{
+    GPUPrimitivesParams params = {};
+    
+    params.count = count;
+    params.srcStride = srcStride;
+    params.dstStride = dstStride;
+    params.words = words;
+    
+    dispatchStage(prims, cmdBuffer, GPU_PRIMITIVES_STAGE_GATHER, &params, gpuPrimitivesNumGroups(count));
+}
+
+void gpuPrimitivesRecordScan(GPUPrimitives* prims, VkCommandBuffer cmdBuffer, uint32_t count)
+{
+    beginRecord(prims, cmdBuffer);
+    recordScan(prims, cmdBuffer, count);
+}
+
+void gpuPrimitivesRecordCompact(GPUPrimitives* prims, VkCommandBuffer cmdBuffer, uint32_t count)
+{
+    GPUPrimitivesParams params = {};
+    
+    params.count = count;
+    
+    beginRecord(prims, cmdBuffer);
+    recordScan(prims, cmdBuffer, count);
+    dispatchStage(prims, cmdBuffer, GPU_PRIMITIVES_STAGE_COMPACT, &params, gpuPrimitivesNumGroups(count));
+}
+
+void gpuPrimitivesRecordSort(GPUPrimitives* prims, VkCommandBuffer cmdBuffer, uint32_t count, uint32_t keyBits)
+{
+    beginRecord(prims, cmdBuffer);
+    recordSort(prims, cmdBuffer, count, keyBits);
+}
+
+void gpuPrimitivesRecordGather(GPUPrimitives* prims, VkCommandBuffer cmdBuffer, uint32_t count,
+    uint32_t srcStride, uint32_t dstStride, uint32_t words)
+{
+    beginRecord(prims, cmdBuffer);
+    recordGather(prims, cmdBuffer, count, srcStride, dstStride, words);
+}
+
+/*Keys hold the mesh rank above shift and the top bits of the view depth below it, so a full
+  32 bit sort keeps every mesh's triangles in its own range of the index buffer.*/
+void gpuPrimitivesRecordTriangleOrder(GPUPrimitives* prims, VkCommandBuffer cmdBuffer, VkDescriptorSet sharedSet)
+{
+    GPUPrimitivesParams params = {};
+    uint32_t rankBits = 1;
+    
+    while(rankBits < 32 && (1u << rankBits) <= prims->_numObjs) ++rankBits;
+    
+    params.count = prims->_numTris;
+    params.shift = 32 - rankBits;
+    
+    beginRecord(prims, cmdBuffer);
+    vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+        prims->_pipelineLayout, 1, 1, &sharedSet, 0, NULL);
+    
+    dispatchStage(prims, cmdBuffer, GPU_PRIMITIVES_STAGE_TRIANGLE_KEYS, &params, gpuPrimitivesNumGroups(prims->_numTris));
+    recordSort(prims, cmdBuffer, prims->_numTris, 32);
+    recordGather(prims, cmdBuffer, prims->_numTris, 4, 3, 3);
+}
+
+void gpuPrimitivesDestroy(GPUPrimitives* prims, Context* context)
+{
+    for(uint32_t i = 0; i < GPU_PRIMITIVES_NUM_STAGES; ++i)
+    {
+        vkDestroyPipeline(context->device, prims->_pipelines[i], NULL);
+    }
+    
+    vkDestroyPipelineLayout(context->device, prims->_pipelineLayout, NULL);
+    vkDestroyShaderModule(context->device, prims->_shader, NULL);
+    
+    vkResetDescriptorPool(context->device, prims->_descPool, 0);
+    vkDestroyDescriptorPool(context->device, prims->_descPool, NULL);
+    vkDestroyDescriptorSetLayout(context->device, prims->_descLayout, NULL);
+    
+    for(int32_t i = 0; i < 2; ++i)
+    {
+        shaderStorageBufferDestroy(&prims->keys[i], context);
+        shaderStorageBufferDestroy(&prims->values[i], context);
+    }
+    
+    shaderStorageBufferDestroy(&prims->scan, context);
+    shaderStorageBufferDestroy(&prims->_groupSums, context);
+    shaderStorageBufferDestroy(&prims->total, context);
+}
@@ -0,0 +1,97 @@
+#ifndef GPU_PRIMITIVES_H
+#define GPU_PRIMITIVES_H
+
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+#include "context.h"
+#include "shaderStorageBuffer.hpp"
+
+/*At most 255 so the packed 8 bit digit counters of the sort cannot overflow*/
+#define GPU_PRIMITIVES_GROUP_SIZE 128
+#define GPU_PRIMITIVES_RADIX_BITS 4
+#define GPU_PRIMITIVES_RADIX_SIZE (1 << GPU_PRIMITIVES_RADIX_BITS)
+
+/*Must match the stage constants in sort.comp*/
+#define GPU_PRIMITIVES_STAGE_SCAN_REDUCE 0
+#define GPU_PRIMITIVES_STAGE_SCAN_GROUPS 1
+#define GPU_PRIMITIVES_STAGE_SCAN_DOWNSWEEP 2
+#define GPU_PRIMITIVES_STAGE_COMPACT 3
+#define GPU_PRIMITIVES_STAGE_SORT_COUNT 4
+#define GPU_PRIMITIVES_STAGE_SORT_SCATTER 5
+#define GPU_PRIMITIVES_STAGE_GATHER 6
+#define GPU_PRIMITIVES_STAGE_TRIANGLE_KEYS 7
+#define GPU_PRIMITIVES_NUM_STAGES 8
+
+/*Matches Params in sort.comp.  count is the number of elements a stage works on, shift and
+  flip select the digit and the ping pong direction of a sort pass and the strides and
+  words describe the records moved by a gather.*/
+typedef struct
+{
+    uint32_t count;
+    uint32_t shift;
+    uint32_t flip;
+    uint32_t srcStride;
+    uint32_t dstStride;
+    uint32_t words;
+}
+GPUPrimitivesParams;
+
+/*Data parallel building blocks recorded into a compute capable command buffer, each working
+  on up to maxElements uint32_t elements in the buffers below.  Callers fill the inputs with
+  their own stages, transfers or copies and read the results the same way.
+
+  Scan replaces scan with its exclusive prefix sum and writes the sum of all elements to
+  total.  Compaction scans 0 or 1 flags written to scan and moves the flagged pairs of
+  keys[0] and values[0], in order, to the front of keys[1] and values[1], leaving their
+  count in total.  Sort is a stable least significant digit radix sort of the pairs in
+  keys[0] and values[0] by key, and leaves them sorted in the same buffers.  Gather copies
+  words uint32_t of record values[0][i] of gatherSrc to record i of gatherDst, so a sorted
+  permutation can reorder any payload.
+
+  The triangle key stage is the first consumer.  It writes one key per ray tracing triangle
+  ordering each mesh's triangles front to back from the camera, so sorting and gathering the
+  shared index buffer gives an index buffer the G-buffer pass can draw with less overdraw.*/
+typedef struct
+{
+    VkShaderModule _shader;
+    VkDescriptorSetLayout _descLayout;
+    VkDescriptorPool _descPool;
+    VkDescriptorSet _descSet;
+    VkPipelineLayout _pipelineLayout;
+    VkPipeline _pipelines[GPU_PRIMITIVES_NUM_STAGES];
+    
+    ShaderStorageBuffer keys[2];
+    ShaderStorageBuffer values[2];
+    ShaderStorageBuffer scan;
+    ShaderStorageBuffer _groupSums;
+    ShaderStorageBuffer total;
+    
+    uint32_t maxElements;
+    uint32_t _numObjs;
+    uint32_t _numTris;
+}
+GPUPrimitives;
+
+static inline uint32_t gpuPrimitivesNumGroups(uint32_t count)
+{
+    return (count + GPU_PRIMITIVES_GROUP_SIZE - 1) / GPU_PRIMITIVES_GROUP_SIZE;
+}
+
+/*specData holds numObjs, numVerts and numTris like the graphics pipelines and sharedLayout is
+  bound as set 1 for the triangle key stage, which also reads viewProj from camPosBuffer.
+  gatherSrc and gatherDst are the buffers gpuPrimitivesRecordGather reads and writes.*/
+int32_t gpuPrimitivesCreate(GPUPrimitives* prims, Context* context, const char* src, uint32_t len, VkDescriptorSetLayout sharedLayout,
+    const uint32_t* specData, uint32_t maxElements, VkBuffer camPosBuffer, VkBuffer gatherSrc, VkBuffer gatherDst);
+void gpuPrimitivesRecordScan(GPUPrimitives* prims, VkCommandBuffer cmdBuffer, uint32_t count);
+void gpuPrimitivesRecordCompact(GPUPrimitives* prims, VkCommandBuffer cmdBuffer, uint32_t count);
+/*keyBits rounds up to a whole number of digits, an even number of passes is always run*/
+void gpuPrimitivesRecordSort(GPUPrimitives* prims, VkCommandBuffer cmdBuffer, uint32_t count, uint32_t keyBits);
+void gpuPrimitivesRecordGather(GPUPrimitives* prims, VkCommandBuffer cmdBuffer, uint32_t count,
+    uint32_t srcStride, uint32_t dstStride, uint32_t words);
+/*Keys, sorts and gathers the triangles in gatherSrc, four words each like the shared index
+  buffer, into gatherDst as three indices per triangle*/
+void gpuPrimitivesRecordTriangleOrder(GPUPrimitives* prims, VkCommandBuffer cmdBuffer, VkDescriptorSet sharedSet);
+void gpuPrimitivesDestroy(GPUPrimitives* prims, Context* context);
+
+#endif //GPU_PRIMITIVES_H
@@ -0,0 +1,1187 @@
+#include "mesh.hpp"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <vector>
+#include <glm/glm.hpp>
+#include <vulkan/vulkan.h>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else //_WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif //_WIN32
+
+#include "bvh.hpp"
+#include "optimize.hpp"
+#include "threadPool.hpp"
+#include "vertex.hpp"
+#include "utilMacros.h"
+#include "debugUtils.h"
+
+/*Set in ObjCorner::flags when reference i counts from the start of its chunk*/
+#define OBJ_RELATIVE(i) (1u << (i))
+/*Set in ObjCorner::flags when the corner has no texture coordinates or normal*/
+#define OBJ_MISSING(i) (8u << (i))
+#define OBJ_NO_VERTEX 0xffffffffu
+/*Mantissa digits past this are dropped and only shift the exponent*/
+#define OBJ_MAX_MANTISSA 100000000000000000ull
+/*Every section of a cooked file starts at a multiple of this*/
+#define COOKED_ALIGNMENT 16
+
+static const Vertex _defaultVertices[14] =
+{
+    {glm::vec4(-0.5f, 0, 0, 1), glm::vec4(-1, 0, 0, 0), glm::vec4(0, 0, 0, 0)},
+    {glm::vec4(0, 0, -0.5f, 1), glm::vec4(0, 0, -1, 0), glm::vec4(0, 1, 0, 0)},
+    {glm::vec4(0.5f, 0, 0, 1), glm::vec4(1, 0, 0, 0), glm::vec4(1, 1, 0, 0)},
+    {glm::vec4(0, 0, 0.5f, 1), glm::vec4(0, 0, 1, 0), glm::vec4(1, 0, 0, 0)},
+    {glm::vec4(0, -0.5f, 0, 1), glm::vec4(0, -1, 0, 0), glm::vec4(0.5f, 0.5f, 0, 0)},
+    {glm::vec4(0, 0.5f, 0, 1), glm::vec4(0, 1, 0, 0), glm::vec4(0.5f, 0.5f, 0, 0)},
+    {glm::vec4(-1, 1, -1, 1), glm::vec4(0.0f, -1.0f, 0.0f, 0.0f), glm::vec4(0, 0, 0, 0)},
+    {glm::vec4(1, 1, -1, 1), glm::vec4(0.0f, -1.0f, 0.0f, 0.0f), glm::vec4(1, 0, 0, 0)},
+    {glm::vec4(1, 1, 1, 1), glm::vec4(0.0f, -1.0f, 0.0f, 0.0f), glm::vec4(1, 1, 0, 0)},
+    {glm::vec4(-1, 1, 1, 1), glm::vec4(0.0f, -1.0f, 0.0f, 0.0f), glm::vec4(0, 1, 0, 0)},
+    {glm::vec4(-1, 1, 1, 1), glm::vec4(0.0f, 0.0f, -1.0f, 0.0f), glm::vec4(0, 1, 0, 0)},
+    {glm::vec4(1, 1, 1, 1), glm::vec4(0.0f, 0.0f, -1.0f, 0.0f), glm::vec4(1, 1, 0, 0)},
+    {glm::vec4(1, -1, 1, 1), glm::vec4(0.0f, 0.0f, -1.0f, 0.0f), glm::vec4(1, 0, 0, 0)},
+    {glm::vec4(-1, -1, 1, 1), glm::vec4(0.0f, 0.0f, -1.0f, 0.0f), glm::vec4(0, 0, 0, 0)}
+};
+
+static const uint32_t _defaultIndices[36] =
+{
+    0, 1, 4,
+    1, 2, 4,
+    2, 3, 4,
+    3, 0, 4,
+    1, 0, 5,
+    2, 1, 5,
+    3, 2, 5,
+    0, 3, 5,
+    6, 7, 8,
+    8, 9, 6,
+    10, 11, 12,
+    12, 13, 10,
+};
+
+static const VkDrawIndexedIndirectCommand _defaultDraws[2] =
+{
+    {24, 1, 0, 0, 0},
+    {12, 1, 24, 0, 1}
+};
+
+static const double _powersOf10[23] =
+{
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+typedef enum
+{
+    COOKED_VERTICES,
+    COOKED_INDICES,
+    COOKED_DRAWS,
+    COOKED_VERTEX_FORMATS,
+    COOKED_STORAGE_VERTICES,
+    COOKED_ATTRIBUTES,
+    COOKED_SORT_TRIANGLES,
+    COOKED_TRIANGLES,
+    COOKED_RECORDS,
+    COOKED_NODES,
+    COOKED_WIDE_NODES,
+    COOKED_RANGES,
+    COOKED_NUM_SECTIONS
+}
+CookedSection;
+
+/*Start of a cooked file.  offsets are from the start of the file and sizes in bytes, both are
+  checked against the counts so a truncated or mismatched file is refused before use.*/
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t numVertices;
+    uint32_t numIndices;
+    uint32_t numMeshes;
+    uint32_t indexType;
+    uint32_t numTris;
+    uint32_t numNodes;
+    uint32_t numWideNodes;
+    uint32_t _padding[3];
+    uint64_t offsets[COOKED_NUM_SECTIONS];
+    uint64_t sizes[COOKED_NUM_SECTIONS];
+}
+CookedHeader;
+
+/*refs are the position, texture coordinate and normal of a face corner.  Parsing leaves them
+  absolute or relative to the chunk as flagged, resolving makes them all absolute.*/
+typedef struct
+{
+    int32_t refs[3];
+    uint32_t flags;
+}
+ObjCorner;
+
+typedef struct
+{
+    char* text;
+    size_t length;
+    
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec2> texCoords;
+    std::vector<glm::vec3> normals;
+    std::vector<ObjCorner> corners;
+    /*Corners at which an o or g line starts a new mesh*/
+    std::vector<uint32_t> meshStarts;
+    
+    uint32_t bases[3];
+    const uint32_t* totals;
+    int32_t error;
+}
+ObjChunk;
+
+static inline bool isBlank(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+static inline bool endsKeyword(char c)
+{
+    return isBlank(c) || c == '\r' || c == '\n' || c == '\0';
+}
+
+static inline const char* skipBlank(const char* p)
+{
+    while(isBlank(*p)) ++p;
+    return p;
+}
+
+static inline const char* nextLine(const char* p, const char* end)
+{
+    while(p < end && *p != '\n') ++p;
+    return p + 1;
+}
+
+/*strtof is locale aware and several times slower, this reads the decimal forms OBJ exporters
+  write and rounds through double*/
+static inline float parseFloat(const char** cursor)
+{
+    const char* p = skipBlank(*cursor);
+    bool negative = *p == '-';
+    uint64_t mantissa = 0;
+    int32_t exponent = 0;
+    double value;
+    
+    if(*p == '-' || *p == '+') ++p;
+    
+    for(; *p >= '0' && *p <= '9'; ++p)
+    {
+        if(mantissa < OBJ_MAX_MANTISSA) mantissa = 10 * mantissa + (*p - '0');
+        else ++exponent;
+    }
+    
+    if(*p == '.')
+    {
+        for(++p; *p >= '0' && *p <= '9'; ++p)
+        {
+            if(mantissa < OBJ_MAX_MANTISSA)
+            {
+                mantissa = 10 * mantissa + (*p - '0');
+                --exponent;
+            }
+        }
+    }
+    
+    if((*p == 'e' || *p == 'E') && (p[1] == '-' || p[1] == '+' || (p[1] >= '0' && p[1] <= '9')))
+    {
+        bool negativeExponent = p[1] == '-';
+        int32_t written = 0;
+        
+        p += p[1] == '-' || p[1] == '+' ? 2 : 1;
+        
+        for(; *p >= '0' && *p <= '9'; ++p)
+        {
+            if(written < 10000) written = 10 * written + (*p - '0');
+        }
+        
+        exponent += negativeExponent ? -written : written;
+    }
+    
+    value = (double)mantissa;
+    
+    if(exponent < 0) value = exponent >= -22 ? value / _powersOf10[-exponent] : value * pow(10.0, exponent);
+    else if(exponent > 0) value = exponent <= 22 ? value * _powersOf10[exponent] : value * pow(10.0, exponent);
+    
+    *cursor = p;
+    return (float)(negative ? -value : value);
+}
+
+/*Returns false and leaves the cursor when there is no number at it*/
+static inline bool parseIndex(const char** cursor, int32_t* index)
+{
+    const char* p = *cursor;
+    bool negative = *p == '-';
+    int64_t value = 0;
+    
+    if(*p == '-' || *p == '+') ++p;
+    if(*p < '0' || *p > '9') return false;
+    
+    for(; *p >= '0' && *p <= '9'; ++p)
+    {
+        if(value < INT32_MAX) value = 10 * value + (*p - '0');
+    }
+    
+    value = value < INT32_MAX ? value : INT32_MAX;
+    *index = (int32_t)(negative ? -value : value);
+    *cursor = p;
+    
+    return true;
+}
+
+/*Reads v, v/vt, v//vn or v/vt/vn.  Negative references count back from the attributes read so
+  far, which may lie in earlier chunks, so they are kept relative to this chunk.*/
+static inline bool parseCorner(ObjChunk* chunk, const char** cursor, ObjCorner* corner)
+{
+    const char* p = skipBlank(*cursor);
+    int32_t refs[3] = {0, 0, 0};
+    int32_t counts[3] = {(int32_t)chunk->positions.size(), (int32_t)chunk->texCoords.size(), (int32_t)chunk->normals.size()};
+    
+    if(!parseIndex(&p, &refs[0])) return false;
+    
+    if(*p == '/')
+    {
+        ++p;
+        parseIndex(&p, &refs[1]);
+        
+        if(*p == '/')
+        {
+            ++p;
+            parseIndex(&p, &refs[2]);
+        }
+    }
+    
+    corner->flags = 0;
+    
+    for(uint32_t k = 0; k < 3; ++k)
+    {
+        if(refs[k] > 0)
+        {
+            corner->refs[k] = refs[k] - 1;
+        }
+        else if(refs[k] < 0)
+        {
+            corner->refs[k] = counts[k] + refs[k];
+            corner->flags |= OBJ_RELATIVE(k);
+        }
+        else
+        {
+            corner->refs[k] = 0;
+            corner->flags |= OBJ_MISSING(k);
+        }
+    }
+    
+    *cursor = p;
+    return true;
+}
+
+static void parseChunk(void* data)
+{
+    ObjChunk* chunk = (ObjChunk*)data;
+    const char* end = chunk->text + chunk->length;
+    const char* p = chunk->text;
+    
+    while(p < end)
+    {
+        p = skipBlank(p);
+        
+        if(p[0] == 'v' && endsKeyword(p[1]))
+        {
+            glm::vec3 position;
+            
+            ++p;
+            position.x = parseFloat(&p);
+            position.y = parseFloat(&p);
+            position.z = parseFloat(&p);
+            chunk->positions.push_back(position);
+        }
+        else if(p[0] == 'v' && p[1] == 't' && endsKeyword(p[2]))
+        {
+            glm::vec2 texCoords;
+            
+            p += 2;
+            texCoords.x = parseFloat(&p);
+            texCoords.y = parseFloat(&p);
+            chunk->texCoords.push_back(texCoords);
+        }
+        else if(p[0] == 'v' && p[1] == 'n' && endsKeyword(p[2]))
+        {
+            glm::vec3 normal;
+            
+            p += 2;
+            normal.x = parseFloat(&p);
+            normal.y = parseFloat(&p);
+            normal.z = parseFloat(&p);
+            chunk->normals.push_back(normal);
+        }
+        else if(p[0] == 'f' && endsKeyword(p[1]))
+        {
+            ObjCorner first;
+            ObjCorner prev;
+            ObjCorner corner;
+            uint32_t numCorners = 0;
+            
+            ++p;
+            
+            while(parseCorner(chunk, &p, &corner))
+            {
+                if(numCorners == 0) first = corner;
+                
+                if(numCorners >= 2)
+                {
+                    chunk->corners.push_back(first);
+                    chunk->corners.push_back(prev);
+                    chunk->corners.push_back(corner);
+                }
+                
+                prev = corner;
+                ++numCorners;
+            }
+        }
+        else if((p[0] == 'o' || p[0] == 'g') && endsKeyword(p[1]))
+        {
+            chunk->meshStarts.push_back((uint32_t)chunk->corners.size());
+        }
+        
+        p = nextLine(p, end);
+    }
+}
+
+static void resolveChunk(void* data)
+{
+    ObjChunk* chunk = (ObjChunk*)data;
+    
+    for(uint32_t i = 0; i < chunk->corners.size(); ++i)
+    {
+        ObjCorner* corner = &chunk->corners[i];
+        
+        for(uint32_t k = 0; k < 3; ++k)
+        {
+            int64_t ref = corner->refs[k];
+            
+            if(corner->flags & OBJ_MISSING(k))
+            {
+                corner->refs[k] = -1;
+                continue;
+            }
+            
+            if(corner->flags & OBJ_RELATIVE(k)) ref += chunk->bases[k];
+            
+            if(ref < 0 || ref >= chunk->totals[k])
+            {
+                chunk->error = -3;
+                return;
+            }
+            
+            corner->refs[k] = (int32_t)ref;
+        }
+        
+        if(corner->refs[0] < 0)
+        {
+            chunk->error = -3;
+            return;
+        }
+    }
+}
+
+static inline uint32_t hashCorner(const ObjCorner* corner)
+{
+    uint32_t hash = (uint32_t)corner->refs[0] * 0x9e3779b1u;
+    
+    hash = (hash ^ (uint32_t)corner->refs[1]) * 0x85ebca6bu;
+    hash = (hash ^ (uint32_t)corner->refs[2]) * 0xc2b2ae35u;
+    
+    return hash ^ (hash >> 16);
+}
+
+/*Corners with the same three references share a vertex, looked up in an open addressed table
+  of vertex indices at most half full*/
+static int32_t buildVertices(MeshData* data, std::deque<ObjChunk>& chunks, uint32_t numCorners,
+    const std::vector<glm::vec3>& positions, const std::vector<glm::vec2>& texCoords, const std::vector<glm::vec3>& normals)
+{
+    uint32_t tableSize = 16;
+    std::vector<uint32_t> table;
+    std::vector<ObjCorner> keys;
+    std::vector<glm::vec3> smoothNormals;
+    bool missingNormals = false;
+    uint32_t* indices = (uint32_t*)malloc(numCorners * sizeof(uint32_t));
+    uint32_t numIndices = 0;
+    
+    data->indices = indices;
+    data->indexType = VK_INDEX_TYPE_UINT32;
+    if(!indices) return -2;
+    
+    while(tableSize < 2 * numCorners) tableSize *= 2;
+    
+    table.assign(tableSize, OBJ_NO_VERTEX);
+    
+    for(std::deque<ObjChunk>::iterator chunk = chunks.begin(); chunk != chunks.end(); ++chunk)
+    {
+        for(uint32_t i = 0; i < chunk->corners.size(); ++i)
+        {
+            const ObjCorner* corner = &chunk->corners[i];
+            uint32_t slot = hashCorner(corner) & (tableSize - 1);
+            
+            while(table[slot] != OBJ_NO_VERTEX && memcmp(keys[table[slot]].refs, corner->refs, sizeof(corner->refs)))
+            {
+                slot = (slot + 1) & (tableSize - 1);
+            }
+            
+            if(table[slot] == OBJ_NO_VERTEX)
+            {
+                table[slot] = (uint32_t)keys.size();
+                keys.push_back(*corner);
+                missingNormals |= corner->refs[2] < 0;
+            }
+            
+            indices[numIndices++] = table[slot];
+        }
+    }
+    
+    if(missingNormals)
+    {
+        smoothNormals.assign(positions.size(), glm::vec3(0.0f));
+        
+        for(uint32_t i = 0; i < numIndices; i += 3)
+        {
+            const int32_t* refs[3] = {keys[indices[i]].refs, keys[indices[i + 1]].refs, keys[indices[i + 2]].refs};
+            glm::vec3 normal = glm::cross(positions[refs[1][0]] - positions[refs[0][0]], positions[refs[2][0]] - positions[refs[0][0]]);
+            
+            for(uint32_t k = 0; k < 3; ++k)
+            {
+                smoothNormals[refs[k][0]] += normal;
+            }
+        }
+    }
+    
+    data->numIndices = numIndices;
+    data->numVertices = (uint32_t)keys.size();
+    data->vertices = (Vertex*)malloc(keys.size() * sizeof(Vertex));
+    if(!data->vertices) return -2;
+    
+    for(uint32_t i = 0; i < keys.size(); ++i)
+    {
+        const int32_t* refs = keys[i].refs;
+        Vertex* vertex = &data->vertices[i];
+        glm::vec3 normal = refs[2] >= 0 ? normals[refs[2]] : smoothNormals[refs[0]];
+        
+        //OBJ texture coordinates start at the bottom of the image
+        vertex->position = glm::vec4(positions[refs[0]], 1.0f);
+        vertex->normal = glm::vec4(glm::dot(normal, normal) > 0 ? glm::normalize(normal) : glm::vec3(0, -1, 0), 0.0f);
+        vertex->texCoords = refs[1] >= 0 ? glm::vec4(texCoords[refs[1]].x, 1.0f - texCoords[refs[1]].y, 0, 0) : glm::vec4(0.0f);
+    }
+    
+    return 0;
+}
+
+int32_t meshDataCreateDefault(MeshData* data)
+{
+    *data = {};
+    
+    data->vertices = (Vertex*)malloc(sizeof(_defaultVertices));
+    data->indices = (uint32_t*)malloc(sizeof(_defaultIndices));
+    data->draws = (VkDrawIndexedIndirectCommand*)malloc(sizeof(_defaultDraws));
+    
+    if(!data->vertices || !data->indices || !data->draws)
+    {
+        meshDataDestroy(data);
+        return -1;
+    }
+    
+    memcpy(data->vertices, _defaultVertices, sizeof(_defaultVertices));
+    memcpy(data->indices, _defaultIndices, sizeof(_defaultIndices));
+    memcpy(data->draws, _defaultDraws, sizeof(_defaultDraws));
+    data->numVertices = LENGTH_OF(_defaultVertices);
+    data->numIndices = LENGTH_OF(_defaultIndices);
+    data->numMeshes = LENGTH_OF(_defaultDraws);
+    data->indexType = VK_INDEX_TYPE_UINT32;
+    
+    return 0;
+}
+
+int32_t meshDataLoadOBJ(MeshData* data, const char* file, ThreadPool* pool)
+{
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    std::deque<ObjChunk> chunks;
+    std::vector<char> carry;
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec2> texCoords;
+    std::vector<glm::vec3> normals;
+    std::vector<uint32_t> meshStarts;
+    std::atomic<int32_t> counter(0);
+    uint32_t totals[3] = {0, 0, 0};
+    uint32_t numCorners = 0;
+    uint32_t unread = 0;
+    int32_t res = 0;
+    FILE* f;
+    
+    *data = {};
+    
+    f = fopen(file, "rb");
+    if(!f) return -1;
+    
+    /*Blocks end after their last full line and the rest starts the next block.  At most one
+      block per thread is parsed while the next is read, so memory stays bounded by the block
+      size rather than the file size.*/
+    for(bool last = false; !last && !res;)
+    {
+        size_t carried = carry.size();
+        char* text = (char*)malloc(carried + MESH_OBJ_CHUNK_SIZE + 1);
+        size_t length;
+        size_t split;
+        
+        if(!text)
+        {
+            res = -2;
+            break;
+        }
+        
+        if(carried) memcpy(text, carry.data(), carried);
+        length = carried + fread(text + carried, 1, MESH_OBJ_CHUNK_SIZE, f);
+        last = length < carried + MESH_OBJ_CHUNK_SIZE;
+        split = length;
+        
+        if(!last)
+        {
+            while(split > 0 && text[split - 1] != '\n') --split;
+        }
+        
+        carry.assign(text + split, text + length);
+        text[split] = '\0';
+        
+        chunks.push_back(ObjChunk());
+        chunks.back().text = text;
+        chunks.back().length = split;
+        chunks.back().error = 0;
+        threadPoolSubmit(pool, parseChunk, &chunks.back(), &counter);
+        
+        if(chunks.size() - unread > pool->numThreads || last)
+        {
+            threadPoolWait(pool, &counter);
+            
+            for(; unread < chunks.size(); ++unread)
+            {
+                free(chunks[unread].text);
+                chunks[unread].text = NULL;
+            }
+        }
+    }
+    
+    threadPoolWait(pool, &counter);
+    fclose(f);
+    
+    for(uint32_t i = unread; i < chunks.size(); ++i)
+    {
+        free(chunks[i].text);
+    }
+    
+    for(uint32_t i = 0; i < chunks.size() && !res; ++i)
+    {
+        ObjChunk* chunk = &chunks[i];
+        uint32_t sizes[3] = {(uint32_t)chunk->positions.size(), (uint32_t)chunk->texCoords.size(), (uint32_t)chunk->normals.size()};
+        
+        for(uint32_t j = 0; j < chunk->meshStarts.size(); ++j)
+        {
+            meshStarts.push_back(numCorners + chunk->meshStarts[j]);
+        }
+        
+        for(uint32_t k = 0; k < 3; ++k)
+        {
+            chunk->bases[k] = totals[k];
+            totals[k] += sizes[k];
+        }
+        
+        chunk->totals = totals;
+        numCorners += (uint32_t)chunk->corners.size();
+        
+        positions.insert(positions.end(), chunk->positions.begin(), chunk->positions.end());
+        texCoords.insert(texCoords.end(), chunk->texCoords.begin(), chunk->texCoords.end());
+        normals.insert(normals.end(), chunk->normals.begin(), chunk->normals.end());
+        std::vector<glm::vec3>().swap(chunk->positions);
+        std::vector<glm::vec2>().swap(chunk->texCoords);
+        std::vector<glm::vec3>().swap(chunk->normals);
+    }
+    
+    if(!res && numCorners == 0) res = -4;
+    
+    if(!res)
+    {
+        for(uint32_t i = 0; i < chunks.size(); ++i)
+        {
+            threadPoolSubmit(pool, resolveChunk, &chunks[i], &counter);
+        }
+        
+        threadPoolWait(pool, &counter);
+        
+        for(uint32_t i = 0; i < chunks.size() && !res; ++i)
+        {
+            res = chunks[i].error;
+        }
+    }
+    
+    if(!res) res = buildVertices(data, chunks, numCorners, positions, texCoords, normals);
+    
+    if(!res)
+    {
+        meshStarts.push_back(numCorners);
+        data->draws = (VkDrawIndexedIndirectCommand*)malloc(meshStarts.size() * sizeof(VkDrawIndexedIndirectCommand));
+        if(!data->draws) res = -2;
+    }
+    
+    for(uint32_t i = 0, first = 0; !res && i < meshStarts.size(); first = meshStarts[i++])
+    {
+        if(meshStarts[i] == first) continue;
+        
+        data->draws[data->numMeshes] = {meshStarts[i] - first, 1, first, 0, data->numMeshes};
+        ++data->numMeshes;
+    }
+    
+    if(res)
+    {
+        meshDataDestroy(data);
+        return res;
+    }
+    
+    data->loadMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    
+    DEBUG_PRINT("Loaded %s: %u triangles, %u vertices, %u meshes in %f ms, %f ms per million triangles\n", file,
+        data->numIndices / 3, data->numVertices, data->numMeshes, data->loadMs, data->loadMs * 3e6f / data->numIndices);
+    
+    return 0;
+}
+
+float meshDataPackedError(const MeshData* data, uint32_t mesh)
+{
+    const VkDrawIndexedIndirectCommand* cmd = &data->draws[mesh];
+    glm::vec3 min = glm::vec3(INFINITY);
+    glm::vec3 max = glm::vec3(-INFINITY);
+    float error = 0;
+    float diagonal;
+    
+    for(uint32_t i = cmd->firstIndex; i < cmd->firstIndex + cmd->indexCount; ++i)
+    {
+        glm::vec3 position = glm::vec3(data->vertices[meshDataIndex(data, i) + cmd->vertexOffset].position);
+        PackedVertex packed = packVertex(&data->vertices[meshDataIndex(data, i) + cmd->vertexOffset]);
+        glm::vec3 unpacked = glm::vec3(glm::unpackHalf2x16(packed.position[0]), glm::unpackHalf2x16(packed.position[1]).x);
+        
+        min = glm::min(min, position);
+        max = glm::max(max, position);
+        error = std::max(error, glm::length(unpacked - position));
+    }
+    
+    diagonal = cmd->indexCount ? glm::length(max - min) : 0.0f;
+    
+    return diagonal > 0 ? error / diagonal : error;
+}
+
+int32_t meshDataSetVertexFormat(MeshData* data, uint32_t mesh, VertexFormat format)
+{
+    if(mesh >= data->numMeshes || format >= VERTEX_NUM_FORMATS) return -1;
+    
+    if(!data->vertexFormats)
+    {
+        data->vertexFormats = (uint32_t*)calloc(data->numMeshes, sizeof(uint32_t));
+        if(!data->vertexFormats) return -2;
+    }
+    
+    data->vertexFormats[mesh] = format;
+    
+    return 0;
+}
+
+uint32_t meshDataPackVertices(MeshData* data, float maxError)
+{
+    uint32_t numPacked = 0;
+    
+    for(uint32_t i = 0; i < data->numMeshes; ++i)
+    {
+        float error = meshDataPackedError(data, i);
+        
+        if(error > maxError) continue;
+        
+        if(meshDataSetVertexFormat(data, i, VERTEX_FORMAT_PACKED)) break;
+        
+        DEBUG_PRINT("Mesh %u: packed vertices, relative error %f\n", i, error);
+        ++numPacked;
+    }
+    
+    return numPacked;
+}
+
+static inline uint32_t hashVertex(const Vertex* vertex)
+{
+    const uint32_t* words = (const uint32_t*)vertex;
+    uint32_t hash = 0;
+    
+    for(uint32_t i = 0; i < sizeof(Vertex) / sizeof(uint32_t); ++i)
+    {
+        hash = (hash ^ words[i]) * 0x9e3779b1u;
+    }
+    
+    return hash ^ (hash >> 16);
+}
+
+/*Meshes are optimized on their own vertices numbered in order of first use, so the cache
+  and overdraw passes only need arrays as large as the mesh*/
+int32_t meshDataOptimize(MeshData* data, MeshOptimizeReport* reports)
+{
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    uint32_t* indices = (uint32_t*)data->indices;
+    uint32_t tableSize = 16;
+    std::vector<uint32_t> table;
+    std::vector<uint32_t> remap(data->numVertices);
+    std::vector<uint32_t> local(data->numVertices, OBJ_NO_VERTEX);
+    std::vector<uint32_t> globals;
+    std::vector<glm::vec3> positions;
+    std::vector<uint32_t> meshIndices;
+    std::vector<uint32_t> cacheIndices;
+    Vertex* vertices;
+    uint32_t numUsed = 0;
+    
+    if(data->_mapping || data->indexType != VK_INDEX_TYPE_UINT32) return -1;
+    
+    while(tableSize < 2 * data->numVertices) tableSize *= 2;
+    
+    table.assign(tableSize, OBJ_NO_VERTEX);
+    
+    for(uint32_t i = 0; i < data->numVertices; ++i)
+    {
+        uint32_t slot = hashVertex(&data->vertices[i]) & (tableSize - 1);
+        
+        while(table[slot] != OBJ_NO_VERTEX && memcmp(&data->vertices[table[slot]], &data->vertices[i], sizeof(Vertex)))
+        {
+            slot = (slot + 1) & (tableSize - 1);
+        }
+        
+        if(table[slot] == OBJ_NO_VERTEX) table[slot] = i;
+        
+        remap[i] = table[slot];
+    }
+    
+    for(uint32_t i = 0; i < data->numIndices; ++i)
+    {
+        indices[i] = remap[indices[i]];
+    }
+    
+    for(uint32_t i = 0; i < data->numMeshes; ++i)
+    {
+        const VkDrawIndexedIndirectCommand* cmd = &data->draws[i];
+        uint32_t* first = &indices[cmd->firstIndex];
+        uint32_t numTris = cmd->indexCount / 3;
+        
+        globals.clear();
+        positions.clear();
+        meshIndices.resize(3 * numTris);
+        cacheIndices.resize(3 * numTris);
+        
+        for(uint32_t j = 0; j < 3 * numTris; ++j)
+        {
+            if(local[first[j]] == OBJ_NO_VERTEX)
+            {
+                local[first[j]] = (uint32_t)globals.size();
+                globals.push_back(first[j]);
+                positions.push_back(glm::vec3(data->vertices[first[j]].position));
+            }
+            
+            meshIndices[j] = local[first[j]];
+        }
+        
+        if(reports)
+        {
+            reports[i].acmrBefore = analyzeVertexCache(meshIndices.data(), numTris, (uint32_t)globals.size());
+            reports[i].overdrawBefore = analyzeOverdraw(positions.data(), meshIndices.data(), numTris);
+        }
+        
+        optimizeVertexCache(meshIndices.data(), numTris, (uint32_t)globals.size(), cacheIndices.data());
+        optimizeOverdraw(positions.data(), cacheIndices.data(), numTris, (uint32_t)globals.size(), meshIndices.data());
+        
+        if(reports)
+        {
+            reports[i].acmrAfter = analyzeVertexCache(meshIndices.data(), numTris, (uint32_t)globals.size());
+            reports[i].overdrawAfter = analyzeOverdraw(positions.data(), meshIndices.data(), numTris);
+            
+            DEBUG_PRINT("Mesh %u: ACMR %f -> %f, overdraw %f -> %f\n", i, reports[i].acmrBefore, reports[i].acmrAfter,
+                reports[i].overdrawBefore, reports[i].overdrawAfter);
+        }
+        
+        for(uint32_t j = 0; j < 3 * numTris; ++j)
+        {
+            first[j] = globals[meshIndices[j]];
+        }
+        
+        for(uint32_t j = 0; j < globals.size(); ++j)
+        {
+            local[globals[j]] = OBJ_NO_VERTEX;
+        }
+    }
+    
+    //Vertices are fetched in the order the draws first reach them
+    vertices = (Vertex*)malloc(data->numVertices * sizeof(Vertex));
+    if(!vertices) return -2;
+    
+    std::fill(remap.begin(), remap.end(), OBJ_NO_VERTEX);
+    
+    for(uint32_t i = 0; i < data->numIndices; ++i)
+    {
+        if(remap[indices[i]] == OBJ_NO_VERTEX) remap[indices[i]] = numUsed++;
+        
+        indices[i] = remap[indices[i]];
+    }
+    
+    for(uint32_t i = 0; i < data->numVertices; ++i)
+    {
+        if(remap[i] != OBJ_NO_VERTEX) vertices[remap[i]] = data->vertices[i];
+    }
+    
+    data->optimizeMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    
+    DEBUG_PRINT("Optimized %u meshes, kept %u of %u vertices in %f ms\n", data->numMeshes, numUsed, data->numVertices,
+        data->optimizeMs);
+    
+    free(data->vertices);
+    data->vertices = vertices;
+    data->numVertices = numUsed;
+    
+    return 0;
+}
+
+#ifdef _WIN32
+static int32_t mapFile(const char* file, void** mapping, size_t* size)
+{
+    HANDLE handle = CreateFileA(file, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    HANDLE section;
+    LARGE_INTEGER fileSize;
+    
+    if(handle == INVALID_HANDLE_VALUE) return -1;
+    
+    if(!GetFileSizeEx(handle, &fileSize) || fileSize.QuadPart == 0)
+    {
+        CloseHandle(handle);
+        return -1;
+    }
+    
+    //The view keeps the file open after both handles are closed
+    section = CreateFileMappingA(handle, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+    CloseHandle(handle);
+    if(!section) return -1;
+    
+    *mapping = MapViewOfFile(section, FILE_MAP_COPY, 0, 0, 0);
+    CloseHandle(section);
+    if(!*mapping) return -1;
+    
+    *size = (size_t)fileSize.QuadPart;
+    
+    return 0;
+}
+
+static void unmapFile(void* mapping, size_t size)
+{
+    UnmapViewOfFile(mapping);
+}
+#else //_WIN32
+static int32_t mapFile(const char* file, void** mapping, size_t* size)
+{
+    int fd = open(file, O_RDONLY);
+    struct stat info;
+    
+    if(fd < 0) return -1;
+    
+    if(fstat(fd, &info) || info.st_size == 0)
+    {
+        close(fd);
+        return -1;
+    }
+    
+    *mapping = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    
+    if(*mapping == MAP_FAILED)
+    {
+        *mapping = NULL;
+        return -1;
+    }
+    
+    *size = (size_t)info.st_size;
+    
+    return 0;
+}
+
+static void unmapFile(void* mapping, size_t size)
+{
+    munmap(mapping, size);
+}
+#endif //_WIN32
+
+static void cookedSizes(const CookedHeader* header, uint64_t* sizes)
+{
+    sizes[COOKED_VERTICES] = (uint64_t)header->numVertices * sizeof(Vertex);
+    sizes[COOKED_INDICES] = (uint64_t)header->numIndices * (header->indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t));
+    sizes[COOKED_DRAWS] = (uint64_t)header->numMeshes * sizeof(VkDrawIndexedIndirectCommand);
+    sizes[COOKED_VERTEX_FORMATS] = (uint64_t)header->numMeshes * sizeof(uint32_t);
+    sizes[COOKED_STORAGE_VERTICES] = (uint64_t)header->numVertices * sizeof(StorageVertex);
+    sizes[COOKED_ATTRIBUTES] = (uint64_t)header->numVertices * sizeof(VertexAttributes);
+    sizes[COOKED_SORT_TRIANGLES] = (uint64_t)(header->numIndices / 3) * 4 * sizeof(uint32_t);
+    sizes[COOKED_TRIANGLES] = (uint64_t)header->numTris * 4 * sizeof(uint32_t);
+    sizes[COOKED_RECORDS] = (uint64_t)header->numTris * sizeof(TriangleRecord);
+    sizes[COOKED_NODES] = (uint64_t)header->numNodes * sizeof(BVHNode);
+    sizes[COOKED_WIDE_NODES] = (uint64_t)header->numWideNodes * sizeof(BVHWideNode);
+    sizes[COOKED_RANGES] = (uint64_t)header->numMeshes * sizeof(BLASRange);
+}
+
+void meshDataFillSortTriangles(const MeshData* data, const uint32_t* firstTris, uint32_t* triangles)
+{
+    uint32_t numTris = 0;
+    
+    for(uint32_t i = 0; i < data->numMeshes; ++i)
+    {
+        const VkDrawIndexedIndirectCommand* cmd = &data->draws[i];
+        
+        for(uint32_t j = 0; j < cmd->indexCount / 3; ++j, ++numTris)
+        {
+            triangles[4 * numTris] = meshDataIndex(data, cmd->firstIndex + 3 * j) + cmd->vertexOffset;
+            triangles[4 * numTris + 1] = meshDataIndex(data, cmd->firstIndex + 3 * j + 1) + cmd->vertexOffset;
+            triangles[4 * numTris + 2] = meshDataIndex(data, cmd->firstIndex + 3 * j + 2) + cmd->vertexOffset;
+            triangles[4 * numTris + 3] = firstTris[i];
+        }
+    }
+}
+
+/*The BLAS are built from the raster triangles, the same build the renderer runs at a proxy
+  ratio of 1 with no proxies registered*/
+int32_t meshDataCook(const MeshData* data, const char* file, ThreadPool* pool)
+{
+    CookedHeader header = {};
+    const void* sections[COOKED_NUM_SECTIONS];
+    const uint32_t** meshIndices = (const uint32_t**)malloc(data->numMeshes * sizeof(uint32_t*));
+    uint32_t* meshTris = (uint32_t*)malloc(data->numMeshes * sizeof(uint32_t));
+    uint32_t* firstTris = (uint32_t*)malloc(data->numMeshes * sizeof(uint32_t));
+    uint32_t* rasterIndices = (uint32_t*)malloc(data->numIndices * sizeof(uint32_t));
+    uint32_t* sortTriangles = (uint32_t*)malloc((data->numIndices / 3) * 4 * sizeof(uint32_t));
+    uint32_t* vertexFormats = (uint32_t*)calloc(data->numMeshes, sizeof(uint32_t));
+    StorageVertex* storageVertices = (StorageVertex*)malloc(data->numVertices * sizeof(StorageVertex));
+    VertexAttributes* attributes = (VertexAttributes*)malloc(data->numVertices * sizeof(VertexAttributes));
+    uint16_t* shortIndices = NULL;
+    BLASImage blas = {};
+    uint64_t offset = (sizeof(CookedHeader) + COOKED_ALIGNMENT - 1) & ~(uint64_t)(COOKED_ALIGNMENT - 1);
+    uint32_t firstIndex = 0;
+    int32_t res = 0;
+    FILE* f = NULL;
+    
+    if(!meshIndices || !meshTris || !firstTris || !rasterIndices || !sortTriangles || !vertexFormats || !storageVertices || !attributes) res = -2;
+    
+    if(!res && data->vertexFormats) memcpy(vertexFormats, data->vertexFormats, data->numMeshes * sizeof(uint32_t));
+    
+    for(uint32_t i = 0; i < data->numMeshes && !res; ++i)
+    {
+        const VkDrawIndexedIndirectCommand* cmd = &data->draws[i];
+        
+        for(uint32_t j = 0; j < cmd->indexCount; ++j)
+        {
+            rasterIndices[firstIndex + j] = meshDataIndex(data, cmd->firstIndex + j) + cmd->vertexOffset;
+        }
+        
+        meshIndices[i] = &rasterIndices[firstIndex];
+        meshTris[i] = cmd->indexCount / 3;
+        firstIndex += cmd->indexCount;
+    }
+    
+    if(!res && bvhBuildImage(&blas, data->vertices, meshIndices, meshTris, data->numMeshes, pool)) res = -3;
+    
+    if(!res)
+    {
+        for(uint32_t i = 0; i < data->numMeshes; ++i)
+        {
+            firstTris[i] = blas.ranges[i].firstTri;
+        }
+        
+        meshDataFillSortTriangles(data, firstTris, sortTriangles);
+        
+        for(uint32_t i = 0; i < data->numVertices; ++i)
+        {
+            storageVertices[i].position = glm::vec3(data->vertices[i].position);
+            attributes[i].normal = packOctahedral(glm::normalize(glm::vec3(data->vertices[i].normal)));
+            attributes[i].texCoords = glm::packHalf2x16(glm::vec2(data->vertices[i].texCoords));
+        }
+        
+        header.magic = MESH_COOKED_MAGIC;
+        header.version = MESH_COOKED_VERSION;
+        header.numVertices = data->numVertices;
+        header.numIndices = data->numIndices;
+        header.numMeshes = data->numMeshes;
+        header.indexType = data->numVertices <= 0x10000 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+        header.numTris = blas.numTris;
+        header.numNodes = blas.numNodes;
+        header.numWideNodes = blas.numWideNodes;
+        
+        sections[COOKED_VERTICES] = data->vertices;
+        sections[COOKED_INDICES] = data->indices;
+        sections[COOKED_DRAWS] = data->draws;
+        sections[COOKED_VERTEX_FORMATS] = vertexFormats;
+        sections[COOKED_STORAGE_VERTICES] = storageVertices;
+        sections[COOKED_ATTRIBUTES] = attributes;
+        sections[COOKED_SORT_TRIANGLES] = sortTriangles;
+        sections[COOKED_TRIANGLES] = blas.triangles;
+        sections[COOKED_RECORDS] = blas.records;
+        sections[COOKED_NODES] = blas.nodes;
+        sections[COOKED_WIDE_NODES] = blas.wideNodes;
+        sections[COOKED_RANGES] = blas.ranges;
+        
+        if(header.indexType != data->indexType)
+        {
+            shortIndices = (uint16_t*)malloc(data->numIndices * sizeof(uint16_t));
+            if(!shortIndices) res = -2;
+            
+            for(uint32_t i = 0; i < data->numIndices && !res; ++i)
+            {
+                shortIndices[i] = (uint16_t)meshDataIndex(data, i);
+            }
+            
+            sections[COOKED_INDICES] = shortIndices;
+        }
+        
+        cookedSizes(&header, header.sizes);
+        
+        for(uint32_t i = 0; i < COOKED_NUM_SECTIONS; ++i)
+        {
+            header.offsets[i] = offset;
+            offset = (offset + header.sizes[i] + COOKED_ALIGNMENT - 1) & ~(uint64_t)(COOKED_ALIGNMENT - 1);
+        }
+    }
+    
+    if(!res)
+    {
+        f = fopen(file, "wb");
+        if(!f) res = -1;
+    }
+    
+    if(!res && fwrite(&header, sizeof(header), 1, f) != 1) res = -4;
+    
+    for(uint32_t i = 0; i < COOKED_NUM_SECTIONS && !res; ++i)
+    {
+        static const uint8_t zeros[COOKED_ALIGNMENT] = {};
+        uint64_t written = i ? header.offsets[i - 1] + header.sizes[i - 1] : sizeof(header);
+        
+        if(fwrite(zeros, 1, header.offsets[i] - written, f) != header.offsets[i] - written) res = -4;
+        if(!res && header.sizes[i] && fwrite(sections[i], header.sizes[i], 1, f) != 1) res = -4;
+    }
+    
+    if(f) fclose(f);
+    
+    DEBUG_PRINT("Cooked %s: %u triangles, %u vertices, %u meshes, %llu bytes\n", file, data->numIndices / 3,
+        data->numVertices, data->numMeshes, (unsigned long long)offset);
+    
+    bvhDestroyImage(&blas);
+    free(meshIndices);
+    free(meshTris);
+    free(firstTris);
+    free(rasterIndices);
+    free(sortTriangles);
+    free(vertexFormats);
+    free(storageVertices);
+    free(attributes);
+    free(shortIndices);
+    
+    return res;
+}
+
+int32_t meshDataLoadCooked(MeshData* data, const char* file)
+{
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    const CookedHeader* header;
+    uint64_t sizes[COOKED_NUM_SECTIONS];
+    uint8_t* sections[COOKED_NUM_SECTIONS];
+    
+    *data = {};
+    
+    if(mapFile(file, &data->_mapping, &data->_mappingSize)) return -1;
+    
+    header = (const CookedHeader*)data->_mapping;
+    
+    if(data->_mappingSize < sizeof(CookedHeader) || header->magic != MESH_COOKED_MAGIC || header->version != MESH_COOKED_VERSION)
+    {
+        meshDataDestroy(data);
+        return -2;
+    }
+    
+    cookedSizes(header, sizes);
+    
+    for(uint32_t i = 0; i < COOKED_NUM_SECTIONS; ++i)
+    {
+        if(header->offsets[i] % COOKED_ALIGNMENT || header->sizes[i] != sizes[i] ||
+            header->offsets[i] > data->_mappingSize || sizes[i] > data->_mappingSize - header->offsets[i])
+        {
+            meshDataDestroy(data);
+            return -3;
+        }
+        
+        sections[i] = (uint8_t*)data->_mapping + header->offsets[i];
+    }
+    
+    data->vertices = (Vertex*)sections[COOKED_VERTICES];
+    data->indices = sections[COOKED_INDICES];
+    data->draws = (VkDrawIndexedIndirectCommand*)sections[COOKED_DRAWS];
+    data->numVertices = header->numVertices;
+    data->numIndices = header->numIndices;
+    data->numMeshes = header->numMeshes;
+    data->indexType = (VkIndexType)header->indexType;
+    data->vertexFormats = (uint32_t*)sections[COOKED_VERTEX_FORMATS];
+    data->storageVertices = (StorageVertex*)sections[COOKED_STORAGE_VERTICES];
+    data->attributes = (VertexAttributes*)sections[COOKED_ATTRIBUTES];
+    data->sortTriangles = (uint32_t*)sections[COOKED_SORT_TRIANGLES];
+    data->blas.triangles = (uint32_t*)sections[COOKED_TRIANGLES];
+    data->blas.records = (TriangleRecord*)sections[COOKED_RECORDS];
+    data->blas.nodes = (BVHNode*)sections[COOKED_NODES];
+    data->blas.wideNodes = (BVHWideNode*)sections[COOKED_WIDE_NODES];
+    data->blas.ranges = (BLASRange*)sections[COOKED_RANGES];
+    data->blas.numTris = header->numTris;
+    data->blas.numNodes = header->numNodes;
+    data->blas.numWideNodes = header->numWideNodes;
+    data->blas.numMeshes = header->numMeshes;
+    
+    data->loadMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    
+    DEBUG_PRINT("Mapped %s: %u triangles, %u vertices, %u meshes in %f ms\n", file,
+        data->numIndices / 3, data->numVertices, data->numMeshes, data->loadMs);
+    
+    return 0;
+}
+
+/*Cooked data points into its mapping, everything else was allocated piece by piece*/
+void meshDataDestroy(MeshData* data)
+{
+    if(data->_mapping)
+    {
+        unmapFile(data->_mapping, data->_mappingSize);
+    }
+    else
+    {
+        free(data->vertices);
+        free(data->indices);
+        free(data->draws);
+        free(data->vertexFormats);
+        free(data->storageVertices);
+        free(data->attributes);
+        free(data->sortTriangles);
+        bvhDestroyImage(&data->blas);
+    }
+    
+    *data = {};
+}
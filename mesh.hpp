@@ -0,0 +1,101 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+#include "bvh.hpp"
+#include "threadPool.hpp"
+#include "vertex.hpp"
+
+/*Bytes of an OBJ file read and parsed per job*/
+#define MESH_OBJ_CHUNK_SIZE (8 << 20)
+/*"RRMB" at the start of a cooked mesh file*/
+#define MESH_COOKED_MAGIC 0x424d5252
+/*Bump whenever the header or the layout of a section changes, older files are refused*/
+#define MESH_COOKED_VERSION 3
+
+/*The geometry a renderer draws and traces.  indices are global vertex indices of indexType
+  and every mesh is one indirect draw over its range of them with a vertex offset of 0.
+  Objects are the instances of the draws, numbered by firstInstance.  vertexFormats holds the
+  VertexFormat every mesh is rastered with, NULL rasters all of them full.
+
+  Cooked data also holds the storage vertices and attributes, the raster triangles of the
+  sort pipeline and the BLAS of every mesh as the renderer uploads them, all pointing into
+  the mapped file.  Loaded and built in data leaves them NULL.*/
+typedef struct
+{
+    Vertex* vertices;
+    void* indices;
+    VkDrawIndexedIndirectCommand* draws;
+    uint32_t numVertices;
+    uint32_t numIndices;
+    uint32_t numMeshes;
+    VkIndexType indexType;
+    uint32_t* vertexFormats;
+    
+    StorageVertex* storageVertices;
+    VertexAttributes* attributes;
+    uint32_t* sortTriangles;
+    BLASImage blas;
+    
+    float loadMs;
+    /*Time meshDataOptimize took, 0 if it was not run*/
+    float optimizeMs;
+    void* _mapping;
+    size_t _mappingSize;
+}
+MeshData;
+
+/*Post-transform cache ACMR and overdraw of one mesh around meshDataOptimize, as measured by
+  analyzeVertexCache and analyzeOverdraw*/
+typedef struct
+{
+    float acmrBefore;
+    float acmrAfter;
+    float overdrawBefore;
+    float overdrawAfter;
+}
+MeshOptimizeReport;
+
+static inline uint32_t meshDataIndex(const MeshData* data, uint32_t i)
+{
+    return data->indexType == VK_INDEX_TYPE_UINT16 ? ((const uint16_t*)data->indices)[i] : ((const uint32_t*)data->indices)[i];
+}
+
+static inline uint32_t meshDataIndexSize(const MeshData* data)
+{
+    return data->indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+/*The two built in meshes, a double pyramid and a floor with a wall, one object each*/
+int32_t meshDataCreateDefault(MeshData* data);
+/*Reads the file in MESH_OBJ_CHUNK_SIZE blocks and parses the blocks on the pool while the
+  next ones are read.  Every o or g line starts a new mesh with one object, polygons are
+  triangulated as fans and vertices without a normal get the area weighted normal of the
+  faces around their position.  Materials, smoothing groups and lines are ignored.*/
+int32_t meshDataLoadOBJ(MeshData* data, const char* file, ThreadPool* pool);
+/*Merges bitwise identical vertices, orders the triangles of every mesh for the vertex cache
+  and then for overdraw and renumbers the vertices in order of first use, dropping unused
+  ones.  Draws keep their index ranges.  Analyzing overdraw rasterizes every mesh twelve times,
+  so it is only done when reports has room for numMeshes entries to fill.  Cooked data is
+  already optimized and refused.*/
+int32_t meshDataOptimize(MeshData* data, MeshOptimizeReport* reports);
+/*Largest distance between a vertex of mesh and its VERTEX_FORMAT_PACKED position, relative to
+  the diagonal of the mesh's bounds*/
+float meshDataPackedError(const MeshData* data, uint32_t mesh);
+int32_t meshDataSetVertexFormat(MeshData* data, uint32_t mesh, VertexFormat format);
+/*Packs every mesh whose meshDataPackedError is at most maxError, returns how many were*/
+uint32_t meshDataPackVertices(MeshData* data, float maxError);
+/*Writes data and everything the renderer derives from it before uploading to a versioned
+  binary file.  Indices are stored as 16 bit when every vertex fits.*/
+int32_t meshDataCook(const MeshData* data, const char* file, ThreadPool* pool);
+/*Maps a file written by meshDataCook copy on write and points data into it without parsing
+  or converting anything*/
+int32_t meshDataLoadCooked(MeshData* data, const char* file);
+/*Four words per raster triangle in draw order, its three global vertex indices and
+  firstTris[mesh], the first ray tracing triangle of its mesh*/
+void meshDataFillSortTriangles(const MeshData* data, const uint32_t* firstTris, uint32_t* triangles);
+void meshDataDestroy(MeshData* data);
+
+#endif //MESH_H
@@ -0,0 +1,363 @@
+#include "optimize.hpp"
+
+#include <stdint.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+#include <glm/glm.hpp>
+
+/*A cluster ends once its ACMR is within this factor of its hard cluster's*/
+#define OPTIMIZE_OVERDRAW_THRESHOLD 1.05f
+/*Width and height of each view analyzeOverdraw rasterizes*/
+#define OPTIMIZE_VIEW_SIZE 256
+
+typedef struct
+{
+    uint32_t first;
+    uint32_t numTris;
+    float sortKey;
+}
+TriangleCluster;
+
+struct ClusterOrder
+{
+    bool operator()(const TriangleCluster& a, const TriangleCluster& b) const
+    {
+        return a.sortKey > b.sortKey;
+    }
+};
+
+/*The cache holds a vertex while fewer than OPTIMIZE_CACHE_SIZE misses came after its own, stamps
+  start at 0 and time above OPTIMIZE_CACHE_SIZE so everything misses at first*/
+static inline uint32_t cacheMisses(const uint32_t* tri, uint32_t* stamps, uint32_t* time)
+{
+    uint32_t misses = 0;
+    
+    for(uint32_t k = 0; k < 3; ++k)
+    {
+        if(*time - stamps[tri[k]] > OPTIMIZE_CACHE_SIZE)
+        {
+            stamps[tri[k]] = (*time)++;
+            ++misses;
+        }
+    }
+    
+    return misses;
+}
+
+/*Candidates that stay in the cache while their remaining triangles are emitted win, the
+  oldest first.  Otherwise a vertex of a recently emitted triangle or the next unfinished
+  vertex in index order.*/
+static int64_t nextFanVertex(const std::vector<uint32_t>& candidates, const std::vector<uint32_t>& live,
+    const std::vector<uint32_t>& stamps, uint32_t time, std::vector<uint32_t>& deadEnds, uint32_t* cursor)
+{
+    int64_t best = -1;
+    int64_t bestPriority = -1;
+    
+    for(uint32_t i = 0; i < candidates.size(); ++i)
+    {
+        uint32_t v = candidates[i];
+        int64_t priority = 0;
+        
+        if(!live[v]) continue;
+        
+        if(time - stamps[v] + 2 * live[v] <= OPTIMIZE_CACHE_SIZE) priority = time - stamps[v];
+        
+        if(priority > bestPriority)
+        {
+            best = v;
+            bestPriority = priority;
+        }
+    }
+    
+    if(best >= 0) return best;
+    
+    while(!deadEnds.empty())
+    {
+        uint32_t v = deadEnds.back();
+        
+        deadEnds.pop_back();
+        if(live[v]) return v;
+    }
+    
+    for(; *cursor < live.size(); ++*cursor)
+    {
+        if(live[*cursor]) return *cursor;
+    }
+    
+    return -1;
+}
+
+void optimizeVertexCache(const uint32_t* indices, uint32_t numTris, uint32_t numVertices, uint32_t* outIndices)
+{
+    std::vector<uint32_t> offsets(numVertices + 1, 0);
+    std::vector<uint32_t> adjacency(3 * numTris);
+    std::vector<uint32_t> live(numVertices, 0);
+    std::vector<uint32_t> stamps(numVertices, 0);
+    std::vector<bool> emitted(numTris, false);
+    std::vector<uint32_t> candidates;
+    std::vector<uint32_t> deadEnds;
+    uint32_t time = OPTIMIZE_CACHE_SIZE + 1;
+    uint32_t cursor = 0;
+    uint32_t numOut = 0;
+    int64_t fan;
+    
+    for(uint32_t i = 0; i < 3 * numTris; ++i)
+    {
+        ++live[indices[i]];
+    }
+    
+    for(uint32_t i = 0; i < numVertices; ++i)
+    {
+        offsets[i + 1] = offsets[i] + live[i];
+    }
+    
+    for(uint32_t t = 0; t < numTris; ++t)
+    {
+        for(uint32_t k = 0; k < 3; ++k)
+        {
+            uint32_t v = indices[3 * t + k];
+            
+            //Counts back down to the vertex's first slot as its triangles are placed
+            adjacency[offsets[v + 1] - live[v]] = t;
+            --live[v];
+        }
+    }
+    
+    for(uint32_t i = 0; i < numVertices; ++i)
+    {
+        live[i] = offsets[i + 1] - offsets[i];
+    }
+    
+    fan = nextFanVertex(candidates, live, stamps, time, deadEnds, &cursor);
+    
+    while(fan >= 0)
+    {
+        candidates.clear();
+        
+        for(uint32_t i = offsets[fan]; i < offsets[fan + 1]; ++i)
+        {
+            uint32_t t = adjacency[i];
+            
+            if(emitted[t]) continue;
+            
+            for(uint32_t k = 0; k < 3; ++k)
+            {
+                uint32_t v = indices[3 * t + k];
+                
+                outIndices[3 * numOut + k] = v;
+                deadEnds.push_back(v);
+                candidates.push_back(v);
+                --live[v];
+            }
+            
+            cacheMisses(&indices[3 * t], stamps.data(), &time);
+            emitted[t] = true;
+            ++numOut;
+        }
+        
+        fan = nextFanVertex(candidates, live, stamps, time, deadEnds, &cursor);
+    }
+}
+
+void optimizeOverdraw(const glm::vec3* positions, const uint32_t* indices, uint32_t numTris, uint32_t numVertices,
+    uint32_t* outIndices)
+{
+    std::vector<uint32_t> stamps(numVertices, 0);
+    std::vector<uint32_t> hardBoundaries;
+    std::vector<TriangleCluster> clusters;
+    glm::dvec3 meshCentroid = glm::dvec3(0.0);
+    double meshArea = 0;
+    uint32_t time = OPTIMIZE_CACHE_SIZE + 1;
+    uint32_t numOut = 0;
+    
+    if(!numTris) return;
+    
+    hardBoundaries.push_back(0);
+    
+    //A triangle missing all three vertices starts over as if the cache had been flushed
+    for(uint32_t t = 0; t < numTris; ++t)
+    {
+        if(cacheMisses(&indices[3 * t], stamps.data(), &time) == 3 && t) hardBoundaries.push_back(t);
+    }
+    
+    hardBoundaries.push_back(numTris);
+    
+    for(uint32_t i = 0; i + 1 < hardBoundaries.size(); ++i)
+    {
+        uint32_t start = hardBoundaries[i];
+        uint32_t end = hardBoundaries[i + 1];
+        uint32_t misses = 0;
+        uint32_t runningMisses = 0;
+        uint32_t firstCluster = clusters.size();
+        float threshold;
+        
+        time += OPTIMIZE_CACHE_SIZE + 1;
+        
+        for(uint32_t t = start; t < end; ++t)
+        {
+            misses += cacheMisses(&indices[3 * t], stamps.data(), &time);
+        }
+        
+        threshold = OPTIMIZE_OVERDRAW_THRESHOLD * misses / (end - start);
+        clusters.push_back({start, 0, 0.0f});
+        time += OPTIMIZE_CACHE_SIZE + 1;
+        
+        for(uint32_t t = start; t < end; ++t)
+        {
+            runningMisses += cacheMisses(&indices[3 * t], stamps.data(), &time);
+            ++clusters.back().numTris;
+            
+            if(t + 1 < end && runningMisses <= threshold * clusters.back().numTris)
+            {
+                clusters.push_back({t + 1, 0, 0.0f});
+                runningMisses = 0;
+                time += OPTIMIZE_CACHE_SIZE + 1;
+            }
+        }
+        
+        //The last cluster is whatever was left over and rarely reached the threshold
+        if(clusters.size() - firstCluster > 1 && runningMisses > threshold * clusters.back().numTris)
+        {
+            clusters[clusters.size() - 2].numTris += clusters.back().numTris;
+            clusters.pop_back();
+        }
+    }
+    
+    for(uint32_t t = 0; t < numTris; ++t)
+    {
+        glm::dvec3 p0 = glm::dvec3(positions[indices[3 * t]]);
+        glm::dvec3 p1 = glm::dvec3(positions[indices[3 * t + 1]]);
+        glm::dvec3 p2 = glm::dvec3(positions[indices[3 * t + 2]]);
+        double area = glm::length(glm::cross(p1 - p0, p2 - p0));
+        
+        meshCentroid += area * (p0 + p1 + p2) / 3.0;
+        meshArea += area;
+    }
+    
+    if(meshArea > 0) meshCentroid /= meshArea;
+    
+    for(uint32_t i = 0; i < clusters.size(); ++i)
+    {
+        TriangleCluster* cluster = &clusters[i];
+        glm::dvec3 centroid = glm::dvec3(0.0);
+        glm::dvec3 normal = glm::dvec3(0.0);
+        double area = 0;
+        
+        for(uint32_t t = cluster->first; t < cluster->first + cluster->numTris; ++t)
+        {
+            glm::dvec3 p0 = glm::dvec3(positions[indices[3 * t]]);
+            glm::dvec3 p1 = glm::dvec3(positions[indices[3 * t + 1]]);
+            glm::dvec3 p2 = glm::dvec3(positions[indices[3 * t + 2]]);
+            glm::dvec3 cross = glm::cross(p1 - p0, p2 - p0);
+            double triArea = glm::length(cross);
+            
+            centroid += triArea * (p0 + p1 + p2) / 3.0;
+            normal += cross;
+            area += triArea;
+        }
+        
+        if(area > 0) centroid /= area;
+        if(glm::length(normal) > 0) normal = glm::normalize(normal);
+        
+        cluster->sortKey = (float)glm::dot(centroid - meshCentroid, normal);
+    }
+    
+    std::stable_sort(clusters.begin(), clusters.end(), ClusterOrder());
+    
+    for(uint32_t i = 0; i < clusters.size(); ++i)
+    {
+        for(uint32_t j = 3 * clusters[i].first; j < 3 * (clusters[i].first + clusters[i].numTris); ++j)
+        {
+            outIndices[numOut++] = indices[j];
+        }
+    }
+}
+
+float analyzeVertexCache(const uint32_t* indices, uint32_t numTris, uint32_t numVertices)
+{
+    std::vector<uint32_t> stamps(numVertices, 0);
+    uint32_t time = OPTIMIZE_CACHE_SIZE + 1;
+    uint32_t misses = 0;
+    
+    for(uint32_t t = 0; t < numTris; ++t)
+    {
+        misses += cacheMisses(&indices[3 * t], stamps.data(), &time);
+    }
+    
+    return numTris ? (float)misses / numTris : 0.0f;
+}
+
+/*Views look along +axis and -axis, u and v are the other two axes in cyclic order so the
+  triangle's signed screen area has the sign of its normal's axis component*/
+float analyzeOverdraw(const glm::vec3* positions, const uint32_t* indices, uint32_t numTris)
+{
+    std::vector<float> depths(OPTIMIZE_VIEW_SIZE * OPTIMIZE_VIEW_SIZE);
+    glm::vec3 min = glm::vec3(INFINITY);
+    glm::vec3 max = glm::vec3(-INFINITY);
+    uint64_t shaded = 0;
+    uint64_t covered = 0;
+    
+    for(uint32_t i = 0; i < 3 * numTris; ++i)
+    {
+        min = glm::min(min, positions[indices[i]]);
+        max = glm::max(max, positions[indices[i]]);
+    }
+    
+    for(uint32_t view = 0; view < 6; ++view)
+    {
+        uint32_t axis = view / 2;
+        uint32_t u = (axis + 1) % 3;
+        uint32_t v = (axis + 2) % 3;
+        float facing = view % 2 ? 1.0f : -1.0f;
+        float scaleU = max[u] > min[u] ? OPTIMIZE_VIEW_SIZE / (max[u] - min[u]) : 0.0f;
+        float scaleV = max[v] > min[v] ? OPTIMIZE_VIEW_SIZE / (max[v] - min[v]) : 0.0f;
+        
+        std::fill(depths.begin(), depths.end(), INFINITY);
+        
+        for(uint32_t t = 0; t < numTris; ++t)
+        {
+            glm::vec3 p[3];
+            float area;
+            int32_t x0, y0, x1, y1;
+            
+            for(uint32_t k = 0; k < 3; ++k)
+            {
+                glm::vec3 position = positions[indices[3 * t + k]];
+                
+                p[k] = glm::vec3((position[u] - min[u]) * scaleU, (position[v] - min[v]) * scaleV, -facing * position[axis]);
+            }
+            
+            //Only triangles with their counter clockwise side towards the view are drawn
+            area = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[1].y - p[0].y) * (p[2].x - p[0].x);
+            if(facing * area <= 0) continue;
+            
+            x0 = std::max((int32_t)floorf(std::min(std::min(p[0].x, p[1].x), p[2].x)), 0);
+            y0 = std::max((int32_t)floorf(std::min(std::min(p[0].y, p[1].y), p[2].y)), 0);
+            x1 = std::min((int32_t)ceilf(std::max(std::max(p[0].x, p[1].x), p[2].x)), OPTIMIZE_VIEW_SIZE - 1);
+            y1 = std::min((int32_t)ceilf(std::max(std::max(p[0].y, p[1].y), p[2].y)), OPTIMIZE_VIEW_SIZE - 1);
+            
+            for(int32_t y = y0; y <= y1; ++y)
+            {
+                for(int32_t x = x0; x <= x1; ++x)
+                {
+                    float px = x + 0.5f;
+                    float py = y + 0.5f;
+                    float w0 = ((p[1].x - px) * (p[2].y - py) - (p[1].y - py) * (p[2].x - px)) / area;
+                    float w1 = ((p[2].x - px) * (p[0].y - py) - (p[2].y - py) * (p[0].x - px)) / area;
+                    float w2 = 1.0f - w0 - w1;
+                    float depth = w0 * p[0].z + w1 * p[1].z + w2 * p[2].z;
+                    float* pixel = &depths[y * OPTIMIZE_VIEW_SIZE + x];
+                    
+                    if(w0 < 0 || w1 < 0 || w2 < 0 || depth >= *pixel) continue;
+                    
+                    covered += *pixel == INFINITY;
+                    ++shaded;
+                    *pixel = depth;
+                }
+            }
+        }
+    }
+    
+    return covered ? (float)shaded / covered : 0.0f;
+}
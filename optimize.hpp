@@ -0,0 +1,29 @@
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+#include <stdint.h>
+#include <glm/glm.hpp>
+
+/*Entries of the FIFO post-transform cache triangles are ordered for and measured against*/
+#define OPTIMIZE_CACHE_SIZE 16
+
+/*Reorders the triangles in indices for post-transform cache reuse with Tipsify and writes them
+  to outIndices.  Indices must be below numVertices and are best numbered in order of first use,
+  vertices are visited in index order whenever the fan being emitted runs dry.  Triangles keep
+  their winding.*/
+void optimizeVertexCache(const uint32_t* indices, uint32_t numTris, uint32_t numVertices, uint32_t* outIndices);
+/*Splits triangles ordered by optimizeVertexCache into clusters wherever the cache restarts
+  or a cluster reaches a low enough ACMR, then sorts the clusters so the ones facing out from
+  the middle of the mesh draw first and hide what lies behind them.  Triangles within a
+  cluster keep their order, so most of the cache reuse survives.*/
+void optimizeOverdraw(const glm::vec3* positions, const uint32_t* indices, uint32_t numTris, uint32_t numVertices,
+    uint32_t* outIndices);
+/*Average vertex shader invocations per triangle through an OPTIMIZE_CACHE_SIZE FIFO cache,
+  between 0.5 for a perfect grid and 3*/
+float analyzeVertexCache(const uint32_t* indices, uint32_t numTris, uint32_t numVertices);
+/*Pixels shaded per pixel covered when the triangles are drawn in order with early depth
+  testing and back face culling, averaged over the six axis views of the mesh's bounds.  1
+  means every covered pixel was shaded once.*/
+float analyzeOverdraw(const glm::vec3* positions, const uint32_t* indices, uint32_t numTris);
+
+#endif //OPTIMIZE_H
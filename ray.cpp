@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 #include <vulkan/vulkan.h>
 #include <GLFW/glfw3.h>
 #define GLM_FORCE_RADIANS
@@ -14,11 +15,17 @@
 
 #include "context.h"
 #include "debugUtils.h"
+#include "mesh.hpp"
 #include "renderer.hpp"
+#include "threadPool.hpp"
 #include "uniformBuffer.hpp"
 
 #define MOVE_SPEED 0.001f
 #define CAM_SENSITIVITY -0.005f
+#define REFLECTION_TARGET_MS 4.0f
+#define PROXY_RATIO 0.5f
+/*Meshes whose half precision positions stay this close, relative to their size, raster packed*/
+#define PACKED_MAX_ERROR 0.001f
 
 long int readShaderFromFile(const char* fileName, char** shaderSrc)
 {
@@ -27,6 +34,14 @@ long int readShaderFromFile(const char* fileName, char** shaderSrc)
     
     file = fopen(fileName, "rb");
     
+    /*Checked outside of ASSERT so release builds missing a compiled shader stop here too*/
+    if(!file)
+    {
+        fprintf(stderr, "Failed to open %s, compile it from shaders as the Readme describes\n", fileName);
+        *shaderSrc = NULL;
+        return -1;
+    }
+    
     fseek(file, 0, SEEK_END);
     
     size = ftell(file);
@@ -40,25 +55,54 @@ long int readShaderFromFile(const char* fileName, char** shaderSrc)
     return size;
 }
 
+/*Everything main creates before the first pipeline, in reverse order*/
+void destroyStartup(GLFWwindow* window, Context* context, Renderer* renderer, MeshData* scene, StandardUniforms* uniforms)
+{
+    rendererDestroy(renderer);
+    
+    meshDataDestroy(scene);
+    free(uniforms);
+    
+    cleanupRender(context);
+    
+    unbindWindowContext(context);
+    glfwDestroyWindow(window);
+    
+    destroyContext(context);
+    glfwTerminate();
+}
+
 int main(int argc, char** argv)
 {
     GLFWwindow* window;
     Context context;
     Renderer renderer;
+    MeshData scene;
+    ThreadPool loadPool;
     char* vert1Src;
     char* frag1Src;
     char* vert2Src;
     char* frag2Src;
+    char* lbvhSrc;
+    char* wavefrontSrc;
+    char* sortSrc;
+    char* tileCullSrc;
     long int vert1Size;
     long int frag1Size;
     long int vert2Size;
     long int frag2Size;
-    StandardUniforms uniforms[2];
+    long int lbvhSize;
+    long int wavefrontSize;
+    long int sortSize;
+    long int tileCullSize;
+    StandardUniforms* uniforms;
+    MeshOptimizeReport* reports;
     float fovy = glm::pi<float>()/2.0f;
     float nearClip = 0.1f;
     float farClip = 100.0f;
     double lastX = 0;
     double xPos, yPos;
+    int res;
     
     /*Apparently, using a lefthanded perspective perspective matrix results in a functional righthanded
       coordinate system and using a righthanded perspective matrix results in z > 1 every time.*/
@@ -66,9 +110,43 @@ int main(int argc, char** argv)
     
     glm::quat camRot = glm::angleAxis(0.0f, glm::vec3(0.0f, -1.0f, 0.0f));
     
+    /*-cook in.obj out.mesh converts an OBJ file offline and exits without opening a window*/
+    if(argc > 3 && !strcmp(argv[1], "-cook"))
+    {
+        res = threadPoolCreate(&loadPool, 0);
+        ASSERT(res == 0, "Failed to create loading threads");
+        
+        res = meshDataLoadOBJ(&scene, argv[2], &loadPool);
+        ASSERT(res == 0, "Failed to load meshes");
+        
+        reports = (MeshOptimizeReport*)malloc(scene.numMeshes * sizeof(MeshOptimizeReport));
+        res = meshDataOptimize(&scene, reports);
+        ASSERT(res == 0, "Failed to optimize meshes");
+        
+        for(uint32_t i = 0; i < scene.numMeshes; ++i)
+        {
+            printf("Mesh %u: ACMR %.3f -> %.3f, overdraw %.3f -> %.3f\n", i, reports[i].acmrBefore, reports[i].acmrAfter,
+                reports[i].overdrawBefore, reports[i].overdrawAfter);
+        }
+        
+        printf("Loaded in %.3f ms, optimized in %.3f ms\n", scene.loadMs, scene.optimizeMs);
+        
+        free(reports);
+        
+        printf("%u of %u meshes packed\n", meshDataPackVertices(&scene, PACKED_MAX_ERROR), scene.numMeshes);
+        
+        res = meshDataCook(&scene, argv[3], &loadPool);
+        ASSERT(res == 0, "Failed to cook meshes");
+        
+        meshDataDestroy(&scene);
+        threadPoolDestroy(&loadPool);
+        
+        return 0;
+    }
+    
     glfwInit();
     
-    int res = createContext(&context);
+    res = createContext(&context);
     ASSERT(res == 0, "Failed to create context");
     
     glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
@@ -85,13 +163,60 @@ int main(int argc, char** argv)
     res = setupRender(&context);
     ASSERT(res == 0, "Failed to setup render");
     
-    res = rendererCreate(&renderer, &context);
+    /*An OBJ or cooked file on the command line replaces the built in meshes*/
+    if(argc > 1 && strlen(argv[1]) > 4 && !strcmp(argv[1] + strlen(argv[1]) - 4, ".obj"))
+    {
+        res = threadPoolCreate(&loadPool, 0);
+        ASSERT(res == 0, "Failed to create loading threads");
+        
+        res = meshDataLoadOBJ(&scene, argv[1], &loadPool);
+        threadPoolDestroy(&loadPool);
+        
+        if(res == 0) res = meshDataOptimize(&scene, NULL);
+        if(res == 0) meshDataPackVertices(&scene, PACKED_MAX_ERROR);
+    }
+    else if(argc > 1)
+    {
+        res = meshDataLoadCooked(&scene, argv[1]);
+    }
+    else
+    {
+        res = meshDataCreateDefault(&scene);
+    }
+    
+    ASSERT(res == 0, "Failed to load meshes");
+    
+    res = rendererCreate(&renderer, &context, &scene);
     ASSERT(res == 0, "Failed to create render engine");
     
+    uniforms = (StandardUniforms*)malloc(getNumObjects(&renderer) * sizeof(StandardUniforms));
+    
+    /*Every shader is read before the first pipeline is created, so a missing one only adds
+      freeing the sources that were read to the normal teardown*/
     vert1Size = readShaderFromFile("shaders/mpAttachVert.spv", &vert1Src);
     frag1Size = readShaderFromFile("shaders/mpAttachFrag.spv", &frag1Src);
     vert2Size = readShaderFromFile("shaders/triCastVert.spv", &vert2Src);
     frag2Size = readShaderFromFile("shaders/triCastFrag.spv", &frag2Src);
+    lbvhSize = readShaderFromFile("shaders/lbvh.spv", &lbvhSrc);
+    wavefrontSize = readShaderFromFile("shaders/wavefront.spv", &wavefrontSrc);
+    sortSize = readShaderFromFile("shaders/sort.spv", &sortSrc);
+    tileCullSize = readShaderFromFile("shaders/tileCull.spv", &tileCullSrc);
+    
+    if(vert1Size < 0 || frag1Size < 0 || vert2Size < 0 || frag2Size < 0 ||
+        lbvhSize < 0 || wavefrontSize < 0 || sortSize < 0 || tileCullSize < 0)
+    {
+        free(vert1Src);
+        free(frag1Src);
+        free(vert2Src);
+        free(frag2Src);
+        free(lbvhSrc);
+        free(wavefrontSrc);
+        free(sortSrc);
+        free(tileCullSrc);
+        
+        destroyStartup(window, &context, &renderer, &scene, uniforms);
+        return -1;
+    }
     
     res = createPipeline(&renderer, 
         {(const char*)vert1Src, (uint32_t)vert1Size}, 
@@ -106,6 +231,26 @@ int main(int argc, char** argv)
     free(vert2Src);
     free(frag2Src);
     
+    res = createComputePipeline(&renderer, {(const char*)lbvhSrc, (uint32_t)lbvhSize});
+    ASSERT(res == 0, "Failed to create compute pipeline");
+    
+    free(lbvhSrc);
+    
+    res = createWavefrontPipeline(&renderer, {(const char*)wavefrontSrc, (uint32_t)wavefrontSize});
+    ASSERT(res == 0, "Failed to create wavefront pipeline");
+    
+    free(wavefrontSrc);
+    
+    res = createSortPipeline(&renderer, {(const char*)sortSrc, (uint32_t)sortSize});
+    ASSERT(res == 0, "Failed to create sort pipeline");
+    
+    free(sortSrc);
+    
+    res = createTileCullPipeline(&renderer, {(const char*)tileCullSrc, (uint32_t)tileCullSize});
+    ASSERT(res == 0, "Failed to create tile culling pipeline");
+    
+    free(tileCullSrc);
+    
     createTextureFromFile(&renderer, "res/brick.png", 0);
     updateTexture(&renderer, 0);
     createTextureFromFile(&renderer, "res/spinner.png", 1);
@@ -114,8 +259,17 @@ int main(int argc, char** argv)
     res = createRenderCommands(&renderer);
     ASSERT(res == 0, "Failed to create render commands");
     
+    res = setBVHMode(&renderer, BVH_MODE_REFIT);
+    ASSERT(res == 0, "Failed to enable BVH refitting");
+    
+    res = setTriangleSorting(&renderer, true);
+    ASSERT(res == 0, "Failed to enable triangle sorting");
+    
+    res = setReflectionBudget(&renderer, 3, 2 * context.width * context.height);
+    ASSERT(res == 0, "Failed to set reflection budget");
+    
     setCamPos(&renderer, {0, 0, -1});
-
+    
     glfwGetCursorPos(window, &xPos, &yPos);
     lastX = xPos;
     
@@ -124,6 +278,25 @@ int main(int argc, char** argv)
         glfwPollEvents();
         if(glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS) break;
         
+        if(glfwGetKey(window, GLFW_KEY_1)) setReflectionBackend(&renderer, REFLECTION_BACKEND_RASTER);
+        if(glfwGetKey(window, GLFW_KEY_2)) setReflectionBackend(&renderer, REFLECTION_BACKEND_WAVEFRONT);
+        if(glfwGetKey(window, GLFW_KEY_3)) setReflectionBackend(&renderer, REFLECTION_BACKEND_TILED);
+        if(glfwGetKey(window, GLFW_KEY_4)) setTileCulling(&renderer, true);
+        if(glfwGetKey(window, GLFW_KEY_5)) setTileCulling(&renderer, false);
+        if(glfwGetKey(window, GLFW_KEY_6)) setReflectionResolution(&renderer, REFLECTION_RESOLUTION_FULL);
+        if(glfwGetKey(window, GLFW_KEY_7)) setReflectionResolution(&renderer, REFLECTION_RESOLUTION_HALF);
+        if(glfwGetKey(window, GLFW_KEY_8)) setReflectionResolution(&renderer, REFLECTION_RESOLUTION_QUARTER);
+        if(glfwGetKey(window, GLFW_KEY_9)) setTemporalReflections(&renderer, true);
+        if(glfwGetKey(window, GLFW_KEY_0)) setTemporalReflections(&renderer, false);
+        if(glfwGetKey(window, GLFW_KEY_MINUS)) setWideBVH(&renderer, true);
+        if(glfwGetKey(window, GLFW_KEY_EQUAL)) setWideBVH(&renderer, false);
+        if(glfwGetKey(window, GLFW_KEY_LEFT_BRACKET)) setTriangleSorting(&renderer, true);
+        if(glfwGetKey(window, GLFW_KEY_RIGHT_BRACKET)) setTriangleSorting(&renderer, false);
+        if(glfwGetKey(window, GLFW_KEY_SEMICOLON)) setFrameTimeTarget(&renderer, REFLECTION_TARGET_MS);
+        if(glfwGetKey(window, GLFW_KEY_APOSTROPHE)) setFrameTimeTarget(&renderer, 0);
+        if(glfwGetKey(window, GLFW_KEY_COMMA)) setProxyRatio(&renderer, PROXY_RATIO);
+        if(glfwGetKey(window, GLFW_KEY_PERIOD)) setProxyRatio(&renderer, 1.0f);
+        
         glm::vec3 camPos = getCamPos(&renderer);
         glm::vec3 movement = {};
         
@@ -164,22 +337,19 @@ int main(int argc, char** argv)
         glm::mat4 camTransform = glm::translate(camPos) * glm::toMat4(camRot);
         glm::mat4 viewMat = glm::inverse(camTransform);
         
-        uniforms[0].model = glm::translate(glm::vec3(glm::sin((float)glfwGetTime() * 0.5f), 0.0f, 0.0f));
-        uniforms[0].camPos = getCamPos(&renderer);
-        
-        
-        uniforms[0].vp = projection * viewMat;
-        uniforms[0].texture = 1;
-        
-        updateSingleUniform(&renderer, &uniforms[0], 0);
-        
-        uniforms[1].model = glm::mat4(1.0f);
-        uniforms[1].camPos = getCamPos(&renderer);
-        
-        uniforms[1].vp = projection * viewMat;
-        uniforms[1].texture = 0;
-        
-        updateSingleUniform(&renderer, &uniforms[1], 1);
+        //The first object slides back and forth, the rest stay put
+        for(uint32_t i = 0; i < getNumObjects(&renderer); ++i)
+        {
+            uniforms[i].model = i == 0 ? glm::translate(glm::vec3(glm::sin((float)glfwGetTime() * 0.5f), 0.0f, 0.0f)) : glm::mat4(1.0f);
+            uniforms[i].camPos = getCamPos(&renderer);
+            
+            uniforms[i].vp = projection * viewMat;
+            uniforms[i].texture = i == 0 ? 1 : 0;
+            uniforms[i].reflectivity = 0.5f;
+            uniforms[i].roughness = 0.0f;
+            
+            updateSingleUniform(&renderer, &uniforms[i], i);
+        }
         
         render(&renderer);
     }
@@ -188,18 +358,18 @@ int main(int argc, char** argv)
     destroyTexture(&renderer, 1);
     
     destroyRenderCommands(&renderer);
-
-    destroyPipeline(&renderer);
     
-    rendererDestroy(&renderer);
+    destroyWavefrontPipeline(&renderer);
     
-    cleanupRender(&context);
+    destroyTileCullPipeline(&renderer);
     
-    unbindWindowContext(&context);
-    glfwDestroyWindow(window);
+    destroySortPipeline(&renderer);
     
-    destroyContext(&context);
-    glfwTerminate();
+    destroyComputePipeline(&renderer);
+    
+    destroyPipeline(&renderer);
+    
+    destroyStartup(window, &context, &renderer, &scene, uniforms);
     
 #ifndef NDEBUG
     system("PAUSE");
@@ -1,58 +1,27 @@
 #include "renderer.hpp"
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <algorithm>
 #include <vulkan/vulkan.h>
 
+#include "bvh.hpp"
 #include "context.h"
+#include "gpuBVH.hpp"
+#include "gpuPrimitives.hpp"
+#include "mesh.hpp"
 #include "shaderStorageBuffer.hpp"
+#include "simplify.hpp"
 #include "texture.h"
+#include "tileCull.hpp"
 #include "uniformBuffer.hpp"
 #include "vertex.hpp"
+#include "wavefront.hpp"
 #include "utilMacros.h"
 #include "debugUtils.h"
 
-const Vertex _vertices[14] =
-{
-    {glm::vec4(-0.5f, 0, 0, 1), glm::vec4(-1, 0, 0, 0), glm::vec4(0, 0, 0, 0)},
-    {glm::vec4(0, 0, -0.5f, 1), glm::vec4(0, 0, -1, 0), glm::vec4(0, 1, 0, 0)},
-    {glm::vec4(0.5f, 0, 0, 1), glm::vec4(1, 0, 0, 0), glm::vec4(1, 1, 0, 0)},
-    {glm::vec4(0, 0, 0.5f, 1), glm::vec4(0, 0, 1, 0), glm::vec4(1, 0, 0, 0)},
-    {glm::vec4(0, -0.5f, 0, 1), glm::vec4(0, -1, 0, 0), glm::vec4(0.5f, 0.5f, 0, 0)},
-    {glm::vec4(0, 0.5f, 0, 1), glm::vec4(0, 1, 0, 0), glm::vec4(0.5f, 0.5f, 0, 0)},
-    {glm::vec4(-1, 1, -1, 1), glm::vec4(0.0f, -1.0f, 0.0f, 0.0f), glm::vec4(0, 0, 0, 0)},
-    {glm::vec4(1, 1, -1, 1), glm::vec4(0.0f, -1.0f, 0.0f, 0.0f), glm::vec4(1, 0, 0, 0)},
-    {glm::vec4(1, 1, 1, 1), glm::vec4(0.0f, -1.0f, 0.0f, 0.0f), glm::vec4(1, 1, 0, 0)},
-    {glm::vec4(-1, 1, 1, 1), glm::vec4(0.0f, -1.0f, 0.0f, 0.0f), glm::vec4(0, 1, 0, 0)},
-    {glm::vec4(-1, 1, 1, 1), glm::vec4(0.0f, 0.0f, -1.0f, 0.0f), glm::vec4(0, 1, 0, 0)},
-    {glm::vec4(1, 1, 1, 1), glm::vec4(0.0f, 0.0f, -1.0f, 0.0f), glm::vec4(1, 1, 0, 0)},
-    {glm::vec4(1, -1, 1, 1), glm::vec4(0.0f, 0.0f, -1.0f, 0.0f), glm::vec4(1, 0, 0, 0)},
-    {glm::vec4(-1, -1, 1, 1), glm::vec4(0.0f, 0.0f, -1.0f, 0.0f), glm::vec4(0, 0, 0, 0)}
-};
-
-const uint16_t _indices[36] = 
-{
-    0, 1, 4,
-    1, 2, 4,
-    2, 3, 4,
-    3, 0, 4,
-    1, 0, 5,
-    2, 1, 5,
-    3, 2, 5,
-    0, 3, 5,
-    6, 7, 8,
-    8, 9, 6,
-    10, 11, 12,
-    12, 13, 10,
-};
-
-const VkDrawIndexedIndirectCommand _indirect[2] =
-{
-    {24, 1, 0, 0, 0},
-    {12, 1, 24, 0, 1}
-};
-
 static inline int32_t createRenderBuffers(Renderer* renderer, Context* context)
 {
     VkResult result;
@@ -76,6 +45,7 @@ static inline int32_t createRenderBuffers(Renderer* renderer, Context* context)
     int32_t colorOffset;
     int32_t positionOffset;
     int32_t normalOffset;
+    uint32_t familyIndices[3];
     
     imageInfos[0].sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
     imageInfos[0].imageType = VK_IMAGE_TYPE_2D;
@@ -85,7 +55,7 @@ static inline int32_t createRenderBuffers(Renderer* renderer, Context* context)
     imageInfos[0].arrayLayers = 1;
     imageInfos[0].samples = VK_SAMPLE_COUNT_1_BIT;
     imageInfos[0].tiling = VK_IMAGE_TILING_OPTIMAL;
-    imageInfos[0].usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+    imageInfos[0].usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
     imageInfos[0].sharingMode = VK_SHARING_MODE_EXCLUSIVE;
     imageInfos[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
     
@@ -98,14 +68,16 @@ static inline int32_t createRenderBuffers(Renderer* renderer, Context* context)
         imageInfos[i].arrayLayers = 1;
         imageInfos[i].samples = VK_SAMPLE_COUNT_1_BIT;
         imageInfos[i].tiling = VK_IMAGE_TILING_OPTIMAL;
-        imageInfos[i].usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
-        imageInfos[i].sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        imageInfos[i].usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+        imageInfos[i].sharingMode = getSharingMode(context);
+        imageInfos[i].queueFamilyIndexCount = getFamilies(context, familyIndices);
+        imageInfos[i].pQueueFamilyIndices = familyIndices;
         imageInfos[i].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
     }
     
     imageInfos[1].format = VK_FORMAT_R8G8B8A8_UNORM;
     imageInfos[2].format = VK_FORMAT_R16G16B16A16_SFLOAT;
-    imageInfos[3].format = VK_FORMAT_R16G16_SFLOAT;
+    imageInfos[3].format = VK_FORMAT_R16G16B16A16_SFLOAT;
     
     result = vkCreateImage(context->device, &imageInfos[0], NULL, &renderer->_depthBuffer);
     if(result != VK_SUCCESS) return -1;
@@ -204,7 +176,7 @@ static inline int32_t createRenderBuffers(Renderer* renderer, Context* context)
         layoutBarriers[i].srcAccessMask = 0;
         layoutBarriers[i].dstAccessMask = 
             VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-            
+        
         layoutBarriers[i].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
         layoutBarriers[i].newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
         layoutBarriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
@@ -277,66 +249,59 @@ static inline int32_t createRenderPass(Renderer* renderer, Context* context)
     VkRenderPassCreateInfo renderPassInfo = {};
     VkFramebufferCreateInfo frameBufferInfo = {};
     VkImageView framebufferAttachements[5] = {};
-    VkSubpassDependency subpassDeps = {};
+    VkSubpassDependency subpassDeps[2] = {};
     VkResult result;
     
-    passAttachments[0].format = context->colorFormat;
+    /*The G-buffer and reflection passes are separate render passes so compute work can be
+      recorded between them.  Attachments are ordered depth, G-buffer, back buffer and each
+      pass uses four consecutive ones.*/
+    passAttachments[0].format = VK_FORMAT_D32_SFLOAT;
     passAttachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
     passAttachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
     passAttachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
     passAttachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     passAttachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    passAttachments[0].initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-    passAttachments[0].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-    
-    passAttachments[1].format = VK_FORMAT_D32_SFLOAT;
-    passAttachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
-    passAttachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    passAttachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    passAttachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    passAttachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    passAttachments[1].initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-    passAttachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-    
-    passAttachments[2].format = VK_FORMAT_R8G8B8A8_UNORM;
-    passAttachments[2].samples = VK_SAMPLE_COUNT_1_BIT;
-    passAttachments[2].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    passAttachments[2].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    passAttachments[2].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    passAttachments[2].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    passAttachments[2].initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-    passAttachments[2].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    /*Depth is kept for the screen space march in the reflection pass*/
+    passAttachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    passAttachments[0].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
     
+    passAttachments[1].format = VK_FORMAT_R8G8B8A8_UNORM;
+    passAttachments[2].format = VK_FORMAT_R16G16B16A16_SFLOAT;
+    /*Normal x and z with the material reflectivity and roughness*/
     passAttachments[3].format = VK_FORMAT_R16G16B16A16_SFLOAT;
-    passAttachments[3].samples = VK_SAMPLE_COUNT_1_BIT;
-    passAttachments[3].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    passAttachments[3].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    passAttachments[3].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    passAttachments[3].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    passAttachments[3].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    passAttachments[3].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-    
-    passAttachments[4].format = VK_FORMAT_R16G16_SFLOAT;
+    
+    for(int32_t i = 1; i < 4; ++i)
+    {
+        passAttachments[i].samples = VK_SAMPLE_COUNT_1_BIT;
+        passAttachments[i].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        passAttachments[i].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        passAttachments[i].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        passAttachments[i].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        passAttachments[i].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        passAttachments[i].finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    }
+    
+    passAttachments[4].format = context->colorFormat;
     passAttachments[4].samples = VK_SAMPLE_COUNT_1_BIT;
     passAttachments[4].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    passAttachments[4].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    passAttachments[4].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
     passAttachments[4].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     passAttachments[4].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     passAttachments[4].initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
     passAttachments[4].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
     
-    backReference.attachment = 0;
-    backReference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-    
-    depthReference.attachment = 1;
+    depthReference.attachment = 0;
     depthReference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
     
+    backReference.attachment = 3;
+    backReference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    
     for(int32_t i = 0; i < 3; ++i)
     {
-        writeReferences[i].attachment = i + 2;
+        writeReferences[i].attachment = i + 1;
         writeReferences[i].layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
         
-        readReferences[i].attachment = i + 2;
+        readReferences[i].attachment = i;
         readReferences[i].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
     }
     
@@ -351,44 +316,74 @@ static inline int32_t createRenderPass(Renderer* renderer, Context* context)
     subpasses[1].inputAttachmentCount = 3;
     subpasses[1].pInputAttachments = readReferences;
     
-    subpassDeps.srcSubpass = 0;
-    subpassDeps.dstSubpass = 1;
-    subpassDeps.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    subpassDeps.dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-    subpassDeps.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-    subpassDeps.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-    subpassDeps.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+    subpassDeps[0].srcSubpass = 0;
+    subpassDeps[0].dstSubpass = VK_SUBPASS_EXTERNAL;
+    subpassDeps[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    subpassDeps[0].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    subpassDeps[0].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    subpassDeps[0].dstAccessMask = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+    /*The tile culling prepass reads whole tiles of the G-buffer, not just its own pixel*/
+    subpassDeps[0].dependencyFlags = 0;
+    
+    subpassDeps[1].srcSubpass = VK_SUBPASS_EXTERNAL;
+    subpassDeps[1].dstSubpass = 0;
+    subpassDeps[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT;
+    subpassDeps[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    subpassDeps[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    /*RayStats is cleared by a transfer and then updated with atomics, which write as well as read*/
+    subpassDeps[1].dstAccessMask = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    subpassDeps[1].dependencyFlags = 0;
     
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-    renderPassInfo.attachmentCount = 5;
+    renderPassInfo.attachmentCount = 4;
     renderPassInfo.pAttachments = passAttachments;
-    renderPassInfo.subpassCount = 2;
-    renderPassInfo.pSubpasses = subpasses;
+    renderPassInfo.subpassCount = 1;
+    renderPassInfo.pSubpasses = &subpasses[0];
     renderPassInfo.dependencyCount = 1;
-    renderPassInfo.pDependencies = &subpassDeps;
+    renderPassInfo.pDependencies = &subpassDeps[0];
     result = vkCreateRenderPass(context->device, &renderPassInfo, NULL, &renderer->_renderPass);
     
     if(result != VK_SUCCESS) return -1;
     
+    for(int32_t i = 1; i < 4; ++i)
+    {
+        passAttachments[i].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+        passAttachments[i].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        passAttachments[i].initialLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    }
+    
+    renderPassInfo.pAttachments = &passAttachments[1];
+    renderPassInfo.pSubpasses = &subpasses[1];
+    renderPassInfo.pDependencies = &subpassDeps[1];
+    result = vkCreateRenderPass(context->device, &renderPassInfo, NULL, &renderer->_reflectionPass);
+    
+    if(result != VK_SUCCESS) return -1;
+    
     
-    framebufferAttachements[1] = renderer->_depthView;
-    framebufferAttachements[2] = renderer->_colorView;
-    framebufferAttachements[3] = renderer->_positionView;
-    framebufferAttachements[4] = renderer->_normalView;
+    framebufferAttachements[0] = renderer->_depthView;
+    framebufferAttachements[1] = renderer->_colorView;
+    framebufferAttachements[2] = renderer->_positionView;
+    framebufferAttachements[3] = renderer->_normalView;
     
     frameBufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
     frameBufferInfo.renderPass = renderer->_renderPass;
-    frameBufferInfo.attachmentCount = 5;
+    frameBufferInfo.attachmentCount = 4;
     frameBufferInfo.pAttachments = framebufferAttachements;
     frameBufferInfo.width = context->width;
     frameBufferInfo.height = context->height;
     frameBufferInfo.layers = 1;
     
+    result = vkCreateFramebuffer(context->device, &frameBufferInfo, NULL, &renderer->_gBufferFrameBuffer);
+    if(result != VK_SUCCESS) return -2;
+    
+    frameBufferInfo.renderPass = renderer->_reflectionPass;
+    frameBufferInfo.pAttachments = &framebufferAttachements[1];
+    
     renderer->_frameBuffers = (VkFramebuffer*)malloc(sizeof(VkFramebuffer) * context->numImages);
     
     for(int i = 0; i < context->numImages; ++i)
     {
-        framebufferAttachements[0] = context->presentViews[i];
+        framebufferAttachements[4] = context->presentViews[i];
         result = vkCreateFramebuffer(context->device, &frameBufferInfo, NULL, &renderer->_frameBuffers[i]);
         if(result != VK_SUCCESS) return -2;
     }
@@ -396,8 +391,167 @@ static inline int32_t createRenderPass(Renderer* renderer, Context* context)
     return 0;
 }
 
+static inline uint32_t blasMaxNodes(Renderer* renderer)
+{
+    const MeshData* scene = renderer->_scene;
+    uint32_t maxNodes = 0;
+    
+    for(uint32_t i = 0; i < renderer->_numMeshes; ++i)
+    {
+        maxNodes += bvhMaxNodes(scene->draws[i].indexCount / 3);
+    }
+    
+    return maxNodes;
+}
+
+/*Every raster triangle of the sort pipeline carries the first ray tracing triangle of its
+  mesh, which finds the instance it is keyed through and changes whenever the BLAS do*/
+static inline int32_t writeSortTriangles(Renderer* renderer)
+{
+    const MeshData* scene = renderer->_scene;
+    VkDeviceSize size = (scene->numIndices / 3) * 4 * sizeof(uint32_t);
+    uint32_t* triangles;
+    uint32_t* firstTris;
+    int32_t res = 0;
+    
+    if(renderer->_cookedBLAS && scene->sortTriangles)
+    {
+        return shaderStorageBufferWrite(&renderer->_sortTriangleBuffer, renderer->context, scene->sortTriangles, size) ? -1 : 0;
+    }
+    
+    triangles = (uint32_t*)malloc(size);
+    firstTris = (uint32_t*)malloc(renderer->_numMeshes * sizeof(uint32_t));
+    
+    for(uint32_t i = 0; i < renderer->_numMeshes; ++i)
+    {
+        firstTris[i] = renderer->_meshes[i].range.firstTri;
+    }
+    
+    meshDataFillSortTriangles(scene, firstTris, triangles);
+    
+    if(shaderStorageBufferWrite(&renderer->_sortTriangleBuffer, renderer->context, triangles, size)) res = -1;
+    
+    free(triangles);
+    free(firstTris);
+    
+    return res;
+}
+
+/*Builds one object space BLAS per mesh and uploads them back to back.  Child and triangle
+  indices are offset so every BLAS indexes the shared node, index and triangle record
+  buffers directly.  A mesh traces its registered proxy if it has one, a copy simplified to
+  _proxyRatio of its triangles below a ratio of 1 and its raster triangles otherwise.  Proxies
+  never have more triangles than the raster mesh, so the buffers sized for the raster
+  triangles hold every build.  Cooked scenes come with the raster BLAS already built, which
+  are uploaded as they are while nothing asks for proxies.*/
+static int32_t buildBLAS(Renderer* renderer)
+{
+    const MeshData* scene = renderer->_scene;
+    BLASImage built = {};
+    const BLASImage* image = &scene->blas;
+    const uint32_t** meshIndices = NULL;
+    uint32_t* meshTris = NULL;
+    uint32_t* rasterIndices = NULL;
+    uint32_t* simplifiedIndices = NULL;
+    int32_t res = 0;
+    
+    renderer->_cookedBLAS = scene->blas.nodes && renderer->_proxyRatio >= 1.0f;
+    
+    for(uint32_t i = 0; i < renderer->_numMeshes; ++i)
+    {
+        if(renderer->_meshes[i].proxyIndices) renderer->_cookedBLAS = false;
+    }
+    
+    if(!renderer->_cookedBLAS)
+    {
+        uint32_t firstIndex = 0;
+        
+        meshIndices = (const uint32_t**)malloc(renderer->_numMeshes * sizeof(uint32_t*));
+        meshTris = (uint32_t*)malloc(renderer->_numMeshes * sizeof(uint32_t));
+        rasterIndices = (uint32_t*)malloc(scene->numIndices * sizeof(uint32_t));
+        simplifiedIndices = (uint32_t*)malloc(scene->numIndices * sizeof(uint32_t));
+        
+        for(uint32_t i = 0; i < renderer->_numMeshes; ++i)
+        {
+            const VkDrawIndexedIndirectCommand* cmd = &scene->draws[i];
+            const MeshBLAS* mesh = &renderer->_meshes[i];
+            
+            for(uint32_t j = 0; j < cmd->indexCount; ++j)
+            {
+                rasterIndices[firstIndex + j] = meshDataIndex(scene, cmd->firstIndex + j) + cmd->vertexOffset;
+            }
+            
+            meshIndices[i] = &rasterIndices[firstIndex];
+            meshTris[i] = cmd->indexCount / 3;
+            
+            if(mesh->proxyIndices)
+            {
+                meshIndices[i] = mesh->proxyIndices;
+                meshTris[i] = mesh->numProxyTris;
+            }
+            else if(renderer->_proxyRatio < 1.0f)
+            {
+                uint32_t targetTris = std::max((uint32_t)(renderer->_proxyRatio * meshTris[i]), 1u);
+                
+                meshTris[i] = simplifyMesh(scene->vertices, scene->numVertices, &rasterIndices[firstIndex], meshTris[i],
+                    targetTris, &simplifiedIndices[firstIndex]);
+                meshIndices[i] = &simplifiedIndices[firstIndex];
+            }
+            
+            firstIndex += cmd->indexCount;
+        }
+        
+        if(bvhBuildImage(&built, scene->vertices, meshIndices, meshTris, renderer->_numMeshes, &renderer->_threadPool)) res = -3;
+        image = &built;
+    }
+    
+    for(uint32_t i = 0; i < renderer->_numMeshes && !res; ++i)
+    {
+        renderer->_meshes[i].range = image->ranges[i];
+    }
+    
+    if(!res && shaderStorageBufferWrite(&renderer->_shaderIndexBuffer, renderer->context, image->triangles, image->numTris * 4 * sizeof(uint32_t))) res = -4;
+    if(!res && shaderStorageBufferWrite(&renderer->_shaderBVHBuffer, renderer->context, image->nodes, image->numNodes * sizeof(BVHNode))) res = -5;
+    if(!res && shaderStorageBufferWrite(&renderer->_shaderTriRecordBuffer, renderer->context, image->records, image->numTris * sizeof(TriangleRecord))) res = -6;
+    if(!res && shaderStorageBufferWrite(&renderer->_shaderWideBVHBuffer, renderer->context, image->wideNodes, image->numWideNodes * sizeof(BVHWideNode))) res = -9;
+    if(!res && renderer->_primitives._shader != VK_NULL_HANDLE && writeSortTriangles(renderer)) res = -10;
+    
+    DEBUG_PRINT("BLAS nodes (%s): %u binary (%zu bytes), %u wide (%zu bytes)\n", renderer->_cookedBLAS ? "cooked" : "built",
+        image->numNodes, image->numNodes * sizeof(BVHNode), image->numWideNodes, image->numWideNodes * sizeof(BVHWideNode));
+    
+    bvhDestroyImage(&built);
+    free(meshIndices);
+    free(meshTris);
+    free(rasterIndices);
+    free(simplifiedIndices);
+    
+    return res;
+}
+
+static inline int32_t createBLAS(Renderer* renderer, Context* context)
+{
+    const MeshData* scene = renderer->_scene;
+    uint32_t maxNodes = blasMaxNodes(renderer);
+    
+    if(shaderStorageBufferCreate(&renderer->_shaderIndexBuffer, context, (scene->numIndices / 3) * 4 * sizeof(uint32_t))) return -1;
+    if(shaderStorageBufferCreate(&renderer->_shaderBVHBuffer, context, maxNodes * sizeof(BVHNode))) return -2;
+    if(shaderStorageBufferCreate(&renderer->_shaderTriRecordBuffer, context, (scene->numIndices / 3) * sizeof(TriangleRecord))) return -7;
+    if(shaderStorageBufferCreate(&renderer->_shaderWideBVHBuffer, context, maxNodes * sizeof(BVHWideNode))) return -8;
+    
+    return buildBLAS(renderer);
+}
+
+static inline VertexFormat meshVertexFormat(const MeshData* scene, uint32_t mesh)
+{
+    return scene->vertexFormats ? (VertexFormat)scene->vertexFormats[mesh] : VERTEX_FORMAT_FULL;
+}
+
+/*The raster vertices are stored once per VertexFormat, each region only covering the range of
+  global vertices its meshes use.  Draws index their region through a negative vertex offset,
+  so the indices stay global and shared with the sort pipeline.*/
 static inline int32_t createVertexBuffer(Renderer* renderer, Context* context)
 {
+    const MeshData* scene = renderer->_scene;
     VkResult result;
     int32_t ssbRes;
     uint32_t vertexMemoryTypeBits;
@@ -407,9 +561,48 @@ static inline int32_t createVertexBuffer(Renderer* renderer, Context* context)
     VkMemoryAllocateInfo allocInfo = {};
     VkMemoryPropertyFlags desiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
     void* mapped;
-    uint32_t indices[(LENGTH_OF(_indices) * sizeof(uint32_t) * 4) / 3];
+    StorageVertex* storageVertices;
+    VertexAttributes* attributes;
+    VkDrawIndexedIndirectCommand* draws;
+    PackedVertex* packedVertices;
+    VkDeviceSize drawsSize = scene->numMeshes * sizeof(VkDrawIndexedIndirectCommand);
+    VkDeviceSize indicesSize = scene->numIndices * meshDataIndexSize(scene);
+    VkDeviceSize strides[VERTEX_NUM_FORMATS] = {sizeof(Vertex), sizeof(PackedVertex)};
+    uint32_t regionEnds[VERTEX_NUM_FORMATS] = {};
+    
+    renderer->_indexOffset = drawsSize;
+    
+    for(uint32_t i = 0; i < VERTEX_NUM_FORMATS; ++i)
+    {
+        renderer->_vertexRegionFirst[i] = scene->numVertices;
+    }
+    
+    for(uint32_t i = 0; i < scene->numMeshes; ++i)
+    {
+        const VkDrawIndexedIndirectCommand* cmd = &scene->draws[i];
+        VertexFormat format = meshVertexFormat(scene, i);
+        
+        for(uint32_t j = cmd->firstIndex; j < cmd->firstIndex + cmd->indexCount; ++j)
+        {
+            uint32_t vertex = meshDataIndex(scene, j) + cmd->vertexOffset;
+            
+            renderer->_vertexRegionFirst[format] = std::min(renderer->_vertexRegionFirst[format], vertex);
+            regionEnds[format] = std::max(regionEnds[format], vertex + 1);
+        }
+    }
+    
+    for(uint32_t i = 0; i < VERTEX_NUM_FORMATS; ++i)
+    {
+        renderer->_vertexRegionFirst[i] = std::min(renderer->_vertexRegionFirst[i], regionEnds[i]);
+        renderer->_vertexRegionOffsets[i] = renderer->_indexOffset;
+        renderer->_indexOffset += (regionEnds[i] - renderer->_vertexRegionFirst[i]) * strides[i];
+        
+        DEBUG_PRINT("Raster vertices %u: %u (%llu bytes)\n", i, regionEnds[i] - renderer->_vertexRegionFirst[i],
+            (unsigned long long)((regionEnds[i] - renderer->_vertexRegionFirst[i]) * strides[i]));
+    }
+    
     vertexInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    vertexInfo.size = sizeof(_indirect) + LENGTH_OF(_vertices) * sizeof(Vertex) + LENGTH_OF(_indices) * sizeof(uint16_t);
+    vertexInfo.size = renderer->_indexOffset + indicesSize;
     vertexInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
     vertexInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
     
@@ -441,36 +634,369 @@ static inline int32_t createVertexBuffer(Renderer* renderer, Context* context)
     result = vkMapMemory(context->device, renderer->_vertexMemory, 0, VK_WHOLE_SIZE, 0, &mapped);
     if(result != VK_SUCCESS) return -3;
     
-    memcpy(mapped, _indirect, sizeof(_indirect));
-    memcpy((uint8_t*)mapped + sizeof(_indirect), _vertices, sizeof(_vertices));
-    memcpy((uint8_t*)mapped + sizeof(_indirect) + sizeof(_vertices), _indices, sizeof(_indices));
+    draws = (VkDrawIndexedIndirectCommand*)mapped;
+    packedVertices = (PackedVertex*)((uint8_t*)mapped + renderer->_vertexRegionOffsets[VERTEX_FORMAT_PACKED]);
+    
+    for(uint32_t i = 0; i < scene->numMeshes; ++i)
+    {
+        draws[i] = scene->draws[i];
+        draws[i].vertexOffset -= (int32_t)renderer->_vertexRegionFirst[meshVertexFormat(scene, i)];
+    }
+    
+    memcpy((uint8_t*)mapped + renderer->_vertexRegionOffsets[VERTEX_FORMAT_FULL], &scene->vertices[renderer->_vertexRegionFirst[VERTEX_FORMAT_FULL]],
+        (regionEnds[VERTEX_FORMAT_FULL] - renderer->_vertexRegionFirst[VERTEX_FORMAT_FULL]) * sizeof(Vertex));
+    
+    for(uint32_t i = renderer->_vertexRegionFirst[VERTEX_FORMAT_PACKED]; i < regionEnds[VERTEX_FORMAT_PACKED]; ++i)
+    {
+        packedVertices[i - renderer->_vertexRegionFirst[VERTEX_FORMAT_PACKED]] = packVertex(&scene->vertices[i]);
+    }
+    
+    memcpy((uint8_t*)mapped + renderer->_indexOffset, scene->indices, indicesSize);
     vkUnmapMemory(context->device, renderer->_vertexMemory);
     result = vkBindBufferMemory(context->device, 
         renderer->_vertexBuffer, renderer->_vertexMemory, 0);
     
     if(result != VK_SUCCESS) return -4;
     
-    ssbRes = shaderStorageBufferCreate(&renderer->_shaderVertexBuffer, context, sizeof(_vertices));
+    ssbRes = shaderStorageBufferCreate(&renderer->_shaderVertexBuffer, context, scene->numVertices * sizeof(StorageVertex));
+    if(ssbRes != VK_SUCCESS) return -5;
+    
+    ssbRes = shaderStorageBufferCreate(&renderer->_shaderAttributeBuffer, context, scene->numVertices * sizeof(VertexAttributes));
     if(ssbRes != VK_SUCCESS) return -5;
     
-    ssbRes = shaderStorageBufferCreate(&renderer->_shaderIndexBuffer, context, sizeof(indices));
-    if(ssbRes != VK_SUCCESS) return -6;
-    for(int32_t i = 0; i < LENGTH_OF(indices); i += 4)
+    if(scene->storageVertices && scene->attributes)
+    {
+        shaderStorageBufferWrite(&renderer->_shaderVertexBuffer, context, scene->storageVertices, scene->numVertices * sizeof(StorageVertex));
+        shaderStorageBufferWrite(&renderer->_shaderAttributeBuffer, context, scene->attributes, scene->numVertices * sizeof(VertexAttributes));
+    }
+    else
+    {
+        storageVertices = (StorageVertex*)malloc(scene->numVertices * sizeof(StorageVertex));
+        attributes = (VertexAttributes*)malloc(scene->numVertices * sizeof(VertexAttributes));
+        
+        for(uint32_t i = 0; i < scene->numVertices; ++i)
+        {
+            storageVertices[i].position = glm::vec3(scene->vertices[i].position);
+            attributes[i].normal = packOctahedral(glm::normalize(glm::vec3(scene->vertices[i].normal)));
+            attributes[i].texCoords = glm::packHalf2x16(glm::vec2(scene->vertices[i].texCoords));
+        }
+        shaderStorageBufferWrite(&renderer->_shaderVertexBuffer, context, storageVertices, scene->numVertices * sizeof(StorageVertex));
+        shaderStorageBufferWrite(&renderer->_shaderAttributeBuffer, context, attributes, scene->numVertices * sizeof(VertexAttributes));
+        
+        free(storageVertices);
+        free(attributes);
+    }
+    
+    renderer->_numMeshes = scene->numMeshes;
+    renderer->_meshes = (MeshBLAS*)malloc(renderer->_numMeshes * sizeof(MeshBLAS));
+    
+    for(uint32_t i = 0; i < renderer->_numMeshes; ++i)
+    {
+        renderer->_meshes[i].proxyIndices = NULL;
+        renderer->_meshes[i].numProxyTris = 0;
+    }
+    
+    if(createBLAS(renderer, context)) return -6;
+    
+    renderer->_numObjects = 0;
+    for(uint32_t i = 0; i < scene->numMeshes; ++i)
+    {
+        renderer->_numObjects = std::max(renderer->_numObjects, scene->draws[i].firstInstance + scene->draws[i].instanceCount);
+    }
+    
+    renderer->_objectMeshes = (uint32_t*)malloc(renderer->_numObjects * sizeof(uint32_t));
+    renderer->_objectTransforms = (glm::mat4*)malloc(renderer->_numObjects * sizeof(glm::mat4));
+    renderer->_objectNormals = (glm::mat4*)malloc(renderer->_numObjects * sizeof(glm::mat4));
+    renderer->_objectTextures = (int32_t*)malloc(renderer->_numObjects * sizeof(int32_t));
+    renderer->_objectMaterials = (glm::vec2*)malloc(renderer->_numObjects * sizeof(glm::vec2));
+    renderer->_objectInstances = (BVHInstance*)malloc(renderer->_numObjects * sizeof(BVHInstance));
+    renderer->_instances = (BVHInstance*)malloc(renderer->_numObjects * sizeof(BVHInstance));
+    renderer->_instanceSlots = (uint32_t*)malloc(renderer->_numObjects * sizeof(uint32_t));
+    renderer->_instanceOrderDirty = true;
+    renderer->_objectDirty = (bool*)malloc(renderer->_numObjects * sizeof(bool));
+    renderer->_dirtyObjects = (uint32_t*)malloc(renderer->_numObjects * sizeof(uint32_t));
+    renderer->_numDirtyObjects = 0;
+    
+    for(uint32_t i = 0; i < scene->numMeshes; ++i)
+    {
+        for(uint32_t j = scene->draws[i].firstInstance; j < scene->draws[i].firstInstance + scene->draws[i].instanceCount; ++j)
+        {
+            renderer->_objectMeshes[j] = i;
+        }
+    }
+    
+    for(uint32_t i = 0; i < renderer->_numObjects; ++i)
+    {
+        renderer->_objectTransforms[i] = glm::mat4(1.0f);
+        renderer->_objectNormals[i] = glm::mat4(1.0f);
+        renderer->_objectTextures[i] = 0;
+        renderer->_objectMaterials[i] = glm::vec2(0.0f);
+        renderer->_objectDirty[i] = false;
+    }
+    
+    ssbRes = shaderStorageBufferCreate(&renderer->_shaderTLASBuffer, context, bvhMaxNodes(renderer->_numObjects) * sizeof(BVHNode));
+    if(ssbRes != VK_SUCCESS) return -7;
+    
+    ssbRes = shaderStorageBufferCreate(&renderer->_shaderInstanceBuffer, context, renderer->_numObjects * sizeof(BVHInstance));
+    if(ssbRes != VK_SUCCESS) return -8;
+    
+    markAllObjectsDirty(renderer);
+    
+    return 0;
+}
+
+static inline void fillInstance(Renderer* renderer, uint32_t object, BVHInstance* instance)
+{
+    const MeshBLAS* mesh = &renderer->_meshes[renderer->_objectMeshes[object]];
+    
+    instance->objectToWorld = renderer->_objectTransforms[object];
+    instance->worldToObject = glm::transpose(renderer->_objectNormals[object]);
+    instance->min = mesh->range.min;
+    instance->blasRoot = renderer->_wideBVH ? mesh->range.wideRoot | BLAS_ROOT_WIDE : mesh->range.root;
+    instance->max = mesh->range.max;
+    instance->textureUnit = renderer->_objectTextures[object];
+    instance->firstTri = mesh->range.firstTri;
+    instance->numTris = mesh->range.numTris;
+    instance->reflectivity = renderer->_objectMaterials[object].x;
+    instance->roughness = renderer->_objectMaterials[object].y;
+}
+
+/*Instances are written in the order the TLAS leaves index them.  Device rebuilds keep
+  whatever order the buffer has, so the order only changes on host builds, which gather and
+  write every instance.  Otherwise only the objects that changed since the last upload are
+  refilled and written to their slots, with neighbouring slots merged into one copy.*/
+static inline int32_t uploadInstances(Renderer* renderer)
+{
+    VkBufferCopy* ranges;
+    uint32_t numRanges = 0;
+    int32_t res;
+    
+    for(uint32_t i = 0; i < renderer->_numDirtyObjects; ++i)
+    {
+        uint32_t object = renderer->_dirtyObjects[i];
+        
+        fillInstance(renderer, object, &renderer->_objectInstances[object]);
+        renderer->_objectDirty[object] = false;
+    }
+    
+    if(renderer->_instanceOrderDirty)
+    {
+        for(uint32_t i = 0; i < renderer->_numObjects; ++i)
+        {
+            uint32_t object = renderer->_tlas.triIndices ? renderer->_tlas.triIndices[i] : i;
+            
+            renderer->_instances[i] = renderer->_objectInstances[object];
+            renderer->_instanceSlots[object] = i;
+        }
+        
+        renderer->_numDirtyObjects = 0;
+        renderer->_instanceOrderDirty = false;
+        
+        return shaderStorageBufferWrite(&renderer->_shaderInstanceBuffer, renderer->context,
+            renderer->_instances, renderer->_numObjects * sizeof(BVHInstance));
+    }
+    
+    if(renderer->_numDirtyObjects == 0) return 0;
+    
+    ranges = (VkBufferCopy*)malloc(renderer->_numDirtyObjects * sizeof(VkBufferCopy));
+    if(!ranges) return -1;
+    
+    for(uint32_t i = 0; i < renderer->_numDirtyObjects; ++i)
+    {
+        uint32_t object = renderer->_dirtyObjects[i];
+        uint32_t slot = renderer->_instanceSlots[object];
+        
+        renderer->_instances[slot] = renderer->_objectInstances[object];
+        ranges[i].srcOffset = 0;
+        ranges[i].dstOffset = slot * sizeof(BVHInstance);
+        ranges[i].size = sizeof(BVHInstance);
+    }
+    
+    std::sort(ranges, ranges + renderer->_numDirtyObjects,
+        [](const VkBufferCopy& a, const VkBufferCopy& b)
+        {
+            return a.dstOffset < b.dstOffset;
+        });
+    
+    for(uint32_t i = 0; i < renderer->_numDirtyObjects; ++i)
+    {
+        if(numRanges > 0 && ranges[numRanges - 1].dstOffset + ranges[numRanges - 1].size == ranges[i].dstOffset)
+        {
+            ranges[numRanges - 1].size += ranges[i].size;
+        }
+        else
+        {
+            ranges[numRanges++] = ranges[i];
+        }
+    }
+    
+    renderer->_numDirtyObjects = 0;
+    
+    res = shaderStorageBufferWriteRanges(&renderer->_shaderInstanceBuffer, renderer->context, renderer->_instances, ranges, numRanges);
+    
+    free(ranges);
+    return res;
+}
+
+static inline int32_t buildTLAS(Renderer* renderer)
+{
+    glm::vec3* mins = (glm::vec3*)malloc(renderer->_numObjects * sizeof(glm::vec3));
+    glm::vec3* maxs = (glm::vec3*)malloc(renderer->_numObjects * sizeof(glm::vec3));
+    BVH* tlas = &renderer->_tlas;
+    uint32_t prevNodes = tlas->numNodes;
+    int32_t res;
+    
+    if(!mins || !maxs)
+    {
+        free(mins);
+        free(maxs);
+        return -1;
+    }
+    
+    for(uint32_t i = 0; i < renderer->_numObjects; ++i)
+    {
+        const MeshBLAS* mesh = &renderer->_meshes[renderer->_objectMeshes[i]];
+        bvhTransformBounds(mesh->range.min, mesh->range.max, renderer->_objectTransforms[i], &mins[i], &maxs[i]);
+    }
+    
+    bvhDestroy(tlas);
+    renderer->_instanceOrderDirty = true;
+    res = bvhBuildBounds(tlas, mins, maxs, renderer->_numObjects, &renderer->_threadPool);
+    
+    free(mins);
+    free(maxs);
+    if(res) return -1;
+    
+    /*The TLAS is rebuilt every frame objects move, so only report builds that change its shape*/
+    if(tlas->numNodes != prevNodes)
+    {
+        DEBUG_PRINT("TLAS: %u instances, %u nodes, SAH cost %f, built in %f ms\n", tlas->numTris, tlas->numNodes, tlas->sahCost, tlas->buildMs);
+    }
+    
+    if(uploadInstances(renderer)) return -2;
+    if(shaderStorageBufferWrite(&renderer->_shaderTLASBuffer, renderer->context, tlas->nodes, tlas->numNodes * sizeof(BVHNode))) return -3;
+    
+    return 0;
+}
+
+int32_t rendererUpdateBVH(Renderer* renderer)
+{
+    if(renderer->_bvhMode == BVH_MODE_CPU)
     {
-        indices[i] = _indices[(i/4) * 3];
-        indices[i + 1] = _indices[(i/4) * 3 + 1];
-        indices[i + 2] = _indices[(i/4) * 3 + 2];
-        indices[i + 3] = 0;
+        if(buildTLAS(renderer)) return -1;
+    }
+    else
+    {
+        if(uploadInstances(renderer)) return -2;
     }
-    shaderStorageBufferWrite(&renderer->_shaderIndexBuffer, context, indices, sizeof(indices));
+    
+    renderer->_bvhDirty = false;
     
     return 0;
 }
 
-int32_t rendererCreate(Renderer* renderer, Context* context)
+/*Reflection limits from best to cheapest.  Far hits go first, then extra bounces, then half the
+  pixels of every frame and last the resolution.  Distances are in world units.*/
+static const ReflectionSettings _qualityLevels[] =
+{
+    {REFLECTION_RESOLUTION_FULL, REFLECTION_MAX_DISTANCE, MAX_REFLECTION_BOUNCES, false},
+    {REFLECTION_RESOLUTION_FULL, 50.0f, MAX_REFLECTION_BOUNCES, false},
+    {REFLECTION_RESOLUTION_FULL, 50.0f, 2, false},
+    {REFLECTION_RESOLUTION_FULL, 20.0f, 1, false},
+    {REFLECTION_RESOLUTION_FULL, 20.0f, 1, true},
+    {REFLECTION_RESOLUTION_HALF, 20.0f, 1, true},
+    {REFLECTION_RESOLUTION_HALF, 10.0f, 1, true},
+    {REFLECTION_RESOLUTION_QUARTER, 10.0f, 1, true}
+};
+
+/*Frames a level is measured before the controller lowers it and twice that before raising it*/
+#define FRAME_TIME_SETTLE_FRAMES 30
+/*Weight of the newest frame in smoothedMs*/
+#define FRAME_TIME_SMOOTHING 0.1f
+/*Fraction of the target the smoothed time must stay under before a better level is tried*/
+#define FRAME_TIME_RAISE_MARGIN 0.6f
+
+/*Reads the ray counters of the last raster frame, called once its fence has signalled.  A
+  frame that asked for more rays than the budget drops a bounce and one that would still
+  fit with another bounce, assuming each bounce costs as much as the average, gets it back.*/
+int32_t rendererUpdateBounceDepth(Renderer* renderer)
+{
+    ReflectionUniforms* uniforms = &renderer->_camUniforms;
+    uint32_t maxBounces = std::min(renderer->_maxBounces, renderer->_frameTime.limits.maxBounces);
+    uint32_t depth = std::min(uniforms->bounceDepth, maxBounces);
+    RayStats stats;
+    void* mapped;
+    VkResult result;
+    
+    result = vkMapMemory(renderer->context->device, renderer->_rayStatsReadbackMemory, 0, sizeof(RayStats), 0, &mapped);
+    if(result != VK_SUCCESS) return -1;
+    
+    memcpy(&stats, mapped, sizeof(RayStats));
+    vkUnmapMemory(renderer->context->device, renderer->_rayStatsReadbackMemory);
+    
+    renderer->_raysTraced = stats.traced;
+    renderer->_raysScreenSpace = stats.screenSpace;
+    renderer->_raysTraversed = stats.traversed;
+    renderer->_tileLeavesNeeded = stats.tileLeaves;
+    
+    if(stats.requested > uniforms->rayBudget && depth > 1)
+    {
+        --depth;
+    }
+    else if(depth < maxBounces && (uint64_t)stats.requested + stats.requested / depth <= uniforms->rayBudget)
+    {
+        ++depth;
+    }
+    
+    if(depth == uniforms->bounceDepth) return 0;
+    
+    uniforms->bounceDepth = depth;
+    return updateUniforms(&renderer->_camPosBuffer, renderer->context, uniforms);
+}
+
+int32_t rendererCreate(Renderer* renderer, Context* context, const MeshData* scene)
 {
     renderer->context = context;
-    renderer->_camPos = glm::vec3();
+    renderer->_scene = scene;
+    renderer->_camUniforms = {};
+    renderer->_camUniforms.camPos = glm::vec3();
+    renderer->_camUniforms.bounceDepth = 1;
+    renderer->_camUniforms.rayBudget = 0xffffffff;
+    renderer->_camUniforms.frame = 0;
+    renderer->_camUniforms.screenSpaceSteps = SCREEN_SPACE_STEPS;
+    renderer->_camUniforms.maxDistance = REFLECTION_MAX_DISTANCE;
+    renderer->_camUniforms.prevViewProj = glm::mat4(1.0f);
+    renderer->_camUniforms.viewProj = glm::mat4(1.0f);
+    renderer->_viewProj = glm::mat4(1.0f);
+    renderer->_maxBounces = 1;
+    renderer->_maxDistance = REFLECTION_MAX_DISTANCE;
+    renderer->_frameTime = {};
+    renderer->_frameTime.limits = _qualityLevels[0];
+    renderer->_environment = {};
+    renderer->_raysTraced = 0;
+    renderer->_raysScreenSpace = 0;
+    renderer->_raysTraversed = 0;
+    renderer->_tlas = {};
+    renderer->_gpuBVHBuilder = {};
+    renderer->_bvhMode = BVH_MODE_CPU;
+    renderer->_wideBVH = false;
+    renderer->_wavefront = {};
+    renderer->_reflectionBackend = REFLECTION_BACKEND_RASTER;
+    renderer->_reflectionResolution = REFLECTION_RESOLUTION_FULL;
+    renderer->_temporalReflections = false;
+    renderer->_tileLeafCapacity = 0;
+    renderer->_tileLeavesNeeded = 0;
+    renderer->_tileCuller = {};
+    renderer->_tileCulling = false;
+    renderer->_primitives = {};
+    renderer->_sortTriangleBuffer = {};
+    renderer->_sortedIndexBuffer = {};
+    renderer->_sortedDrawCommands = {};
+    renderer->_sortTriangles = false;
+    renderer->_proxyRatio = 1.0f;
+    renderer->_drawBuffers = NULL;
+    
+    if(threadPoolCreate(&renderer->_threadPool, 0)) return -4;
     
     if(createRenderBuffers(renderer, context)) return -1;
     if(createRenderPass(renderer, context)) return -2;
@@ -516,15 +1042,37 @@ static inline int32_t createShaders(Renderer* renderer, ShaderSrc vertexSrc1, Sh
     return 0;
 }
 
+/*Binding 6 of the reflection pass, written again whenever rendererUpdateTileLeaves grows the buffer*/
+static inline void updateTileLeavesDescriptor(Renderer* renderer)
+{
+    VkDescriptorBufferInfo descriptorBufferInfo = {};
+    VkWriteDescriptorSet writeDescriptor = {};
+    
+    descriptorBufferInfo.buffer = renderer->_tileLeaves.buffer;
+    descriptorBufferInfo.offset = 0;
+    descriptorBufferInfo.range = VK_WHOLE_SIZE;
+    
+    writeDescriptor.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writeDescriptor.dstSet = renderer->_secondPassDescSet;
+    writeDescriptor.dstBinding = 6;
+    writeDescriptor.dstArrayElement = 0;
+    writeDescriptor.descriptorCount = 1;
+    writeDescriptor.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writeDescriptor.pBufferInfo = &descriptorBufferInfo;
+    vkUpdateDescriptorSets(renderer->context->device, 1, &writeDescriptor, 0, NULL);
+}
+
 static inline int32_t createDescriptors(Renderer* renderer)
 {
-    VkDescriptorSetLayoutBinding bindings[9] = {};
+    VkDescriptorSetLayoutBinding bindings[20] = {};
     VkDescriptorSetLayoutCreateInfo setLayoutInfo = {};
-    VkDescriptorPoolSize uniformBufferPoolSize[9] = {};
+    VkDescriptorPoolSize uniformBufferPoolSize[20] = {};
     VkDescriptorPoolCreateInfo descriptorPoolInfo = {};
     VkDescriptorSetAllocateInfo descriptorAllocInfo = {};
     VkDescriptorBufferInfo descriptorBufferInfo = {};
     VkDescriptorImageInfo descriptorImageInfos[3] = {};
+    VkDescriptorImageInfo sampledImageInfos[4] = {};
+    VkSamplerCreateInfo samplerInfo = {};
     VkWriteDescriptorSet writeDescriptor = {};
     VkResult result;
     
@@ -556,15 +1104,36 @@ static inline int32_t createDescriptors(Renderer* renderer)
     bindings[6].descriptorCount = MAX_TEXTURES;
     bindings[6].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
     
-    bindings[7].binding = 0;
-    bindings[7].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    bindings[7].descriptorCount = 1;
-    bindings[7].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+    /*Tile triangle counts and lists written by the tile culling prepass and the ray counters*/
+    for(int32_t i = 7; i < 10; ++i)
+    {
+        bindings[i].binding = i - 2;
+        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    }
     
-    bindings[8].binding = 1;
-    bindings[8].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    bindings[8].descriptorCount = 1;
-    bindings[8].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+    /*Depth and G-buffer sampled at other pixels by the screen space march*/
+    bindings[10].binding = 8;
+    bindings[10].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    bindings[10].descriptorCount = 4;
+    bindings[10].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    
+    /*Environment cubemap seen by the rays that miss*/
+    bindings[11].binding = 9;
+    bindings[11].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    bindings[11].descriptorCount = 1;
+    bindings[11].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    
+    /*Object space vertices, BLAS triangles, BLAS nodes, TLAS nodes and instances.  The TLAS
+      is also built on the device and the wavefront stages trace through all of them.*/
+    for(int32_t i = 12; i < 20; ++i)
+    {
+        bindings[i].binding = i - 12;
+        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+    }
     
     setLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
     setLayoutInfo.bindingCount = 2;
@@ -573,14 +1142,14 @@ static inline int32_t createDescriptors(Renderer* renderer)
     result = vkCreateDescriptorSetLayout(renderer->context->device, &setLayoutInfo, NULL, &renderer->_descriptorLayout);
     if(result != VK_SUCCESS) return -1;
     
-    setLayoutInfo.bindingCount = 5;
+    setLayoutInfo.bindingCount = 10;
     setLayoutInfo.pBindings = &bindings[2];
     
     result = vkCreateDescriptorSetLayout(renderer->context->device, &setLayoutInfo, NULL, &renderer->_secondPassDescLayout);
     if(result != VK_SUCCESS) return -1;
     
-    setLayoutInfo.bindingCount = 2;
-    setLayoutInfo.pBindings = &bindings[7];
+    setLayoutInfo.bindingCount = 8;
+    setLayoutInfo.pBindings = &bindings[12];
     
     result = vkCreateDescriptorSetLayout(renderer->context->device, &setLayoutInfo, NULL, &renderer->_sharedDescLayout);
     if(result != VK_SUCCESS) return -1;
@@ -603,15 +1172,20 @@ static inline int32_t createDescriptors(Renderer* renderer)
     uniformBufferPoolSize[6].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
     uniformBufferPoolSize[6].descriptorCount = MAX_TEXTURES;
     
-    uniformBufferPoolSize[7].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    uniformBufferPoolSize[7].descriptorCount = 1;
+    for(int32_t i = 7; i < 20; ++i)
+    {
+        uniformBufferPoolSize[i].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        uniformBufferPoolSize[i].descriptorCount = 1;
+    }
     
-    uniformBufferPoolSize[8].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    uniformBufferPoolSize[8].descriptorCount = 1;
+    uniformBufferPoolSize[10].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    uniformBufferPoolSize[10].descriptorCount = 4;
+    uniformBufferPoolSize[11].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    uniformBufferPoolSize[11].descriptorCount = 1;
     
     descriptorPoolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
     descriptorPoolInfo.maxSets = 3;
-    descriptorPoolInfo.poolSizeCount = 9;
+    descriptorPoolInfo.poolSizeCount = 20;
     descriptorPoolInfo.pPoolSizes = uniformBufferPoolSize;
     
     result = vkCreateDescriptorPool(renderer->context->device, &descriptorPoolInfo, NULL, &renderer->_descriptorPool);
@@ -667,34 +1241,132 @@ static inline int32_t createDescriptors(Renderer* renderer)
     writeDescriptor.pBufferInfo = &descriptorBufferInfo;
     vkUpdateDescriptorSets(renderer->context->device, 1, &writeDescriptor, 0, NULL);
     
-    descriptorBufferInfo.buffer = renderer->_shaderVertexBuffer.buffer;
+    descriptorBufferInfo.buffer = renderer->_tileRanges.buffer;
     descriptorBufferInfo.offset = 0;
     descriptorBufferInfo.range = VK_WHOLE_SIZE;
     
-    writeDescriptor.dstSet = renderer->_sharedDescSet;
-    writeDescriptor.dstBinding = 0;
+    writeDescriptor.dstSet = renderer->_secondPassDescSet;
+    writeDescriptor.dstBinding = 5;
     writeDescriptor.dstArrayElement = 0;
     writeDescriptor.descriptorCount = 1;
     writeDescriptor.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
     writeDescriptor.pBufferInfo = &descriptorBufferInfo;
     vkUpdateDescriptorSets(renderer->context->device, 1, &writeDescriptor, 0, NULL);
     
-    descriptorBufferInfo.buffer = renderer->_shaderIndexBuffer.buffer;
+    updateTileLeavesDescriptor(renderer);
+    
+    descriptorBufferInfo.buffer = renderer->_rayStats.buffer;
     descriptorBufferInfo.offset = 0;
     descriptorBufferInfo.range = VK_WHOLE_SIZE;
     
-    writeDescriptor.dstSet = renderer->_sharedDescSet;
-    writeDescriptor.dstBinding = 1;
+    writeDescriptor.dstSet = renderer->_secondPassDescSet;
+    writeDescriptor.dstBinding = 7;
     writeDescriptor.dstArrayElement = 0;
     writeDescriptor.descriptorCount = 1;
     writeDescriptor.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
     writeDescriptor.pBufferInfo = &descriptorBufferInfo;
     vkUpdateDescriptorSets(renderer->context->device, 1, &writeDescriptor, 0, NULL);
     
-    for(int32_t i = 0; i < 3; ++i)
-    {
-        descriptorImageInfos[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-    }
+    descriptorBufferInfo.buffer = renderer->_shaderVertexBuffer.buffer;
+    descriptorBufferInfo.offset = 0;
+    descriptorBufferInfo.range = VK_WHOLE_SIZE;
+    
+    writeDescriptor.dstSet = renderer->_sharedDescSet;
+    writeDescriptor.dstBinding = 0;
+    writeDescriptor.dstArrayElement = 0;
+    writeDescriptor.descriptorCount = 1;
+    writeDescriptor.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writeDescriptor.pBufferInfo = &descriptorBufferInfo;
+    vkUpdateDescriptorSets(renderer->context->device, 1, &writeDescriptor, 0, NULL);
+    
+    descriptorBufferInfo.buffer = renderer->_shaderIndexBuffer.buffer;
+    descriptorBufferInfo.offset = 0;
+    descriptorBufferInfo.range = VK_WHOLE_SIZE;
+    
+    writeDescriptor.dstSet = renderer->_sharedDescSet;
+    writeDescriptor.dstBinding = 1;
+    writeDescriptor.dstArrayElement = 0;
+    writeDescriptor.descriptorCount = 1;
+    writeDescriptor.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writeDescriptor.pBufferInfo = &descriptorBufferInfo;
+    vkUpdateDescriptorSets(renderer->context->device, 1, &writeDescriptor, 0, NULL);
+    
+    descriptorBufferInfo.buffer = renderer->_shaderBVHBuffer.buffer;
+    descriptorBufferInfo.offset = 0;
+    descriptorBufferInfo.range = VK_WHOLE_SIZE;
+    
+    writeDescriptor.dstSet = renderer->_sharedDescSet;
+    writeDescriptor.dstBinding = 2;
+    writeDescriptor.dstArrayElement = 0;
+    writeDescriptor.descriptorCount = 1;
+    writeDescriptor.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writeDescriptor.pBufferInfo = &descriptorBufferInfo;
+    vkUpdateDescriptorSets(renderer->context->device, 1, &writeDescriptor, 0, NULL);
+    
+    descriptorBufferInfo.buffer = renderer->_shaderTLASBuffer.buffer;
+    descriptorBufferInfo.offset = 0;
+    descriptorBufferInfo.range = VK_WHOLE_SIZE;
+    
+    writeDescriptor.dstSet = renderer->_sharedDescSet;
+    writeDescriptor.dstBinding = 3;
+    writeDescriptor.dstArrayElement = 0;
+    writeDescriptor.descriptorCount = 1;
+    writeDescriptor.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writeDescriptor.pBufferInfo = &descriptorBufferInfo;
+    vkUpdateDescriptorSets(renderer->context->device, 1, &writeDescriptor, 0, NULL);
+    
+    descriptorBufferInfo.buffer = renderer->_shaderInstanceBuffer.buffer;
+    descriptorBufferInfo.offset = 0;
+    descriptorBufferInfo.range = VK_WHOLE_SIZE;
+    
+    writeDescriptor.dstSet = renderer->_sharedDescSet;
+    writeDescriptor.dstBinding = 4;
+    writeDescriptor.dstArrayElement = 0;
+    writeDescriptor.descriptorCount = 1;
+    writeDescriptor.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writeDescriptor.pBufferInfo = &descriptorBufferInfo;
+    vkUpdateDescriptorSets(renderer->context->device, 1, &writeDescriptor, 0, NULL);
+    
+    descriptorBufferInfo.buffer = renderer->_shaderAttributeBuffer.buffer;
+    descriptorBufferInfo.offset = 0;
+    descriptorBufferInfo.range = VK_WHOLE_SIZE;
+    
+    writeDescriptor.dstSet = renderer->_sharedDescSet;
+    writeDescriptor.dstBinding = 5;
+    writeDescriptor.dstArrayElement = 0;
+    writeDescriptor.descriptorCount = 1;
+    writeDescriptor.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writeDescriptor.pBufferInfo = &descriptorBufferInfo;
+    vkUpdateDescriptorSets(renderer->context->device, 1, &writeDescriptor, 0, NULL);
+    
+    descriptorBufferInfo.buffer = renderer->_shaderTriRecordBuffer.buffer;
+    descriptorBufferInfo.offset = 0;
+    descriptorBufferInfo.range = VK_WHOLE_SIZE;
+    
+    writeDescriptor.dstSet = renderer->_sharedDescSet;
+    writeDescriptor.dstBinding = 6;
+    writeDescriptor.dstArrayElement = 0;
+    writeDescriptor.descriptorCount = 1;
+    writeDescriptor.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writeDescriptor.pBufferInfo = &descriptorBufferInfo;
+    vkUpdateDescriptorSets(renderer->context->device, 1, &writeDescriptor, 0, NULL);
+    
+    descriptorBufferInfo.buffer = renderer->_shaderWideBVHBuffer.buffer;
+    descriptorBufferInfo.offset = 0;
+    descriptorBufferInfo.range = VK_WHOLE_SIZE;
+    
+    writeDescriptor.dstSet = renderer->_sharedDescSet;
+    writeDescriptor.dstBinding = 7;
+    writeDescriptor.dstArrayElement = 0;
+    writeDescriptor.descriptorCount = 1;
+    writeDescriptor.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writeDescriptor.pBufferInfo = &descriptorBufferInfo;
+    vkUpdateDescriptorSets(renderer->context->device, 1, &writeDescriptor, 0, NULL);
+    
+    for(int32_t i = 0; i < 3; ++i)
+    {
+        descriptorImageInfos[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    }
     descriptorImageInfos[0].imageView = renderer->_colorView;
     descriptorImageInfos[1].imageView = renderer->_positionView;
     descriptorImageInfos[2].imageView = renderer->_normalView;
@@ -708,6 +1380,97 @@ static inline int32_t createDescriptors(Renderer* renderer)
     writeDescriptor.pImageInfo = descriptorImageInfos;
     vkUpdateDescriptorSets(renderer->context->device, 1, &writeDescriptor, 0, NULL);
     
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = VK_FILTER_NEAREST;
+    samplerInfo.minFilter = VK_FILTER_NEAREST;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.maxAnisotropy = 1.0f;
+    samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK;
+    samplerInfo.unnormalizedCoordinates = VK_FALSE;
+    
+    result = vkCreateSampler(renderer->context->device, &samplerInfo, NULL, &renderer->_gBufferSampler);
+    if(result != VK_SUCCESS) return -4;
+    
+    for(int32_t i = 0; i < 4; ++i)
+    {
+        sampledImageInfos[i].sampler = renderer->_gBufferSampler;
+        sampledImageInfos[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    }
+    sampledImageInfos[0].imageView = renderer->_depthView;
+    sampledImageInfos[0].imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+    sampledImageInfos[1].imageView = renderer->_colorView;
+    sampledImageInfos[2].imageView = renderer->_positionView;
+    sampledImageInfos[3].imageView = renderer->_normalView;
+    
+    writeDescriptor.dstSet = renderer->_secondPassDescSet;
+    writeDescriptor.dstBinding = 8;
+    writeDescriptor.dstArrayElement = 0;
+    writeDescriptor.descriptorCount = 4;
+    writeDescriptor.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    writeDescriptor.pBufferInfo = NULL;
+    writeDescriptor.pImageInfo = sampledImageInfos;
+    vkUpdateDescriptorSets(renderer->context->device, 1, &writeDescriptor, 0, NULL);
+    
+    return 0;
+}
+
+/*Sky to ground gradient until setEnvironmentMap loads a real one.  -Y is up like in the scene.*/
+static inline int32_t createDefaultEnvironment(Renderer* renderer)
+{
+    const uint32_t size = 16;
+    const glm::vec3 sky = glm::vec3(0.5f, 0.7f, 1.0f);
+    const glm::vec3 ground = glm::vec3(0.3f, 0.25f, 0.2f);
+    uint8_t faces[6][size * size * 4];
+    void* facePtrs[6];
+    
+    for(uint32_t face = 0; face < 6; ++face)
+    {
+        for(uint32_t y = 0; y < size; ++y)
+        {
+            for(uint32_t x = 0; x < size; ++x)
+            {
+                float u = (x + 0.5f) / size * 2 - 1;
+                float v = (y + 0.5f) / size * 2 - 1;
+                glm::vec3 dirs[6] = {{1, -v, -u}, {-1, -v, u}, {u, 1, v}, {u, -1, -v}, {u, -v, 1}, {-u, -v, -1}};
+                float up = -glm::normalize(dirs[face]).y * 0.5f + 0.5f;
+                glm::vec3 color = glm::mix(ground, sky, up) * 255.0f;
+                uint8_t* texel = &faces[face][4 * (y * size + x)];
+                
+                texel[0] = (uint8_t)color.x;
+                texel[1] = (uint8_t)color.y;
+                texel[2] = (uint8_t)color.z;
+                texel[3] = 255;
+            }
+        }
+        
+        facePtrs[face] = faces[face];
+    }
+    
+    if(textureCreateCube(&renderer->_environment, renderer->context, facePtrs, size)) return -1;
+    textureUpdateDescriptor(&renderer->_environment, renderer->context, renderer->_secondPassDescSet, 0, 9);
+    
+    return 0;
+}
+
+int32_t setEnvironmentMap(Renderer* renderer, const char* const* faceFiles)
+{
+    Texture environment = {};
+    
+    if(textureCreateCubeFromFiles(&environment, renderer->context, faceFiles))
+    {
+        textureDestroy(&environment, renderer->context);
+        return -1;
+    }
+    
+    waitIdle(renderer->context);
+    
+    textureDestroy(&renderer->_environment, renderer->context);
+    renderer->_environment = environment;
+    textureUpdateDescriptor(&renderer->_environment, renderer->context, renderer->_secondPassDescSet, 0, 9);
+    
     return 0;
 }
 
@@ -734,11 +1497,41 @@ int32_t createPipeline(Renderer* renderer, ShaderSrc p1Vertex, ShaderSrc p1Fragm
     VkResult result;
     VkDescriptorSetLayout descLayouts[2] = {};
     VkSpecializationInfo specMap = {};
-    VkSpecializationMapEntry specEntries[3] = {};
-    uint32_t specData[3] = {LENGTH_OF(_indirect), LENGTH_OF(_vertices), LENGTH_OF(_indices)/3};
+    VkSpecializationMapEntry specEntries[8] = {};
+    VkQueryPoolCreateInfo queryPoolInfo = {};
+    void* mapped;
+    uint32_t numTiles = tileCullNumTiles(renderer->context);
+    VkSpecializationInfo packedSpecMap = {};
+    /*Same constant ids as the compute modules so triCast.frag can find its tile, 3 and 4 are unused
+      and 7 selects the packed vertex layout in mpAttach.vert*/
+    uint32_t specData[8] = {renderer->_numObjects, renderer->_scene->numVertices, renderer->_scene->numIndices/3, 0, 0,
+        renderer->context->width, renderer->context->height, VK_FALSE};
+    uint32_t packedSpecData[8];
+    
+    if(uniformBufferCreate<StandardUniforms>(&renderer->_uniformBuffer, renderer->context, renderer->_numObjects)) return -1;
+    if(uniformBufferCreate<ReflectionUniforms>(&renderer->_camPosBuffer, renderer->context, 1)) return -1;
+    if(updateUniforms(&renderer->_camPosBuffer, renderer->context, &renderer->_camUniforms)) return -1;
+    renderer->_tileLeafCapacity = numTiles * TILE_CULL_INITIAL_LEAVES;
+    
+    if(shaderStorageBufferCreate(&renderer->_tileRanges, renderer->context, numTiles * 2 * sizeof(uint32_t))) return -1;
+    if(shaderStorageBufferCreate(&renderer->_tileLeaves, renderer->context, renderer->_tileLeafCapacity * 2 * sizeof(uint32_t))) return -1;
+    if(shaderStorageBufferCreate(&renderer->_rayStats, renderer->context, sizeof(RayStats), VK_BUFFER_USAGE_TRANSFER_SRC_BIT)) return -1;
+    if(createStagingBuffer(renderer->context, sizeof(RayStats), &renderer->_rayStatsReadback,
+        &renderer->_rayStatsReadbackMemory, VK_BUFFER_USAGE_TRANSFER_DST_BIT)) return -1;
+    
+    /*No frame has been counted before the first readback*/
+    result = vkMapMemory(renderer->context->device, renderer->_rayStatsReadbackMemory, 0, sizeof(RayStats), 0, &mapped);
+    if(result != VK_SUCCESS) return -1;
+    
+    memset(mapped, 0, sizeof(RayStats));
+    vkUnmapMemory(renderer->context->device, renderer->_rayStatsReadbackMemory);
+    
+    queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    queryPoolInfo.queryCount = 2;
     
-    if(uniformBufferCreate<StandardUniforms>(&renderer->_uniformBuffer, renderer->context, 2)) return -1;
-    if(uniformBufferCreate<glm::vec3>(&renderer->_camPosBuffer, renderer->context, 1)) return -1;
+    result = vkCreateQueryPool(renderer->context->device, &queryPoolInfo, NULL, &renderer->_timestampPool);
+    if(result != VK_SUCCESS) return -1;
     
     if(createShaders(renderer, p1Vertex, p1Fragment, p2Vertex, p2Fragment)) return -2;
     
@@ -761,18 +1554,23 @@ int32_t createPipeline(Renderer* renderer, ShaderSrc p1Vertex, ShaderSrc p1Fragm
     result = vkCreatePipelineLayout(renderer->context->device, &layoutInfo, NULL, &renderer->_pipelineLayoutPass2);
     if(result != VK_SUCCESS) return -4;
     
-    for(int32_t i = 0; i < 3; ++i)
+    for(int32_t i = 0; i < LENGTH_OF(specEntries); ++i)
     {
         specEntries[i].constantID = i;
         specEntries[i].offset = i * sizeof(uint32_t);
         specEntries[i].size = sizeof(uint32_t);
     }
     
-    specMap.mapEntryCount = 3;
+    specMap.mapEntryCount = LENGTH_OF(specEntries);
     specMap.pMapEntries = specEntries;
     specMap.dataSize = sizeof(specData);
     specMap.pData = specData;
     
+    memcpy(packedSpecData, specData, sizeof(specData));
+    packedSpecData[7] = VK_TRUE;
+    packedSpecMap = specMap;
+    packedSpecMap.pData = packedSpecData;
+    
     shaderInfos[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
     shaderInfos[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
     shaderInfos[0].module = renderer->_vertexShader1;
@@ -821,7 +1619,7 @@ int32_t createPipeline(Renderer* renderer, ShaderSrc p1Vertex, ShaderSrc p1Fragm
     vertexInputStateInfos[0].pVertexBindingDescriptions = &bindingDescription;
     vertexInputStateInfos[0].vertexAttributeDescriptionCount = 3;
     vertexInputStateInfos[0].pVertexAttributeDescriptions = attributeDescriptions;
-
+    
     vertexInputStateInfos[1].sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
     vertexInputStateInfos[1].vertexBindingDescriptionCount = 0;
     vertexInputStateInfos[1].vertexAttributeDescriptionCount = 0;
@@ -951,7 +1749,22 @@ int32_t createPipeline(Renderer* renderer, ShaderSrc p1Vertex, ShaderSrc p1Fragm
     pipelineInfo.basePipelineIndex = 0;
     
     result = vkCreateGraphicsPipelines(renderer->context->device,
-        VK_NULL_HANDLE, 1, &pipelineInfo, NULL, &renderer->_pipelinePass1);
+        VK_NULL_HANDLE, 1, &pipelineInfo, NULL, &renderer->_pipelinesPass1[VERTEX_FORMAT_FULL]);
+    
+    if(result != VK_SUCCESS) return -5;
+    
+    /*Halfs and snorms arrive as floats, the normal as the two octahedral components*/
+    bindingDescription.stride = sizeof(PackedVertex);
+    attributeDescriptions[0].format = VK_FORMAT_R16G16B16A16_SFLOAT;
+    attributeDescriptions[0].offset = offsetof(PackedVertex, position);
+    attributeDescriptions[1].format = VK_FORMAT_R16G16_SNORM;
+    attributeDescriptions[1].offset = offsetof(PackedVertex, normal);
+    attributeDescriptions[2].format = VK_FORMAT_R16G16_SFLOAT;
+    attributeDescriptions[2].offset = offsetof(PackedVertex, texCoords);
+    shaderInfos[0].pSpecializationInfo = &packedSpecMap;
+    
+    result = vkCreateGraphicsPipelines(renderer->context->device,
+        VK_NULL_HANDLE, 1, &pipelineInfo, NULL, &renderer->_pipelinesPass1[VERTEX_FORMAT_PACKED]);
     
     if(result != VK_SUCCESS) return -5;
     
@@ -961,8 +1774,8 @@ int32_t createPipeline(Renderer* renderer, ShaderSrc p1Vertex, ShaderSrc p1Fragm
     pipelineInfo.pDepthStencilState = &depthStateInfos[1];
     pipelineInfo.pColorBlendState = &blendStateInfos[1];
     pipelineInfo.layout = renderer->_pipelineLayoutPass2;
-    pipelineInfo.renderPass = renderer->_renderPass;
-    pipelineInfo.subpass = 1;
+    pipelineInfo.renderPass = renderer->_reflectionPass;
+    pipelineInfo.subpass = 0;
     
     result = vkCreateGraphicsPipelines(renderer->context->device,
         VK_NULL_HANDLE, 1, &pipelineInfo, NULL, &renderer->_pipelinePass2);
@@ -976,24 +1789,19 @@ int32_t createPipeline(Renderer* renderer, ShaderSrc p1Vertex, ShaderSrc p1Fragm
         textureUpdateDescriptor(&renderer->_textures[i], renderer->context, renderer->_secondPassDescSet, i, 4);
     }
     
+    if(createDefaultEnvironment(renderer)) return -6;
+    
     return 0;
 }
 
-int32_t createRenderCommands(Renderer* renderer)
+/*Uniform barrier, G-buffer pass and TLAS build, shared by both reflection backends*/
+static inline void recordGBuffer(Renderer* renderer, VkCommandBuffer cmdBuffer)
 {
-    VkFenceCreateInfo fenceInfo = {};
-    VkSemaphoreCreateInfo semaphoreInfo = {};
-    VkEventCreateInfo eventInfo = {};
-    VkCommandBufferAllocateInfo cmdBufferInfo = {};
-    VkCommandBufferBeginInfo beginInfo = {};
-    VkImageMemoryBarrier renderBarrier = {};
-    VkImageMemoryBarrier presentBarrier = {};
     VkMemoryBarrier uniformBarrier = {};
+    VkMemoryBarrier sortBarrier = {};
     VkRenderPassBeginInfo renderPassInfo = {};
-    VkImageSubresourceRange resourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
     VkClearValue clearValues[] =
     {
-        {0.0f, 0.0f, 0.0f, 1.0f}, 
         {1.0f, 0.0f}, 
         {0.0f, 0.0f, 0.0f, 0.0f}, 
         {0.0f, 0.0f, 0.0f, 0.0f}, 
@@ -1002,26 +1810,136 @@ int32_t createRenderCommands(Renderer* renderer)
     
     VkViewport viewport = {0, 0, (float)(renderer->context->width), (float)(renderer->context->height), 0, 1};
     VkRect2D scissor = {0, 0, renderer->context->width, renderer->context->height};
-    VkDeviceSize offsets = sizeof(_indirect);
-    VkResult result;
+    VkBuffer drawCommands = renderer->_sortTriangles ? renderer->_sortedDrawCommands.buffer : renderer->_vertexBuffer;
+    uint32_t first = 0;
     
-    renderer->_drawBuffers = (VkCommandBuffer*)malloc(renderer->context->numImages * sizeof(VkCommandBuffer));
+    uniformBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    uniformBarrier.srcAccessMask = VK_ACCESS_HOST_WRITE_BIT;
+    uniformBarrier.dstAccessMask = VK_ACCESS_UNIFORM_READ_BIT;
     
-    cmdBufferInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    cmdBufferInfo.commandPool = renderer->context->gfxCmdPool;
-    cmdBufferInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    cmdBufferInfo.commandBufferCount = renderer->context->numImages;
+    vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_HOST_BIT,
+        VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &uniformBarrier, 0, NULL, 0, NULL);
     
-    result = vkAllocateCommandBuffers(renderer->context->device, &cmdBufferInfo, renderer->_drawBuffers);
-    if(result != VK_SUCCESS) return -1;
+    /*Orders the triangles with this frame's camera before they are drawn*/
+    if(renderer->_sortTriangles)
+    {
+        gpuPrimitivesRecordTriangleOrder(&renderer->_primitives, cmdBuffer, renderer->_sharedDescSet);
+        
+        sortBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        sortBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        sortBarrier.dstAccessMask = VK_ACCESS_INDEX_READ_BIT;
+        
+        vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 1, &sortBarrier, 0, NULL, 0, NULL);
+    }
     
-    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-    result = vkCreateFence(renderer->context->device, &fenceInfo, NULL, &renderer->_renderFence);
-    if(result != VK_SUCCESS) return -2;
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    renderPassInfo.renderArea = {0, 0, renderer->context->width, renderer->context->height};
+    renderPassInfo.clearValueCount = 4;
+    renderPassInfo.renderPass = renderer->_renderPass;
+    renderPassInfo.framebuffer = renderer->_gBufferFrameBuffer;
+    renderPassInfo.pClearValues = clearValues;
+    vkCmdBeginRenderPass(cmdBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
     
-    semaphoreInfo.sType= VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-    result = vkCreateSemaphore(renderer->context->device, &semaphoreInfo, NULL, &renderer->_renderCompleteSemaphore);
-    if(result != VK_SUCCESS) return -3;
+    vkCmdSetViewport(cmdBuffer, 0, 1, &viewport);
+    vkCmdSetScissor(cmdBuffer, 0, 1, &scissor);
+    
+    vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+        renderer->_pipelineLayoutPass1, 0, 1, &renderer->_descriptorSet, 0, NULL);
+    
+    if(renderer->_sortTriangles)
+    {
+        vkCmdBindIndexBuffer(cmdBuffer, renderer->_sortedIndexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+    }
+    else
+    {
+        vkCmdBindIndexBuffer(cmdBuffer, renderer->_vertexBuffer, renderer->_indexOffset, renderer->_scene->indexType);
+    }
+    
+    /*One indirect draw per run of meshes sharing a vertex format*/
+    while(first < renderer->_scene->numMeshes)
+    {
+        VertexFormat format = meshVertexFormat(renderer->_scene, first);
+        uint32_t count = 1;
+        
+        while(first + count < renderer->_scene->numMeshes && meshVertexFormat(renderer->_scene, first + count) == format) ++count;
+        
+        vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, renderer->_pipelinesPass1[format]);
+        vkCmdBindVertexBuffers(cmdBuffer, 0, 1, &renderer->_vertexBuffer, &renderer->_vertexRegionOffsets[format]);
+        vkCmdDrawIndexedIndirect(cmdBuffer, drawCommands, first * sizeof(VkDrawIndexedIndirectCommand), count,
+            sizeof(VkDrawIndexedIndirectCommand));
+        
+        first += count;
+    }
+    
+    vkCmdEndRenderPass(cmdBuffer);
+    
+    if(renderer->_bvhMode == BVH_MODE_GPU)
+    {
+        gpuBVHBuilderRecord(&renderer->_gpuBVHBuilder, cmdBuffer, renderer->_sharedDescSet);
+    }
+    else if(renderer->_bvhMode == BVH_MODE_REFIT)
+    {
+        gpuBVHBuilderRecordRefit(&renderer->_gpuBVHBuilder, cmdBuffer, renderer->_sharedDescSet);
+    }
+}
+
+static inline void recordWavefrontCommands(Renderer* renderer)
+{
+    VkCommandBufferBeginInfo beginInfo = {};
+    
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = 0;
+    
+    vkBeginCommandBuffer(renderer->_gBufferCmdBuffer, &beginInfo);
+    recordGBuffer(renderer, renderer->_gBufferCmdBuffer);
+    vkEndCommandBuffer(renderer->_gBufferCmdBuffer);
+    
+    vkBeginCommandBuffer(renderer->_wavefrontCmdBuffer, &beginInfo);
+    vkCmdResetQueryPool(renderer->_wavefrontCmdBuffer, renderer->_timestampPool, 0, 2);
+    vkCmdWriteTimestamp(renderer->_wavefrontCmdBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, renderer->_timestampPool, 0);
+    wavefrontTracerRecord(&renderer->_wavefront, renderer->_wavefrontCmdBuffer, renderer->_sharedDescSet,
+        renderer->_reflectionBackend == REFLECTION_BACKEND_TILED, renderer->_reflectionResolution, renderer->_temporalReflections);
+    vkCmdWriteTimestamp(renderer->_wavefrontCmdBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, renderer->_timestampPool, 1);
+    vkEndCommandBuffer(renderer->_wavefrontCmdBuffer);
+    
+    for(int32_t i = 0; i < renderer->context->numImages; ++i)
+    {
+        vkBeginCommandBuffer(renderer->_drawBuffers[i], &beginInfo);
+        wavefrontTracerRecordPresent(&renderer->_wavefront, renderer->context, renderer->_drawBuffers[i], renderer->context->presentImages[i]);
+        vkEndCommandBuffer(renderer->_drawBuffers[i]);
+    }
+}
+
+static inline void recordRenderCommands(Renderer* renderer)
+{
+    VkCommandBufferBeginInfo beginInfo = {};
+    VkImageMemoryBarrier renderBarrier = {};
+    VkImageMemoryBarrier presentBarrier = {};
+    VkMemoryBarrier statsBarrier = {};
+    VkMemoryBarrier readbackBarrier = {};
+    VkBufferCopy statsCopy = {0, 0, sizeof(RayStats)};
+    VkBufferCopy leavesCopy = {0, offsetof(RayStats, tileLeaves), sizeof(uint32_t)};
+    VkRenderPassBeginInfo renderPassInfo = {};
+    VkImageSubresourceRange resourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+    VkClearValue clearValues[] =
+    {
+        {0.0f, 0.0f, 0.0f, 0.0f}, 
+        {0.0f, 0.0f, 0.0f, 0.0f}, 
+        {0.0f, 0.0f},
+        {0.0f, 0.0f, 0.0f, 1.0f}
+    };
+    
+    VkViewport viewport = {0, 0, (float)(renderer->context->width), (float)(renderer->context->height), 0, 1};
+    VkRect2D scissor = {0, 0, renderer->context->width, renderer->context->height};
+    VkPipelineStageFlagBits startStage = renderer->_bvhMode == BVH_MODE_CPU ?
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT : VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    
+    if(renderer->_reflectionBackend != REFLECTION_BACKEND_RASTER)
+    {
+        recordWavefrontCommands(renderer);
+        return;
+    }
     
     beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
     beginInfo.flags = 0;
@@ -1036,10 +1954,8 @@ int32_t createRenderCommands(Renderer* renderer)
     renderBarrier.subresourceRange = resourceRange;
     
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    renderPassInfo.renderPass = renderer->_renderPass;
     renderPassInfo.renderArea = {0, 0, renderer->context->width, renderer->context->height};
-    renderPassInfo.clearValueCount = 5;
-    renderPassInfo.pClearValues = clearValues;
+    renderPassInfo.clearValueCount = 4;
     
     presentBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
     presentBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
@@ -1050,44 +1966,54 @@ int32_t createRenderCommands(Renderer* renderer)
     presentBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
     presentBarrier.subresourceRange = resourceRange;
     
-    uniformBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
-    uniformBarrier.srcAccessMask = VK_ACCESS_HOST_WRITE_BIT;
-    uniformBarrier.dstAccessMask = VK_ACCESS_UNIFORM_READ_BIT;
+    statsBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    statsBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    statsBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    
+    /*With culling the leaf total comes from the culler's scan instead of the cleared counters*/
+    if(renderer->_tileCulling) statsCopy.size = offsetof(RayStats, tileLeaves);
     
-    eventInfo.sType = VK_STRUCTURE_TYPE_EVENT_CREATE_INFO;
+    readbackBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    readbackBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    readbackBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
     
     for(int32_t i = 0; i < renderer->context->numImages; ++i)
     {
         vkBeginCommandBuffer(renderer->_drawBuffers[i], &beginInfo);
         
-        vkCmdPipelineBarrier(renderer->_drawBuffers[i], VK_PIPELINE_STAGE_HOST_BIT,
-            VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, 0, 1, &uniformBarrier, 0, NULL, 0, NULL);
-        
         renderBarrier.image = renderer->context->presentImages[i];
         vkCmdPipelineBarrier(renderer->_drawBuffers[i], VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
             VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0, 0, NULL, 0, NULL, 1, &renderBarrier);
         
-        renderPassInfo.framebuffer = renderer->_frameBuffers[i];
-        vkCmdBeginRenderPass(renderer->_drawBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+        recordGBuffer(renderer, renderer->_drawBuffers[i]);
         
-        vkCmdBindPipeline(renderer->_drawBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, renderer->_pipelinePass1);
+        /*The reflection time covers the tile culling and the reflection pass.  The start waits for
+          the G-buffer writes, or for the device TLAS build that already waited for them.*/
+        vkCmdResetQueryPool(renderer->_drawBuffers[i], renderer->_timestampPool, 0, 2);
+        vkCmdWriteTimestamp(renderer->_drawBuffers[i], startStage, renderer->_timestampPool, 0);
         
-        vkCmdSetViewport(renderer->_drawBuffers[i], 0, 1, &viewport);
-        vkCmdSetScissor(renderer->_drawBuffers[i], 0, 1, &scissor);
+        /*Without culling every tile reports an overflow so triCast.frag traces the BVH*/
+        if(renderer->_tileCulling)
+        {
+            tileCullerRecord(&renderer->_tileCuller, renderer->_drawBuffers[i], renderer->_sharedDescSet);
+        }
+        else
+        {
+            vkCmdFillBuffer(renderer->_drawBuffers[i], renderer->_tileRanges.buffer, 0, VK_WHOLE_SIZE, TILE_CULL_OVERFLOW);
+        }
         
-        vkCmdBindVertexBuffers(renderer->_drawBuffers[i], 0, 1, &renderer->_vertexBuffer, &offsets);
-        vkCmdBindIndexBuffer(renderer->_drawBuffers[i], renderer->_vertexBuffer, offsets + sizeof(_vertices), VK_INDEX_TYPE_UINT16);
+        vkCmdFillBuffer(renderer->_drawBuffers[i], renderer->_rayStats.buffer, 0, VK_WHOLE_SIZE, 0);
         
-        vkCmdBindDescriptorSets(renderer->_drawBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS,
-            renderer->_pipelineLayoutPass1, 0, 1, &renderer->_descriptorSet, 0, NULL);
-        vkCmdBindDescriptorSets(renderer->_drawBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS,
-            renderer->_pipelineLayoutPass1, 1, 1, &renderer->_sharedDescSet, 0, NULL);
+        renderPassInfo.renderPass = renderer->_reflectionPass;
+        renderPassInfo.framebuffer = renderer->_frameBuffers[i];
+        renderPassInfo.pClearValues = clearValues;
+        vkCmdBeginRenderPass(renderer->_drawBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
         
-        vkCmdDrawIndexedIndirect(renderer->_drawBuffers[i], renderer->_vertexBuffer, 0, LENGTH_OF(_indirect), sizeof(_indirect[0]));
+        vkCmdBindPipeline(renderer->_drawBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, renderer->_pipelinePass2);
         
-        vkCmdNextSubpass(renderer->_drawBuffers[i], VK_SUBPASS_CONTENTS_INLINE);
+        vkCmdSetViewport(renderer->_drawBuffers[i], 0, 1, &viewport);
+        vkCmdSetScissor(renderer->_drawBuffers[i], 0, 1, &scissor);
         
-        vkCmdBindPipeline(renderer->_drawBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, renderer->_pipelinePass2);
         vkCmdBindDescriptorSets(renderer->_drawBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS,
             renderer->_pipelineLayoutPass2, 0, 1, &renderer->_secondPassDescSet, 0, NULL);
         vkCmdBindDescriptorSets(renderer->_drawBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS,
@@ -1097,12 +2023,411 @@ int32_t createRenderCommands(Renderer* renderer)
         
         vkCmdEndRenderPass(renderer->_drawBuffers[i]);
         
+        vkCmdWriteTimestamp(renderer->_drawBuffers[i], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, renderer->_timestampPool, 1);
+        
+        vkCmdPipelineBarrier(renderer->_drawBuffers[i], VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &statsBarrier, 0, NULL, 0, NULL);
+        vkCmdCopyBuffer(renderer->_drawBuffers[i], renderer->_rayStats.buffer, renderer->_rayStatsReadback, 1, &statsCopy);
+        
+        if(renderer->_tileCulling)
+        {
+            vkCmdCopyBuffer(renderer->_drawBuffers[i], renderer->_primitives.total.buffer, renderer->_rayStatsReadback, 1, &leavesCopy);
+        }
+        vkCmdPipelineBarrier(renderer->_drawBuffers[i], VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &readbackBarrier, 0, NULL, 0, NULL);
+        
         presentBarrier.image = renderer->context->presentImages[i];
         vkCmdPipelineBarrier(renderer->_drawBuffers[i], VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
             VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 0, NULL, 1, &presentBarrier);
         
         vkEndCommandBuffer(renderer->_drawBuffers[i]);
     }
+}
+
+int32_t createComputePipeline(Renderer* renderer, ShaderSrc compute)
+{
+    uint32_t specData[3] = {renderer->_numObjects, renderer->_scene->numVertices, renderer->_scene->numIndices/3};
+    
+    if(gpuBVHBuilderCreate(&renderer->_gpuBVHBuilder, renderer->context, compute.src, compute.len,
+        renderer->_sharedDescLayout, specData)) return -1;
+    
+    return 0;
+}
+
+int32_t createWavefrontPipeline(Renderer* renderer, ShaderSrc compute)
+{
+    uint32_t specData[3] = {renderer->_numObjects, renderer->_scene->numVertices, renderer->_scene->numIndices/3};
+    VkImageView gBufferViews[3] = {renderer->_colorView, renderer->_positionView, renderer->_normalView};
+    
+    if(wavefrontTracerCreate(&renderer->_wavefront, renderer->context, compute.src, compute.len,
+        renderer->_sharedDescLayout, specData, gBufferViews, renderer->_camPosBuffer.buffer)) return -1;
+    
+    for(int32_t i = 0; i < MAX_TEXTURES; ++i)
+    {
+        textureUpdateDescriptor(&renderer->_textures[i], renderer->context, renderer->_wavefront.descSet, i, 4);
+    }
+    
+    return 0;
+}
+
+int32_t createTileCullPipeline(Renderer* renderer, ShaderSrc compute)
+{
+    uint32_t specData[3] = {renderer->_numObjects, renderer->_scene->numVertices, renderer->_scene->numIndices/3};
+    VkImageView gBufferViews[3] = {renderer->_colorView, renderer->_positionView, renderer->_normalView};
+    
+    if(renderer->_primitives._shader == VK_NULL_HANDLE) return -1;
+    
+    if(tileCullerCreate(&renderer->_tileCuller, renderer->context, compute.src, compute.len, renderer->_sharedDescLayout,
+        specData, gBufferViews, renderer->_camPosBuffer.buffer, &renderer->_primitives, renderer->_tileRanges.buffer,
+        renderer->_tileLeaves.buffer)) return -2;
+    
+    return 0;
+}
+
+/*The ray tracing triangles may be proxies, so the sort reads its own copy of the raster
+  triangles with global vertex indices.  Every mesh is drawn from its range of that copy with
+  a vertex offset of 0.*/
+int32_t createSortPipeline(Renderer* renderer, ShaderSrc compute)
+{
+    const MeshData* scene = renderer->_scene;
+    uint32_t specData[3] = {renderer->_numObjects, scene->numVertices, scene->numIndices/3};
+    VkDeviceSize drawsSize = scene->numMeshes * sizeof(VkDrawIndexedIndirectCommand);
+    VkDrawIndexedIndirectCommand* drawCommands = (VkDrawIndexedIndirectCommand*)malloc(drawsSize);
+    /*The tile culler scans one leaf count per tile with the same primitives*/
+    uint32_t maxElements = std::max(scene->numIndices / 3, tileCullNumTiles(renderer->context));
+    uint32_t firstIndex = 0;
+    int32_t res = 0;
+    
+    for(uint32_t i = 0; i < scene->numMeshes; ++i)
+    {
+        drawCommands[i].indexCount = scene->draws[i].indexCount;
+        drawCommands[i].instanceCount = scene->draws[i].instanceCount;
+        drawCommands[i].firstIndex = firstIndex;
+        drawCommands[i].vertexOffset = -(int32_t)renderer->_vertexRegionFirst[meshVertexFormat(scene, i)];
+        drawCommands[i].firstInstance = scene->draws[i].firstInstance;
+        firstIndex += scene->draws[i].indexCount;
+    }
+    
+    if(shaderStorageBufferCreate(&renderer->_sortTriangleBuffer, renderer->context,
+        (scene->numIndices / 3) * 4 * sizeof(uint32_t))) res = -1;
+    if(!res && shaderStorageBufferCreate(&renderer->_sortedIndexBuffer, renderer->context,
+        scene->numIndices * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT)) res = -1;
+    if(!res && shaderStorageBufferCreate(&renderer->_sortedDrawCommands, renderer->context,
+        drawsSize, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT)) res = -1;
+    if(!res && shaderStorageBufferWrite(&renderer->_sortedDrawCommands, renderer->context, drawCommands, drawsSize)) res = -2;
+    
+    free(drawCommands);
+    if(res) return res;
+    
+    if(gpuPrimitivesCreate(&renderer->_primitives, renderer->context, compute.src, compute.len, renderer->_sharedDescLayout,
+        specData, maxElements, renderer->_camPosBuffer.buffer, renderer->_sortTriangleBuffer.buffer,
+        renderer->_sortedIndexBuffer.buffer)) return -3;
+    if(writeSortTriangles(renderer)) return -2;
+    
+    return 0;
+}
+
+int32_t createRenderCommands(Renderer* renderer)
+{
+    VkFenceCreateInfo fenceInfo = {};
+    VkSemaphoreCreateInfo semaphoreInfo = {};
+    VkCommandBufferAllocateInfo cmdBufferInfo = {};
+    VkResult result;
+    
+    renderer->_drawBuffers = (VkCommandBuffer*)malloc(renderer->context->numImages * sizeof(VkCommandBuffer));
+    
+    cmdBufferInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    cmdBufferInfo.commandPool = renderer->context->gfxCmdPool;
+    cmdBufferInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    cmdBufferInfo.commandBufferCount = renderer->context->numImages;
+    
+    result = vkAllocateCommandBuffers(renderer->context->device, &cmdBufferInfo, renderer->_drawBuffers);
+    if(result != VK_SUCCESS) return -1;
+    
+    cmdBufferInfo.commandBufferCount = 1;
+    
+    result = vkAllocateCommandBuffers(renderer->context->device, &cmdBufferInfo, &renderer->_gBufferCmdBuffer);
+    if(result != VK_SUCCESS) return -1;
+    
+    cmdBufferInfo.commandPool = renderer->context->cmpCmdPool;
+    
+    result = vkAllocateCommandBuffers(renderer->context->device, &cmdBufferInfo, &renderer->_wavefrontCmdBuffer);
+    if(result != VK_SUCCESS) return -1;
+    
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    result = vkCreateFence(renderer->context->device, &fenceInfo, NULL, &renderer->_renderFence);
+    if(result != VK_SUCCESS) return -2;
+    
+    semaphoreInfo.sType= VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    result = vkCreateSemaphore(renderer->context->device, &semaphoreInfo, NULL, &renderer->_renderCompleteSemaphore);
+    if(result != VK_SUCCESS) return -3;
+    
+    result = vkCreateSemaphore(renderer->context->device, &semaphoreInfo, NULL, &renderer->_gBufferSemaphore);
+    if(result != VK_SUCCESS) return -3;
+    
+    result = vkCreateSemaphore(renderer->context->device, &semaphoreInfo, NULL, &renderer->_wavefrontSemaphore);
+    if(result != VK_SUCCESS) return -3;
+    
+    recordRenderCommands(renderer);
+    
+    return 0;
+}
+    
+int32_t setBVHMode(Renderer* renderer, BVHMode mode)
+{
+    if(mode != BVH_MODE_CPU && renderer->_gpuBVHBuilder._shader == VK_NULL_HANDLE) return -1;
+    if(mode == renderer->_bvhMode) return 0;
+    
+    waitIdle(renderer->context);
+    
+    renderer->_bvhMode = mode;
+    renderer->_bvhDirty = true;
+    
+    if(mode == BVH_MODE_REFIT)
+    {
+        if(buildTLAS(renderer)) return -2;
+        if(gpuBVHBuilderResetRefit(&renderer->_gpuBVHBuilder, renderer->context, renderer->_tlas.numNodes)) return -3;
+    }
+    
+    if(renderer->_drawBuffers) recordRenderCommands(renderer);
+    
+    return 0;
+}
+
+int32_t setReflectionBackend(Renderer* renderer, ReflectionBackend backend)
+{
+    if(backend != REFLECTION_BACKEND_RASTER)
+    {
+        if(renderer->_wavefront._shader == VK_NULL_HANDLE) return -1;
+        if(!(renderer->context->presentUsage & VK_IMAGE_USAGE_TRANSFER_DST_BIT)) return -2;
+    }
+    
+    if(backend == renderer->_reflectionBackend) return 0;
+    
+    waitIdle(renderer->context);
+    
+    renderer->_reflectionBackend = backend;
+    
+    if(renderer->_drawBuffers) recordRenderCommands(renderer);
+    
+    return 0;
+}
+
+int32_t setTileCulling(Renderer* renderer, bool enabled)
+{
+    if(enabled && renderer->_tileCuller._shader == VK_NULL_HANDLE) return -1;
+    if(enabled == renderer->_tileCulling) return 0;
+    
+    waitIdle(renderer->context);
+    
+    renderer->_tileCulling = enabled;
+    
+    if(renderer->_drawBuffers) recordRenderCommands(renderer);
+    
+    return 0;
+}
+
+/*Leaves the last frame's lists needed, read by rendererUpdateBounceDepth.  The buffer grows
+  by half again what was needed so a slowly growing scene does not reallocate every frame,
+  until then the tiles that did not fit trace the BVH.*/
+int32_t rendererUpdateTileLeaves(Renderer* renderer)
+{
+    uint32_t capacity;
+    
+    if(!renderer->_tileCulling || renderer->_tileLeavesNeeded <= renderer->_tileLeafCapacity) return 0;
+    
+    capacity = renderer->_tileLeavesNeeded + renderer->_tileLeavesNeeded / 2;
+    
+    waitIdle(renderer->context);
+    
+    shaderStorageBufferDestroy(&renderer->_tileLeaves, renderer->context);
+    if(shaderStorageBufferCreate(&renderer->_tileLeaves, renderer->context, capacity * 2 * sizeof(uint32_t))) return -1;
+    
+    renderer->_tileLeafCapacity = capacity;
+    
+    updateTileLeavesDescriptor(renderer);
+    tileCullerSetLeaves(&renderer->_tileCuller, renderer->context, renderer->_tileLeaves.buffer);
+    
+    if(renderer->_drawBuffers) recordRenderCommands(renderer);
+    
+    return 0;
+}
+
+int32_t setTriangleSorting(Renderer* renderer, bool enabled)
+{
+    if(enabled && renderer->_primitives._shader == VK_NULL_HANDLE) return -1;
+    if(enabled == renderer->_sortTriangles) return 0;
+    
+    waitIdle(renderer->context);
+    
+    renderer->_sortTriangles = enabled;
+    
+    if(renderer->_drawBuffers) recordRenderCommands(renderer);
+    
+    return 0;
+}
+
+int32_t setMeshProxy(Renderer* renderer, uint32_t mesh, const uint32_t* indices, uint32_t numIndices)
+{
+    uint32_t* proxyIndices = NULL;
+    
+    if(mesh >= renderer->_numMeshes) return -1;
+    
+    if(indices)
+    {
+        if(numIndices < 3 || numIndices % 3 || numIndices > renderer->_scene->draws[mesh].indexCount) return -2;
+        
+        for(uint32_t i = 0; i < numIndices; ++i)
+        {
+            if(indices[i] >= renderer->_scene->numVertices) return -3;
+        }
+        
+        proxyIndices = (uint32_t*)malloc(numIndices * sizeof(uint32_t));
+        memcpy(proxyIndices, indices, numIndices * sizeof(uint32_t));
+    }
+    
+    waitIdle(renderer->context);
+    
+    free(renderer->_meshes[mesh].proxyIndices);
+    renderer->_meshes[mesh].proxyIndices = proxyIndices;
+    renderer->_meshes[mesh].numProxyTris = numIndices / 3;
+    markAllObjectsDirty(renderer);
+    
+    return buildBLAS(renderer) ? -4 : 0;
+}
+
+int32_t setProxyRatio(Renderer* renderer, float ratio)
+{
+    ratio = glm::clamp(ratio, 0.0f, 1.0f);
+    if(ratio == renderer->_proxyRatio) return 0;
+    
+    waitIdle(renderer->context);
+    
+    renderer->_proxyRatio = ratio;
+    markAllObjectsDirty(renderer);
+    
+    return buildBLAS(renderer) ? -1 : 0;
+}
+
+/*Levels that only change the resolution or checkerboard cost the raster backend the same, so
+  it steps over them to the next level that changes its distance or bounces.  When no level in
+  that direction does, level is returned unchanged.*/
+static inline uint32_t stepQualityLevel(Renderer* renderer, uint32_t level, int32_t step)
+{
+    const ReflectionSettings* current = &_qualityLevels[level];
+    int32_t next = (int32_t)level + step;
+    
+    if(renderer->_reflectionBackend != REFLECTION_BACKEND_RASTER) return next;
+    
+    for(; next >= 0 && next < (int32_t)LENGTH_OF(_qualityLevels); next += step)
+    {
+        if(_qualityLevels[next].maxDistance != current->maxDistance || _qualityLevels[next].maxBounces != current->maxBounces)
+        {
+            return next;
+        }
+    }
+    
+    return level;
+}
+
+static inline int32_t applyQualityLevel(Renderer* renderer, uint32_t level)
+{
+    FrameTimeController* controller = &renderer->_frameTime;
+    const ReflectionSettings* limits = &_qualityLevels[level];
+    
+    controller->level = level;
+    controller->limits = *limits;
+    controller->framesSinceChange = 0;
+    
+    if(setReflectionResolution(renderer, limits->resolution)) return -1;
+    if(renderer->_wavefront._shader != VK_NULL_HANDLE && setTemporalReflections(renderer, limits->checkerboard)) return -1;
+    
+    renderer->_camUniforms.maxDistance = std::min(renderer->_maxDistance, limits->maxDistance);
+    renderer->_camUniforms.bounceDepth = std::min(renderer->_camUniforms.bounceDepth, std::max(limits->maxBounces, 1u));
+    
+    DEBUG_PRINT("Reflection level %u: %.3f ms of %.3f ms, resolution 1/%u, distance %f, %u bounces, checkerboard %d\n", level,
+        controller->smoothedMs, controller->targetMs, (uint32_t)limits->resolution, limits->maxDistance, limits->maxBounces, limits->checkerboard);
+    
+    return updateUniforms(&renderer->_camPosBuffer, renderer->context, &renderer->_camUniforms);
+}
+
+/*Reads the timestamps of the frame that just finished and moves one level at a time.  A level
+  has to be measured for FRAME_TIME_SETTLE_FRAMES frames before it is lowered and for twice that
+  before it is raised, and raising needs a margin, so the controller does not oscillate between
+  two levels that straddle the target.*/
+int32_t rendererUpdateFrameTime(Renderer* renderer)
+{
+    FrameTimeController* controller = &renderer->_frameTime;
+    uint32_t level = controller->level;
+    uint64_t timestamps[2];
+    uint64_t mask;
+    VkResult result;
+    
+    result = vkGetQueryPoolResults(renderer->context->device, renderer->_timestampPool, 0, 2, sizeof(timestamps),
+        timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    if(result != VK_SUCCESS) return -1;
+    
+    /*The raster backend times the graphics queue and the others the compute queue*/
+    mask = renderer->_reflectionBackend == REFLECTION_BACKEND_RASTER ?
+        renderer->context->gfxTimestampMask : renderer->context->cmpTimestampMask;
+    
+    controller->reflectionMs = (float)((double)(((timestamps[1] & mask) - (timestamps[0] & mask)) & mask) *
+        renderer->context->timestampPeriod * 1e-6);
+    controller->smoothedMs = controller->framesSinceChange == 0 ? controller->reflectionMs :
+        controller->smoothedMs + FRAME_TIME_SMOOTHING * (controller->reflectionMs - controller->smoothedMs);
+    ++controller->framesSinceChange;
+    
+    if(!controller->enabled || controller->framesSinceChange < FRAME_TIME_SETTLE_FRAMES) return 0;
+    
+    if(controller->smoothedMs > controller->targetMs && controller->level + 1 < LENGTH_OF(_qualityLevels))
+    {
+        level = stepQualityLevel(renderer, controller->level, 1);
+    }
+    else if(controller->smoothedMs < controller->targetMs * FRAME_TIME_RAISE_MARGIN && controller->level > 0 &&
+        controller->framesSinceChange >= 2 * FRAME_TIME_SETTLE_FRAMES)
+    {
+        level = stepQualityLevel(renderer, controller->level, -1);
+    }
+    
+    return level == controller->level ? 0 : applyQualityLevel(renderer, level);
+}
+
+int32_t setFrameTimeTarget(Renderer* renderer, float targetMs)
+{
+    if(targetMs == renderer->_frameTime.targetMs && (targetMs > 0) == renderer->_frameTime.enabled) return 0;
+    
+    renderer->_frameTime.enabled = targetMs > 0;
+    renderer->_frameTime.targetMs = targetMs;
+    
+    if(!renderer->_frameTime.enabled) return applyQualityLevel(renderer, 0);
+    
+    renderer->_frameTime.framesSinceChange = 0;
+    return 0;
+}
+
+int32_t setReflectionResolution(Renderer* renderer, ReflectionResolution resolution)
+{
+    if(resolution == renderer->_reflectionResolution) return 0;
+    
+    waitIdle(renderer->context);
+    
+    renderer->_reflectionResolution = resolution;
+    
+    if(renderer->_drawBuffers && renderer->_reflectionBackend != REFLECTION_BACKEND_RASTER) recordRenderCommands(renderer);
+    
+    return 0;
+}
+
+int32_t setTemporalReflections(Renderer* renderer, bool enabled)
+{
+    if(renderer->_wavefront._shader == VK_NULL_HANDLE) return -1;
+    if(enabled == renderer->_temporalReflections) return 0;
+    
+    waitIdle(renderer->context);
+    
+    renderer->_temporalReflections = enabled;
+    
+    if(renderer->_drawBuffers && renderer->_reflectionBackend != REFLECTION_BACKEND_RASTER) recordRenderCommands(renderer);
     
     return 0;
 }
@@ -1113,11 +2438,16 @@ void destroyRenderCommands(Renderer* renderer)
     
     vkDestroyFence(renderer->context->device, renderer->_renderFence, NULL);
     vkDestroySemaphore(renderer->context->device, renderer->_renderCompleteSemaphore, NULL);
+    vkDestroySemaphore(renderer->context->device, renderer->_gBufferSemaphore, NULL);
+    vkDestroySemaphore(renderer->context->device, renderer->_wavefrontSemaphore, NULL);
     
     vkFreeCommandBuffers(renderer->context->device,
         renderer->context->gfxCmdPool, renderer->context->numImages, renderer->_drawBuffers);
+    vkFreeCommandBuffers(renderer->context->device, renderer->context->gfxCmdPool, 1, &renderer->_gBufferCmdBuffer);
+    vkFreeCommandBuffers(renderer->context->device, renderer->context->cmpCmdPool, 1, &renderer->_wavefrontCmdBuffer);
     
     free(renderer->_drawBuffers);
+    renderer->_drawBuffers = NULL;
 }
 
 static inline void destroyDescriptors(Renderer* renderer)
@@ -1127,18 +2457,25 @@ static inline void destroyDescriptors(Renderer* renderer)
         textureDestroy(&renderer->_textures[i], renderer->context);
     }
     
+    textureDestroy(&renderer->_environment, renderer->context);
+    
     vkResetDescriptorPool(renderer->context->device, renderer->_descriptorPool, 0);
     vkDestroyDescriptorPool(renderer->context->device, renderer->_descriptorPool, NULL);
     vkDestroyDescriptorSetLayout(renderer->context->device, renderer->_descriptorLayout, NULL);
     vkDestroyDescriptorSetLayout(renderer->context->device, renderer->_secondPassDescLayout, NULL);
     vkDestroyDescriptorSetLayout(renderer->context->device, renderer->_sharedDescLayout, NULL);
+    vkDestroySampler(renderer->context->device, renderer->_gBufferSampler, NULL);
 }
 
 void destroyPipeline(Renderer* renderer)
 {
     waitIdle(renderer->context);
     
-    vkDestroyPipeline(renderer->context->device, renderer->_pipelinePass1, NULL);
+    for(uint32_t i = 0; i < VERTEX_NUM_FORMATS; ++i)
+    {
+        vkDestroyPipeline(renderer->context->device, renderer->_pipelinesPass1[i], NULL);
+    }
+    
     vkDestroyPipelineLayout(renderer->context->device, renderer->_pipelineLayoutPass1, NULL);
     vkDestroyShaderModule(renderer->context->device, renderer->_vertexShader1, NULL);
     vkDestroyShaderModule(renderer->context->device, renderer->_fragmentShader1, NULL);
@@ -1152,6 +2489,59 @@ void destroyPipeline(Renderer* renderer)
     
     uniformBufferDestroy(&renderer->_uniformBuffer, renderer->context);
     uniformBufferDestroy(&renderer->_camPosBuffer, renderer->context);
+    shaderStorageBufferDestroy(&renderer->_tileRanges, renderer->context);
+    shaderStorageBufferDestroy(&renderer->_tileLeaves, renderer->context);
+    shaderStorageBufferDestroy(&renderer->_rayStats, renderer->context);
+    vkFreeMemory(renderer->context->device, renderer->_rayStatsReadbackMemory, NULL);
+    vkDestroyBuffer(renderer->context->device, renderer->_rayStatsReadback, NULL);
+    vkDestroyQueryPool(renderer->context->device, renderer->_timestampPool, NULL);
+}
+
+void destroyWavefrontPipeline(Renderer* renderer)
+{
+    waitIdle(renderer->context);
+    
+    if(renderer->_reflectionBackend != REFLECTION_BACKEND_RASTER) setReflectionBackend(renderer, REFLECTION_BACKEND_RASTER);
+    
+    wavefrontTracerDestroy(&renderer->_wavefront, renderer->context);
+    renderer->_wavefront = {};
+}
+
+void destroyTileCullPipeline(Renderer* renderer)
+{
+    waitIdle(renderer->context);
+    
+    if(renderer->_tileCulling) setTileCulling(renderer, false);
+    
+    tileCullerDestroy(&renderer->_tileCuller, renderer->context);
+    renderer->_tileCuller = {};
+}
+
+void destroySortPipeline(Renderer* renderer)
+{
+    waitIdle(renderer->context);
+    
+    if(renderer->_sortTriangles) setTriangleSorting(renderer, false);
+    
+    gpuPrimitivesDestroy(&renderer->_primitives, renderer->context);
+    renderer->_primitives = {};
+    
+    shaderStorageBufferDestroy(&renderer->_sortTriangleBuffer, renderer->context);
+    shaderStorageBufferDestroy(&renderer->_sortedIndexBuffer, renderer->context);
+    shaderStorageBufferDestroy(&renderer->_sortedDrawCommands, renderer->context);
+    renderer->_sortTriangleBuffer = {};
+    renderer->_sortedIndexBuffer = {};
+    renderer->_sortedDrawCommands = {};
+}
+
+void destroyComputePipeline(Renderer* renderer)
+{
+    waitIdle(renderer->context);
+    
+    if(renderer->_bvhMode != BVH_MODE_CPU) setBVHMode(renderer, BVH_MODE_CPU);
+    
+    gpuBVHBuilderDestroy(&renderer->_gpuBVHBuilder, renderer->context);
+    renderer->_gpuBVHBuilder = {};
 }
 
 void rendererDestroy(Renderer* renderer)
@@ -1159,7 +2549,33 @@ void rendererDestroy(Renderer* renderer)
     waitIdle(renderer->context);
     
     shaderStorageBufferDestroy(&renderer->_shaderVertexBuffer, renderer->context);
+    shaderStorageBufferDestroy(&renderer->_shaderAttributeBuffer, renderer->context);
     shaderStorageBufferDestroy(&renderer->_shaderIndexBuffer, renderer->context);
+    shaderStorageBufferDestroy(&renderer->_shaderTriRecordBuffer, renderer->context);
+    shaderStorageBufferDestroy(&renderer->_shaderWideBVHBuffer, renderer->context);
+    shaderStorageBufferDestroy(&renderer->_shaderBVHBuffer, renderer->context);
+    shaderStorageBufferDestroy(&renderer->_shaderTLASBuffer, renderer->context);
+    shaderStorageBufferDestroy(&renderer->_shaderInstanceBuffer, renderer->context);
+    
+    bvhDestroy(&renderer->_tlas);
+    
+    for(uint32_t i = 0; i < renderer->_numMeshes; ++i)
+    {
+        free(renderer->_meshes[i].proxyIndices);
+    }
+    
+    free(renderer->_meshes);
+    free(renderer->_objectMeshes);
+    free(renderer->_objectTransforms);
+    free(renderer->_objectNormals);
+    free(renderer->_objectTextures);
+    free(renderer->_objectMaterials);
+    free(renderer->_objectInstances);
+    free(renderer->_instances);
+    free(renderer->_instanceSlots);
+    free(renderer->_objectDirty);
+    free(renderer->_dirtyObjects);
+    threadPoolDestroy(&renderer->_threadPool);
     
     vkFreeMemory(renderer->context->device, renderer->_vertexMemory, NULL);
     vkDestroyBuffer(renderer->context->device, renderer->_vertexBuffer, NULL);
@@ -1169,7 +2585,9 @@ void rendererDestroy(Renderer* renderer)
         vkDestroyFramebuffer(renderer->context->device, renderer->_frameBuffers[i], NULL);
     }
     
+    vkDestroyFramebuffer(renderer->context->device, renderer->_gBufferFrameBuffer, NULL);
     vkDestroyRenderPass(renderer->context->device, renderer->_renderPass, NULL);
+    vkDestroyRenderPass(renderer->context->device, renderer->_reflectionPass, NULL);
     
     vkFreeMemory(renderer->context->device, renderer->_bufferMemory, NULL);
     vkDestroyImageView(renderer->context->device, renderer->_depthView, NULL);
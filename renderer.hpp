@@ -4,11 +4,114 @@
 #include <stdint.h>
 #include <vulkan/vulkan.h>
 
+#include "bvh.hpp"
 #include "context.h"
+#include "gpuBVH.hpp"
+#include "gpuPrimitives.hpp"
+#include "mesh.hpp"
 #include "texture.h"
+#include "threadPool.hpp"
+#include "tileCull.hpp"
 #include "shaderStorageBuffer.hpp"
 #include "uniformBuffer.hpp"
+#include "wavefront.hpp"
 
+#define MAX_REFLECTION_BOUNCES 8
+
+/*Reflection rays are traced through a two level structure.  Every mesh has one object space
+  BLAS built once on the host and the TLAS over the world bounds of the instances is rebuilt
+  when an object moves.  BVH_MODE_CPU rebuilds the TLAS on the host.  BVH_MODE_GPU rebuilds
+  it on the device every frame between the G-buffer and reflection passes.  BVH_MODE_REFIT
+  starts from a host build and refits it on the device every frame, rebuilding on the device
+  only when the refit tree has degraded.  Both device modes need createComputePipeline.*/
+typedef enum
+{
+    BVH_MODE_CPU,
+    BVH_MODE_GPU,
+    BVH_MODE_REFIT
+}
+BVHMode;
+
+/*REFLECTION_BACKEND_RASTER traces every pixel in the fullscreen triCast.frag pass.
+  REFLECTION_BACKEND_WAVEFRONT traces on the compute queue in separate raygen, trace, shade
+  and composite stages.  REFLECTION_BACKEND_TILED is the same compute path with raygen and
+  trace replaced by tiles that share triangles through shared memory.  Both compute
+  backends need createWavefrontPipeline and a swapchain that supports
+  VK_IMAGE_USAGE_TRANSFER_DST_BIT.*/
+typedef enum
+{
+    REFLECTION_BACKEND_RASTER,
+    REFLECTION_BACKEND_WAVEFRONT,
+    REFLECTION_BACKEND_TILED
+}
+ReflectionBackend;
+
+/*Fraction of the pixels the compute backends trace reflection rays for, one ray per 1, 2x2 or
+  4x4 block.  The reduced reflections are upsampled guided by the G-buffer positions and
+  normals.  The raster backend always traces every pixel.*/
+typedef enum
+{
+    REFLECTION_RESOLUTION_FULL = 1,
+    REFLECTION_RESOLUTION_HALF = 2,
+    REFLECTION_RESOLUTION_QUARTER = 4
+}
+ReflectionResolution;
+
+#define SCREEN_SPACE_STEPS 32
+#define REFLECTION_MAX_DISTANCE 100000.0f
+
+/*The reflection knobs the frame time controller turns.  maxBounces caps the bounce depth the
+  ray budget picks and maxDistance the length of every reflection ray.  resolution and
+  checkerboard only change the compute backends.*/
+typedef struct
+{
+    ReflectionResolution resolution;
+    float maxDistance;
+    uint32_t maxBounces;
+    bool checkerboard;
+}
+ReflectionSettings;
+
+/*Closed loop controller holding the GPU time of the reflection work to targetMs.  reflectionMs
+  is the time measured by the timestamps around the reflection pass of the last frame and
+  smoothedMs its moving average since the last change.  level indexes a fixed table of limits
+  from best to cheapest, the limits of the current level are in limits.*/
+typedef struct
+{
+    ReflectionSettings limits;
+    float targetMs;
+    float reflectionMs;
+    float smoothedMs;
+    uint32_t level;
+    uint32_t framesSinceChange;
+    bool enabled;
+}
+FrameTimeController;
+
+/*Matches RayStats in triCast.frag up to tileLeaves.  requested counts every ray a pixel
+  wanted including the bounces dropped by the budget, traced only the ones that were cast.
+  Every traced ray is resolved either by the screen space march or by traversing the
+  triangles.  tileLeaves is copied from the tile culler's scan total, the number of leaves
+  all tile lists needed, and stays 0 without tile culling.*/
+typedef struct
+{
+    uint32_t requested;
+    uint32_t traced;
+    uint32_t screenSpace;
+    uint32_t traversed;
+    uint32_t tileLeaves;
+}
+RayStats;
+
+typedef struct
+{
+    BLASRange range;
+    
+    /*Host copy of the proxy registered with setMeshProxy, NULL traces the raster triangles*/
+    uint32_t* proxyIndices;
+    uint32_t numProxyTris;
+}
+MeshBLAS;
 
 typedef struct 
 {
@@ -24,11 +127,18 @@ typedef struct
     VkImage _normalBuffer;
     VkImageView _normalView;
     VkRenderPass _renderPass;
+    VkRenderPass _reflectionPass;
     
+    VkFramebuffer _gBufferFrameBuffer;
     VkFramebuffer* _frameBuffers;
     
     VkDeviceMemory _vertexMemory;
     VkBuffer _vertexBuffer;
+    /*The raster vertices of every VertexFormat start at _vertexRegionOffsets and hold the global
+      vertices from _vertexRegionFirst on, the indices follow at _indexOffset*/
+    VkDeviceSize _vertexRegionOffsets[VERTEX_NUM_FORMATS];
+    uint32_t _vertexRegionFirst[VERTEX_NUM_FORMATS];
+    VkDeviceSize _indexOffset;
     
     VkShaderModule _vertexShader1;
     VkShaderModule _fragmentShader1;
@@ -36,14 +146,18 @@ typedef struct
     VkShaderModule _fragmentShader2;
     
     VkPipelineLayout _pipelineLayoutPass1;
-    VkPipeline _pipelinePass1;
+    VkPipeline _pipelinesPass1[VERTEX_NUM_FORMATS];
     VkPipelineLayout _pipelineLayoutPass2;
     VkPipeline _pipelinePass2;
     
     VkSemaphore _renderCompleteSemaphore;
+    VkSemaphore _gBufferSemaphore;
+    VkSemaphore _wavefrontSemaphore;
     VkFence _renderFence;
     
     VkCommandBuffer* _drawBuffers;
+    VkCommandBuffer _gBufferCmdBuffer;
+    VkCommandBuffer _wavefrontCmdBuffer;
     
     VkDescriptorPool _descriptorPool;
     VkDescriptorSetLayout _descriptorLayout;
@@ -57,9 +171,77 @@ typedef struct
     UniformBuffer _uniformBuffer;
     UniformBuffer _camPosBuffer;
     ShaderStorageBuffer _shaderVertexBuffer;
+    ShaderStorageBuffer _shaderAttributeBuffer;
     ShaderStorageBuffer _shaderIndexBuffer;
+    ShaderStorageBuffer _shaderTriRecordBuffer;
+    ShaderStorageBuffer _shaderWideBVHBuffer;
+    ShaderStorageBuffer _shaderBVHBuffer;
+    ShaderStorageBuffer _shaderTLASBuffer;
+    ShaderStorageBuffer _shaderInstanceBuffer;
     Texture _textures[8];
-    glm::vec3 _camPos;
+    Texture _environment;
+    ReflectionUniforms _camUniforms;
+    glm::mat4 _viewProj;
+    uint32_t _maxBounces;
+    float _maxDistance;
+    uint32_t _raysTraced;
+    uint32_t _raysScreenSpace;
+    uint32_t _raysTraversed;
+    ShaderStorageBuffer _rayStats;
+    VkSampler _gBufferSampler;
+    VkBuffer _rayStatsReadback;
+    VkDeviceMemory _rayStatsReadbackMemory;
+    VkQueryPool _timestampPool;
+    FrameTimeController _frameTime;
+    
+    BVH _tlas;
+    ThreadPool _threadPool;
+    const MeshData* _scene;
+    MeshBLAS* _meshes;
+    uint32_t _numMeshes;
+    float _proxyRatio;
+    /*The uploaded BLAS are the ones cooked into _scene, not a runtime build*/
+    bool _cookedBLAS;
+    uint32_t* _objectMeshes;
+    glm::mat4* _objectTransforms;
+    /*transpose(inverse()) of every object transform, computed once per change*/
+    glm::mat4* _objectNormals;
+    int32_t* _objectTextures;
+    glm::vec2* _objectMaterials;
+    /*Instance of every object in object order, only the ones in _dirtyObjects are refilled
+      before the next TLAS upload*/
+    BVHInstance* _objectInstances;
+    BVHInstance* _instances;
+    /*Index of every object's instance in _instances, only recomputed when the TLAS order changes*/
+    uint32_t* _instanceSlots;
+    bool _instanceOrderDirty;
+    bool* _objectDirty;
+    uint32_t* _dirtyObjects;
+    uint32_t _numDirtyObjects;
+    uint32_t _numObjects;
+    bool _bvhDirty;
+    
+    GPUBVHBuilder _gpuBVHBuilder;
+    BVHMode _bvhMode;
+    bool _wideBVH;
+    
+    WavefrontTracer _wavefront;
+    ReflectionBackend _reflectionBackend;
+    ReflectionResolution _reflectionResolution;
+    bool _temporalReflections;
+    
+    ShaderStorageBuffer _tileRanges;
+    ShaderStorageBuffer _tileLeaves;
+    uint32_t _tileLeafCapacity;
+    uint32_t _tileLeavesNeeded;
+    TileCuller _tileCuller;
+    bool _tileCulling;
+    
+    GPUPrimitives _primitives;
+    ShaderStorageBuffer _sortTriangleBuffer;
+    ShaderStorageBuffer _sortedIndexBuffer;
+    ShaderStorageBuffer _sortedDrawCommands;
+    bool _sortTriangles;
 }
 Renderer;
 
@@ -70,24 +252,110 @@ typedef struct
 }
 ShaderSrc;
 
-int32_t rendererCreate(Renderer* renderer, Context* context);
+/*The renderer reads scene until rendererDestroy, the caller keeps it alive and destroys it*/
+int32_t rendererCreate(Renderer* renderer, Context* context, const MeshData* scene);
 int32_t createPipeline(Renderer* renderer, ShaderSrc p1Vertex, ShaderSrc p1Fragment, ShaderSrc p2Vertex, ShaderSrc p2Fragment);
 int32_t createComputePipeline(Renderer* renderer, ShaderSrc compute);
+/*Call after createPipeline*/
+int32_t createWavefrontPipeline(Renderer* renderer, ShaderSrc compute);
+/*Call after createSortPipeline, the culler sizes its lists with the sort's scan*/
+int32_t createTileCullPipeline(Renderer* renderer, ShaderSrc compute);
+/*Call after createPipeline*/
+int32_t createSortPipeline(Renderer* renderer, ShaderSrc compute);
 int32_t createRenderCommands(Renderer* renderer);
+/*Replaces the environment reflection rays see when they miss or reach the maximum distance,
+  six square faces in the order +X, -X, +Y, -Y, +Z, -Z.  Call after createPipeline.*/
+int32_t setEnvironmentMap(Renderer* renderer, const char* const* faceFiles);
 
 
+int32_t rendererUpdateBVH(Renderer* renderer);
+int32_t rendererUpdateBounceDepth(Renderer* renderer);
+/*Grows the tile leaf buffer when the last raster frame needed more leaves than it holds*/
+int32_t rendererUpdateTileLeaves(Renderer* renderer);
+int32_t rendererUpdateFrameTime(Renderer* renderer);
+int32_t setBVHMode(Renderer* renderer, BVHMode mode);
+int32_t setReflectionBackend(Renderer* renderer, ReflectionBackend backend);
+int32_t setReflectionResolution(Renderer* renderer, ReflectionResolution resolution);
+/*Checkerboard tracing with reprojected history for the compute backends*/
+int32_t setTemporalReflections(Renderer* renderer, bool enabled);
+/*Per tile BLAS leaf lists for the raster reflection pass, needs createTileCullPipeline*/
+int32_t setTileCulling(Renderer* renderer, bool enabled);
+/*Draws the G-buffer from an index buffer sorted front to back every frame, needs createSortPipeline*/
+int32_t setTriangleSorting(Renderer* renderer, bool enabled);
+/*Steps the reflection settings down when the reflection work takes longer than targetMs and back
+  up when it has room to spare, 0 turns the controller off and returns to the best settings.
+  While it runs the controller owns the resolution and checkerboard settings.*/
+int32_t setFrameTimeTarget(Renderer* renderer, float targetMs);
+/*Traces numIndices / 3 triangles in place of the raster triangles of mesh, indices are global
+  vertex indices and may not exceed the raster index count of the mesh.  NULL drops the proxy.*/
+int32_t setMeshProxy(Renderer* renderer, uint32_t mesh, const uint32_t* indices, uint32_t numIndices);
+/*Meshes without a proxy trace a copy simplified to ratio of their raster triangles, 1 traces
+  the raster triangles themselves*/
+int32_t setProxyRatio(Renderer* renderer, float ratio);
+
 void destroyRenderCommands(Renderer* renderer);
+void destroyWavefrontPipeline(Renderer* renderer);
+void destroyTileCullPipeline(Renderer* renderer);
+void destroySortPipeline(Renderer* renderer);
 void destroyComputePipeline(Renderer* renderer);
 void destroyPipeline(Renderer* renderer);
 void rendererDestroy(Renderer* renderer);
 
+static inline void markObjectDirty(Renderer* renderer, uint32_t index)
+{
+    renderer->_bvhDirty = true;
+    
+    if(renderer->_objectDirty[index]) return;
+    
+    renderer->_objectDirty[index] = true;
+    renderer->_dirtyObjects[renderer->_numDirtyObjects++] = index;
+}
+
+/*Changes to the BLAS touch every instance*/
+static inline void markAllObjectsDirty(Renderer* renderer)
+{
+    for(uint32_t i = 0; i < renderer->_numObjects; ++i)
+    {
+        markObjectDirty(renderer, i);
+    }
+}
+
+static inline void setObjectInstance(Renderer* renderer, StandardUniforms* data, uint32_t index)
+{
+    renderer->_viewProj = data->vp;
+    
+    glm::vec2 material = glm::vec2(data->reflectivity, data->roughness);
+    
+    if(renderer->_objectTransforms[index] != data->model)
+    {
+        renderer->_objectTransforms[index] = data->model;
+        renderer->_objectNormals[index] = glm::transpose(glm::inverse(data->model));
+        markObjectDirty(renderer, index);
+    }
+    
+    if(renderer->_objectTextures[index] != (int32_t)data->texture || renderer->_objectMaterials[index] != material)
+    {
+        renderer->_objectTextures[index] = (int32_t)data->texture;
+        renderer->_objectMaterials[index] = material;
+        markObjectDirty(renderer, index);
+    }
+    
+    data->normalMatrix = renderer->_objectNormals[index];
+}
+
 static inline int32_t updateRendererUniforms(Renderer* renderer, StandardUniforms* data)
 {
+    for(uint32_t i = 0; i < renderer->_numObjects; ++i)
+    {
+        setObjectInstance(renderer, &data[i], i);
+    }
+    
     return updateUniforms(&renderer->_uniformBuffer, renderer->context, data);
 }
 
 static inline int32_t updateSingleUniform(Renderer* renderer, StandardUniforms* data, uint32_t index)
 {
+    setObjectInstance(renderer, data, index);
     return updateUniformSingle(&renderer->_uniformBuffer, renderer->context, data, index);
 }
 
@@ -107,6 +375,11 @@ static inline void updateTexture(Renderer* renderer, uint32_t index)
 {
     textureUpdateDescriptor(&renderer->_textures[index], renderer->context, renderer->_descriptorSet, index, 1);
     textureUpdateDescriptor(&renderer->_textures[index], renderer->context, renderer->_secondPassDescSet, index, 4);
+    
+    if(renderer->_wavefront._shader != VK_NULL_HANDLE)
+    {
+        textureUpdateDescriptor(&renderer->_textures[index], renderer->context, renderer->_wavefront.descSet, index, 4);
+    }
 }
 
 static inline void destroyTexture(Renderer* renderer, uint32_t index)
@@ -116,38 +389,186 @@ static inline void destroyTexture(Renderer* renderer, uint32_t index)
 
 static inline glm::vec3 getCamPos(Renderer* renderer)
 {
-    return renderer->_camPos;
+    return renderer->_camUniforms.camPos;
+}
+
+static inline uint32_t getNumObjects(Renderer* renderer)
+{
+    return renderer->_numObjects;
 }
 
 static inline void setCamPos(Renderer* renderer, glm::vec3 camPos)
 {
-    renderer->_camPos = camPos;
-    updateUniforms(&renderer->_camPosBuffer, renderer->context, &camPos);
+    renderer->_camUniforms.camPos = camPos;
+    updateUniforms(&renderer->_camPosBuffer, renderer->context, &renderer->_camUniforms);
 }
 
-static inline void render(Renderer* renderer)
+/*Reflections follow up to maxBounces mirror hits.  Once a frame asks for more than rayBudget
+  rays the remaining bounces are dropped and the next frames trace one bounce fewer until
+  the extra bounce fits again.  The first reflection of every pixel is always traced.  Only
+  the raster backend follows more than one bounce.*/
+static inline int32_t setReflectionBudget(Renderer* renderer, uint32_t maxBounces, uint32_t rayBudget)
+{
+    if(maxBounces < 1 || maxBounces > MAX_REFLECTION_BOUNCES) return -1;
+    
+    renderer->_maxBounces = maxBounces;
+    renderer->_camUniforms.bounceDepth = maxBounces;
+    renderer->_camUniforms.rayBudget = rayBudget;
+    return updateUniforms(&renderer->_camPosBuffer, renderer->context, &renderer->_camUniforms);
+}
+
+static inline uint32_t getBounceDepth(Renderer* renderer)
+{
+    return renderer->_camUniforms.bounceDepth;
+}
+
+/*Reflection rays cast by the raster backend in the last frame, counting every bounce*/
+static inline uint32_t getRaysTraced(Renderer* renderer)
+{
+    return renderer->_raysTraced;
+}
+
+/*Rays of the last raster frame that hit a visible surface in the depth buffer*/
+static inline uint32_t getRaysScreenSpace(Renderer* renderer)
+{
+    return renderer->_raysScreenSpace;
+}
+
+/*Rays of the last raster frame that left the screen or were occluded and traversed the BVH*/
+static inline uint32_t getRaysTraversed(Renderer* renderer)
+{
+    return renderer->_raysTraversed;
+}
+
+/*Traces the quantized BVH_WIDTH wide BLAS instead of the binary one from the next frame on.
+  The TLAS stays binary since it only holds one leaf per object.*/
+static inline void setWideBVH(Renderer* renderer, bool wide)
+{
+    if(renderer->_wideBVH == wide) return;
+    
+    renderer->_wideBVH = wide;
+    markAllObjectsDirty(renderer);
+}
+
+/*Longest reflection ray, farther surfaces are missed.  The frame time controller may shorten it.*/
+static inline int32_t setMaxRayDistance(Renderer* renderer, float maxDistance)
+{
+    renderer->_maxDistance = maxDistance;
+    renderer->_camUniforms.maxDistance = glm::min(maxDistance, renderer->_frameTime.limits.maxDistance);
+    return updateUniforms(&renderer->_camPosBuffer, renderer->context, &renderer->_camUniforms);
+}
+
+static inline const FrameTimeController* getFrameTimeController(Renderer* renderer)
+{
+    return &renderer->_frameTime;
+}
+
+/*Settings the reflections of the next frame use, maxBounces is the current bounce depth*/
+static inline ReflectionSettings getReflectionSettings(Renderer* renderer)
+{
+    ReflectionSettings settings;
+    
+    settings.resolution = renderer->_reflectionResolution;
+    settings.maxDistance = renderer->_camUniforms.maxDistance;
+    settings.maxBounces = renderer->_camUniforms.bounceDepth;
+    settings.checkerboard = renderer->_temporalReflections;
+    return settings;
+}
+
+/*Steps of the screen space march tried before the triangles are traced, 0 disables it*/
+static inline int32_t setScreenSpaceSteps(Renderer* renderer, uint32_t steps)
+{
+    renderer->_camUniforms.screenSpaceSteps = steps;
+    return updateUniforms(&renderer->_camPosBuffer, renderer->context, &renderer->_camUniforms);
+}
+
+/*The G-buffer pass and TLAS build run on the graphics queue, the wavefront stages on the
+  compute queue and the back buffer copy on the graphics queue again, chained by semaphores.*/
+static inline uint32_t submitWavefront(Renderer* renderer)
 {
     VkSubmitInfo submitInfo = {};
-    VkPipelineStageFlags waitStageMask = {VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT};
-    volatile VkResult eventStatus;    
+    VkSemaphore presentWaitSemaphores[2] = {renderer->context->presentSemaphore, renderer->_wavefrontSemaphore};
+    VkPipelineStageFlags presentWaitStages[2] = {VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT};
+    VkPipelineStageFlags computeWaitStage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    uint32_t nextImage;
     
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.waitSemaphoreCount = 1;
-    submitInfo.pWaitSemaphores = &renderer->context->presentSemaphore;
-    submitInfo.pWaitDstStageMask = &waitStageMask;
     submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &renderer->_gBufferCmdBuffer;
     submitInfo.signalSemaphoreCount = 1;
-    submitInfo.pSignalSemaphores = &renderer->_renderCompleteSemaphore;
+    submitInfo.pSignalSemaphores = &renderer->_gBufferSemaphore;
     
-    uint32_t nextImage = getNextImage(renderer->context, renderer->context->presentSemaphore);
+    vkQueueSubmit(renderer->context->gfxQueue, 1, &submitInfo, VK_NULL_HANDLE);
     
+    submitInfo.waitSemaphoreCount = 1;
+    submitInfo.pWaitSemaphores = &renderer->_gBufferSemaphore;
+    submitInfo.pWaitDstStageMask = &computeWaitStage;
+    submitInfo.pCommandBuffers = &renderer->_wavefrontCmdBuffer;
+    submitInfo.pSignalSemaphores = &renderer->_wavefrontSemaphore;
+    
+    vkQueueSubmit(renderer->context->cmpQueue, 1, &submitInfo, VK_NULL_HANDLE);
+    
+    nextImage = getNextImage(renderer->context, renderer->context->presentSemaphore);
+    
+    submitInfo.waitSemaphoreCount = 2;
+    submitInfo.pWaitSemaphores = presentWaitSemaphores;
+    submitInfo.pWaitDstStageMask = presentWaitStages;
     submitInfo.pCommandBuffers = &renderer->_drawBuffers[nextImage];
+    submitInfo.pSignalSemaphores = &renderer->_renderCompleteSemaphore;
     
     vkQueueSubmit(renderer->context->gfxQueue, 1, &submitInfo, renderer->_renderFence);
     
+    return nextImage;
+}
+
+static inline void render(Renderer* renderer)
+{
+    VkSubmitInfo submitInfo = {};
+    VkPipelineStageFlags waitStageMask = {VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT};
+    volatile VkResult eventStatus;    
+    uint32_t nextImage;
+    
+    if(renderer->_bvhDirty) rendererUpdateBVH(renderer);
+    
+    ++renderer->_camUniforms.frame;
+    renderer->_camUniforms.viewProj = renderer->_viewProj;
+    updateUniforms(&renderer->_camPosBuffer, renderer->context, &renderer->_camUniforms);
+    
+    if(renderer->_reflectionBackend != REFLECTION_BACKEND_RASTER)
+    {
+        nextImage = submitWavefront(renderer);
+    }
+    else
+    {
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.waitSemaphoreCount = 1;
+        submitInfo.pWaitSemaphores = &renderer->context->presentSemaphore;
+        submitInfo.pWaitDstStageMask = &waitStageMask;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = &renderer->_renderCompleteSemaphore;
+        
+        nextImage = getNextImage(renderer->context, renderer->context->presentSemaphore);
+        
+        submitInfo.pCommandBuffers = &renderer->_drawBuffers[nextImage];
+        
+        vkQueueSubmit(renderer->context->gfxQueue, 1, &submitInfo, renderer->_renderFence);
+    }
+    
     vkWaitForFences(renderer->context->device, 1, &renderer->_renderFence, VK_TRUE, 0xffffffffffffffff);
     vkResetFences(renderer->context->device, 1, &renderer->_renderFence);
-
+    
+    rendererUpdateFrameTime(renderer);
+    
+    /*The next frame reprojects its history with this frame's camera*/
+    renderer->_camUniforms.prevViewProj = renderer->_viewProj;
+    
+    if(renderer->_reflectionBackend == REFLECTION_BACKEND_RASTER)
+    {
+        rendererUpdateBounceDepth(renderer);
+        rendererUpdateTileLeaves(renderer);
+    }
+    
     swapBuffers(renderer->context, nextImage, &renderer->_renderCompleteSemaphore, 1);
 }
 
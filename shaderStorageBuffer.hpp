@@ -14,7 +14,9 @@ typedef struct
 }
 ShaderStorageBuffer;
 
-static inline int32_t createStagingBuffer(Context* context, uint32_t size, VkBuffer* buffer, VkDeviceMemory* mem)
+/*Host visible buffer for uploads, or for readbacks with VK_BUFFER_USAGE_TRANSFER_DST_BIT*/
+static inline int32_t createStagingBuffer(Context* context, uint32_t size, VkBuffer* buffer, VkDeviceMemory* mem,
+    VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT)
 {
     VkBufferCreateInfo bufferInfo = {};
     VkMemoryRequirements memoryReqs = {};
@@ -26,7 +28,7 @@ static inline int32_t createStagingBuffer(Context* context, uint32_t size, VkBuf
     
     bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
     bufferInfo.size = size;
-    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    bufferInfo.usage = usage;
     bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
     
     result = vkCreateBuffer(context->device, &bufferInfo, NULL, buffer);
@@ -59,7 +61,7 @@ static inline int32_t createStagingBuffer(Context* context, uint32_t size, VkBuf
     return 0;
 }
 
-static inline int32_t shaderStorageBufferCreate(ShaderStorageBuffer* ssb, Context* context, uint32_t size)
+static inline int32_t shaderStorageBufferCreate(ShaderStorageBuffer* ssb, Context* context, uint32_t size, VkBufferUsageFlags usage = 0)
 {
     VkBufferCreateInfo bufferInfo = {};
     VkMemoryRequirements memoryReqs = {};
@@ -74,7 +76,7 @@ static inline int32_t shaderStorageBufferCreate(ShaderStorageBuffer* ssb, Contex
     
     bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
     bufferInfo.size = size;
-    bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage;
     bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
     bufferInfo.queueFamilyIndexCount = getFamilies(context, familyIndices);
     bufferInfo.pQueueFamilyIndices = familyIndices;
@@ -111,20 +113,32 @@ static inline int32_t shaderStorageBufferCreate(ShaderStorageBuffer* ssb, Contex
     return 0;
 }
 
-static inline int32_t shaderStorageBufferWrite(ShaderStorageBuffer* ssb, Context* context, void* data, uint32_t size)
+/*Copies the ranges of data at each range's dstOffset to the same offset of the buffer with one
+  staging buffer and one submit.  The ranges are packed in the staging buffer and their
+  srcOffset is overwritten with where each one went.*/
+static inline int32_t shaderStorageBufferWriteRanges(ShaderStorageBuffer* ssb, Context* context, const void* data,
+    VkBufferCopy* ranges, uint32_t numRanges)
 {
     VkCommandBufferBeginInfo cmdBeginInfo = {};
     VkFenceCreateInfo fenceInfo = {};
     VkBuffer temp;
     VkDeviceMemory mem;
     VkFence fence;
-    VkBufferCopy copy;
     VkSubmitInfo submitInfo = {};
     VkPipelineStageFlags waitStageMask = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT;
+    uint32_t size = 0;
     void* mapped;
     VkResult vkRes;
     int32_t res;
     
+    if(numRanges == 0) return 0;
+    
+    for(uint32_t i = 0; i < numRanges; ++i)
+    {
+        ranges[i].srcOffset = size;
+        size += (uint32_t)ranges[i].size;
+    }
+    
     res = createStagingBuffer(context, size, &temp, &mem);
     
     if(res == -3)
@@ -141,7 +155,10 @@ static inline int32_t shaderStorageBufferWrite(ShaderStorageBuffer* ssb, Context
     vkRes = vkMapMemory(context->device, mem, 0, VK_WHOLE_SIZE, 0, &mapped);
     if(vkRes != VK_SUCCESS) return -2;
     
-    memcpy(mapped, data, size);
+    for(uint32_t i = 0; i < numRanges; ++i)
+    {
+        memcpy((char*)mapped + ranges[i].srcOffset, (const char*)data + ranges[i].dstOffset, ranges[i].size);
+    }
     
     fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
     vkRes = vkCreateFence(context->device, &fenceInfo, NULL, &fence);
@@ -155,13 +172,9 @@ static inline int32_t shaderStorageBufferWrite(ShaderStorageBuffer* ssb, Context
     cmdBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
     cmdBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
     
-    copy.srcOffset = 0;
-    copy.dstOffset = 0;
-    copy.size = size;
-    
     vkBeginCommandBuffer(context->transferCmdBuffer, &cmdBeginInfo);
     
-    vkCmdCopyBuffer(context->transferCmdBuffer, temp, ssb->buffer, 1, &copy);
+    vkCmdCopyBuffer(context->transferCmdBuffer, temp, ssb->buffer, numRanges, ranges);
     
     vkEndCommandBuffer(context->transferCmdBuffer);
     
@@ -182,6 +195,13 @@ static inline int32_t shaderStorageBufferWrite(ShaderStorageBuffer* ssb, Context
     return 0;
 }
 
+static inline int32_t shaderStorageBufferWrite(ShaderStorageBuffer* ssb, Context* context, void* data, uint32_t size)
+{
+    VkBufferCopy copy = {0, 0, size};
+    
+    return shaderStorageBufferWriteRanges(ssb, context, data, &copy, 1);
+}
+
 static inline void shaderStorageBufferDestroy(ShaderStorageBuffer* ssb, Context* context)
 {
     vkFreeMemory(context->device, ssb->_memory, NULL);
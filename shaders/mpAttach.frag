@@ -10,10 +10,12 @@ layout(location = 0)in struct FragmentIn
 i;
 
 layout(location = 3)flat in int textureUnit;
+layout(location = 4)flat in vec2 material;
 
 layout(location = 0)out vec4 color;
 layout(location = 1)out vec4 position;
-layout(location = 2)out vec2 normal;
+//Normal x and z, reflectivity and roughness
+layout(location = 2)out vec4 normal;
 
 layout(set = 0, binding = 1)uniform sampler2D textures[8];
 
@@ -21,6 +23,6 @@ void main()
 {
     vec3 n = normalize(i.vertexNormal.xyz);
     position = vec4(i.vertexWorldPos.xyz, n.y);
-    normal = n.xz;
+    normal = vec4(n.xz, material);
     color = texture(textures[textureUnit], i.vertexUV.xy);
 }
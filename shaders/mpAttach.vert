@@ -6,13 +6,8 @@ struct Uniforms
     mat4 model;
     mat4 vp;
     vec4 camTex;
-};
-
-struct StorageVertex
-{
-    vec4 positionU;
-    vec4 normalV;
-    ivec4 textureUnit;
+    vec4 material;
+    mat4 normalMatrix;
 };
 
 layout(location = 0)in vec4 position;
@@ -20,8 +15,8 @@ layout(location = 1)in vec4 normal;
 layout(location = 2)in vec4 texCoord;
 
 layout(constant_id = 0)const uint numObjs = 1;
-layout(constant_id = 1)const uint numVerts = 3;
-layout(constant_id = 2)const uint numTris = 1;
+//Set for VERTEX_FORMAT_PACKED meshes, whose normal arrives as the two octahedral components
+layout(constant_id = 7)const bool packedVertices = false;
 
 layout(location = 0)out struct VertexOut
 {
@@ -32,6 +27,7 @@ layout(location = 0)out struct VertexOut
 o;
 
 layout(location = 3)flat out int textureUnit;
+layout(location = 4)flat out vec2 material;
 
 layout(std140, binding = 0)uniform UniformBuffer
 {
@@ -39,23 +35,26 @@ layout(std140, binding = 0)uniform UniformBuffer
 }
 uniformBuffer;
 
-layout(std430, set = 1, binding = 0)buffer VertexBuffer
+vec3 unpackOctahedral(vec2 p)
 {
-    StorageVertex verts[numVerts];
-};
+    vec3 n = vec3(p, 1 - abs(p.x) - abs(p.y));
+    float t = max(-n.z, 0);
+    
+    n.x += n.x >= 0 ? -t : t;
+    n.y += n.y >= 0 ? -t : t;
+    
+    return normalize(n);
+}
 
 void main()
 {
-    StorageVertex sv;
-    o.vertexNormal = transpose(inverse(uniformBuffer.data[gl_InstanceIndex].model)) * normal;
+    vec4 objectNormal = packedVertices ? vec4(unpackOctahedral(normal.xy), 0.0) : normal;
+    
+    o.vertexNormal = uniformBuffer.data[gl_InstanceIndex].normalMatrix * objectNormal;
     o.vertexUV = texCoord;
     textureUnit = floatBitsToInt(uniformBuffer.data[gl_InstanceIndex].camTex.w);
+    material = uniformBuffer.data[gl_InstanceIndex].material.xy;
     o.vertexWorldPos = uniformBuffer.data[gl_InstanceIndex].model * vec4(position.xyz, 1.0);
-    sv.positionU = vec4(o.vertexWorldPos.xyz, o.vertexUV.x);
-    sv.normalV = vec4(o.vertexNormal.xyz, o.vertexUV.y);
-    sv.textureUnit = ivec4(textureUnit);
-    
-    verts[gl_VertexIndex] = sv;
     
     gl_Position = uniformBuffer.data[gl_InstanceIndex].vp * o.vertexWorldPos;
 }
@@ -0,0 +1,454 @@
+//Shared reflection ray tracing.  Declare the numObjs, numVerts and numTris specialization constants before including.
+
+#define EPSILON 0.01
+//The BLAS builders keep every leaf within BVH_STACK_SIZE levels, pushes included for the wide nodes.  Must match bvh.hpp.
+#define BVH_STACK_SIZE 32
+//The TLAS may come from lbvh.comp, whose Karras splits go one level down per distinct common prefix.
+//That is at most 30 Morton bits plus 32 index bits for duplicate codes, so 62 levels.
+#define TLAS_STACK_SIZE 64
+
+//Must match vertex.hpp
+#define TRIANGLE_FLIPPED 0x80000000u
+#define TRIANGLE_MATERIAL_MASK 0x7fffffffu
+#define BLAS_ROOT_WIDE 0x80000000u
+
+//Traversal only reads positions, the attributes are fetched once for the closest hit
+struct StorageVertex
+{
+    float x;
+    float y;
+    float z;
+};
+
+//Octahedral normal and half float texture coordinates
+struct VertexAttributes
+{
+    uint normal;
+    uint texCoords;
+};
+
+//Material ID and TRIANGLE_FLIPPED, stored once per triangle
+struct Triangle
+{
+    int verts[3];
+    uint material;
+};
+
+//First vertex and edges of a triangle, v0.w is -1 for TRIANGLE_FLIPPED triangles
+struct TriangleRecord
+{
+    vec4 v0;
+    vec4 e1;
+    vec4 e2;
+};
+
+struct BVHNode
+{
+    vec3 min;
+    int leftFirst;
+    vec3 max;
+    int count;
+};
+
+//Quantized 4 wide node, see BVHWideNode in bvh.hpp
+struct WideBVHNode
+{
+    vec3 origin;
+    uint exponents;
+    uvec3 qlo;
+    uint leafCounts;
+    uvec3 qhi;
+    uint numChildren;
+    ivec4 children;
+};
+
+struct Instance
+{
+    mat4 objectToWorld;
+    mat4 worldToObject;
+    vec3 min;
+    int blasRoot;
+    vec3 max;
+    int textureUnit;
+    int firstTri;
+    int numTris;
+    float reflectivity;
+    float roughness;
+};
+
+layout(std430, set = 1, binding = 0)buffer VertexBuffer
+{
+    StorageVertex verts[numVerts];
+};
+
+layout(std430, set = 1, binding = 1)buffer IndexBuffer
+{
+    Triangle tris[numTris];
+};
+
+layout(std430, set = 1, binding = 2)buffer BVHBuffer
+{
+    BVHNode nodes[];
+};
+
+layout(std430, set = 1, binding = 3)buffer TLASBuffer
+{
+    BVHNode tlasNodes[];
+};
+
+layout(std430, set = 1, binding = 4)buffer InstanceBuffer
+{
+    Instance instances[numObjs];
+};
+
+layout(std430, set = 1, binding = 5)buffer AttributeBuffer
+{
+    VertexAttributes attributes[numVerts];
+};
+
+layout(std430, set = 1, binding = 6)buffer TriangleRecordBuffer
+{
+    TriangleRecord triRecords[numTris];
+};
+
+layout(std430, set = 1, binding = 7)buffer WideBVHBuffer
+{
+    WideBVHNode wideNodes[];
+};
+
+vec3 comb(vec3 a, vec3 b, vec3 c, vec3 m)
+{
+    return a * m.x + b * m.y + c * m.z;
+}
+
+float comb(float a, float b, float c, vec3 m)
+{
+    return a * m.x + b * m.y + c * m.z;
+}
+
+vec3 vertexPosition(int vert)
+{
+    return vec3(verts[vert].x, verts[vert].y, verts[vert].z);
+}
+
+vec3 unpackOctahedral(uint packed)
+{
+    vec2 p = unpackSnorm2x16(packed);
+    vec3 n = vec3(p, 1 - abs(p.x) - abs(p.y));
+    float t = max(-n.z, 0);
+    
+    n.x += n.x >= 0 ? -t : t;
+    n.y += n.y >= 0 ? -t : t;
+    
+    return normalize(n);
+}
+
+/*Only hits the front face.  det is -dot(cross(e1, e2), direction), so scaling it by the
+  winding in v0.w culls back faces and near parallel rays with one compare.*/
+bool intersect(vec3 origin, vec3 direction, TriangleRecord tri, out float r, out vec3 bary)
+{
+    vec3 e1 = tri.e1.xyz;
+    vec3 e2 = tri.e2.xyz;
+    vec3 p = cross(direction, e2);
+    float det = dot(e1, p);
+    if(det * tri.v0.w < EPSILON)
+    {
+        bary = vec3(0, 0, 0);
+        return false;
+    }
+    
+    float invDet = 1/det;
+    
+    vec3 t = origin - tri.v0.xyz;
+    vec3 q = cross(t, e1);
+    
+    bary.y = dot(t, p) * invDet;
+    bary.z = dot(direction, q) * invDet;
+    bary.x = 1 - bary.y - bary.z;
+    
+    r = dot(e2, q) * invDet;
+    
+    return r > EPSILON && bary.x >= 0 && bary.y >= 0 && bary.z >= 0;
+}
+
+float intersectBox(vec3 origin, vec3 invDir, vec3 bMin, vec3 bMax, float maxR)
+{
+    vec3 t0 = (bMin - origin) * invDir;
+    vec3 t1 = (bMax - origin) * invDir;
+    vec3 tMin = min(t0, t1);
+    vec3 tMax = max(t0, t1);
+    float tNear = max(max(tMin.x, tMin.y), max(tMin.z, 0));
+    float tFar = min(min(tMax.x, tMax.y), tMax.z);
+    
+    return tNear <= tFar && tNear < maxR ? tNear : 1e30;
+}
+
+//Records triangle tri of instance as the hit if it is closer than minR and faces the ray
+void intersectTriangle(vec3 origin, vec3 direction, TriangleRecord record, int tri, int instance,
+    inout float minR, inout ivec2 hit, inout vec3 minBary)
+{
+    vec3 bary;
+    float r;
+    
+    if(intersect(origin, direction, record, r, bary) && r < minR)
+    {
+        hit = ivec2(tri, instance);
+        minR = r;
+        minBary = bary;
+    }
+}
+
+void intersectLeaf(vec3 origin, vec3 direction, BVHNode node, int instance, inout float minR, inout ivec2 hit, inout vec3 minBary)
+{
+    for(int i = node.leftFirst; i < node.leftFirst + node.count; ++i)
+    {
+        intersectTriangle(origin, direction, triRecords[i], i, instance, minR, hit, minBary);
+    }
+}
+
+//Orders the children of an interior node front to back
+void orderChildren(vec3 origin, vec3 invDir, BVHNode left, BVHNode right, int first, float maxR,
+    out int nearChild, out float nearDist, out int farChild, out float farDist)
+{
+    nearDist = intersectBox(origin, invDir, left.min, left.max, maxR);
+    farDist = intersectBox(origin, invDir, right.min, right.max, maxR);
+    nearChild = first;
+    farChild = first + 1;
+    
+    if(farDist < nearDist)
+    {
+        nearChild = first + 1;
+        farChild = first;
+        float tmpDist = nearDist;
+        nearDist = farDist;
+        farDist = tmpDist;
+    }
+}
+
+//origin and direction are in object space.  direction is not renormalized so r stays the world space ray parameter.
+void traceBLAS(vec3 origin, vec3 direction, int root, int instance, inout float minR, inout ivec2 hit, inout vec3 minBary)
+{
+    int stack[BVH_STACK_SIZE];
+    int stackPtr = 0;
+    int nearChild;
+    int farChild;
+    float nearDist;
+    float farDist;
+    vec3 invDir = 1.0 / direction;
+    BVHNode node = nodes[root];
+    
+    if(intersectBox(origin, invDir, node.min, node.max, minR) >= minR) return;
+    
+    while(true)
+    {
+        if(node.count > 0)
+        {
+            intersectLeaf(origin, direction, node, instance, minR, hit, minBary);
+        }
+        else
+        {
+            orderChildren(origin, invDir, nodes[node.leftFirst], nodes[node.leftFirst + 1], node.leftFirst, minR,
+                nearChild, nearDist, farChild, farDist);
+            
+            if(nearDist < minR)
+            {
+                if(farDist < minR)
+                {
+                    stack[stackPtr++] = farChild;
+                }
+                
+                node = nodes[nearChild];
+                continue;
+            }
+        }
+        
+        if(stackPtr == 0) break;
+        node = nodes[stack[--stackPtr]];
+    }
+}
+
+//Size of one quantization step along each axis, the exponent bytes are biased like a float's
+vec3 wideNodeStep(WideBVHNode node)
+{
+    return vec3(uintBitsToFloat((node.exponents & 0xffu) << 23), uintBitsToFloat(((node.exponents >> 8) & 0xffu) << 23),
+        uintBitsToFloat(((node.exponents >> 16) & 0xffu) << 23));
+}
+
+/*Same as traceBLAS over the wide nodes.  Leaf children are intersected as soon as their
+  box is hit and interior children are pushed far to near so the nearest is visited next.*/
+void traceWideBLAS(vec3 origin, vec3 direction, int root, int instance, inout float minR, inout ivec2 hit, inout vec3 minBary)
+{
+    int stack[BVH_STACK_SIZE];
+    int stackPtr = 0;
+    vec3 invDir = 1.0 / direction;
+    int current = root;
+    
+    while(true)
+    {
+        WideBVHNode node = wideNodes[current];
+        vec3 step = wideNodeStep(node);
+        int nearChildren[4];
+        float nearDists[4];
+        int numNear = 0;
+        
+        for(uint i = 0; i < node.numChildren; ++i)
+        {
+            uint shift = 8 * i;
+            vec3 bMin = node.origin + vec3((node.qlo >> shift) & 0xffu) * step;
+            vec3 bMax = node.origin + vec3((node.qhi >> shift) & 0xffu) * step;
+            float dist = intersectBox(origin, invDir, bMin, bMax, minR);
+            int count = int((node.leafCounts >> shift) & 0xffu);
+            
+            if(dist >= minR) continue;
+            
+            if(count > 0)
+            {
+                for(int j = node.children[i]; j < node.children[i] + count; ++j)
+                {
+                    intersectTriangle(origin, direction, triRecords[j], j, instance, minR, hit, minBary);
+                }
+            }
+            else
+            {
+                int k = numNear++;
+                
+                for(; k > 0 && nearDists[k - 1] < dist; --k)
+                {
+                    nearDists[k] = nearDists[k - 1];
+                    nearChildren[k] = nearChildren[k - 1];
+                }
+                
+                nearDists[k] = dist;
+                nearChildren[k] = node.children[i];
+            }
+        }
+        
+        if(numNear > 0)
+        {
+            for(int i = 0; i < numNear - 1; ++i)
+            {
+                stack[stackPtr++] = nearChildren[i];
+            }
+            
+            current = nearChildren[numNear - 1];
+            continue;
+        }
+        
+        if(stackPtr == 0) break;
+        current = stack[--stackPtr];
+    }
+}
+
+//Returns the closest triangle and the instance it belongs to, x is -1 on a miss
+ivec2 traceClosest(vec3 origin, vec3 direction, inout float minR, out vec3 minBary)
+{
+    int stack[TLAS_STACK_SIZE];
+    int stackPtr = 0;
+    int nearChild;
+    int farChild;
+    float nearDist;
+    float farDist;
+    ivec2 hit = ivec2(-1);
+    vec3 invDir = 1.0 / direction;
+    BVHNode node = tlasNodes[0];
+    
+    minBary = vec3(0);
+    
+    if(intersectBox(origin, invDir, node.min, node.max, minR) >= minR) return hit;
+    
+    while(true)
+    {
+        if(node.count > 0)
+        {
+            for(int i = node.leftFirst; i < node.leftFirst + node.count; ++i)
+            {
+                mat4 worldToObject = instances[i].worldToObject;
+                uint root = uint(instances[i].blasRoot);
+                
+                if((root & BLAS_ROOT_WIDE) != 0)
+                {
+                    traceWideBLAS((worldToObject * vec4(origin, 1)).xyz, (worldToObject * vec4(direction, 0)).xyz,
+                        int(root & ~BLAS_ROOT_WIDE), i, minR, hit, minBary);
+                }
+                else
+                {
+                    traceBLAS((worldToObject * vec4(origin, 1)).xyz, (worldToObject * vec4(direction, 0)).xyz,
+                        int(root), i, minR, hit, minBary);
+                }
+            }
+        }
+        else
+        {
+            orderChildren(origin, invDir, tlasNodes[node.leftFirst], tlasNodes[node.leftFirst + 1], node.leftFirst, minR,
+                nearChild, nearDist, farChild, farDist);
+            
+            if(nearDist < minR)
+            {
+                if(farDist < minR)
+                {
+                    stack[stackPtr++] = farChild;
+                }
+                
+                node = tlasNodes[nearChild];
+                continue;
+            }
+        }
+        
+        if(stackPtr == 0) break;
+        node = tlasNodes[stack[--stackPtr]];
+    }
+    
+    return hit;
+}
+
+//Interpolated texture coordinates and world space normal of a hit
+void hitAttributes(ivec2 hit, vec3 bary, out vec2 texUV, out vec3 hitNormal)
+{
+    VertexAttributes triAttributes[3];
+    
+    triAttributes[0] = attributes[tris[hit.x].verts[0]];
+    triAttributes[1] = attributes[tris[hit.x].verts[1]];
+    triAttributes[2] = attributes[tris[hit.x].verts[2]];
+    
+    texUV = unpackHalf2x16(triAttributes[0].texCoords) * bary.x +
+        unpackHalf2x16(triAttributes[1].texCoords) * bary.y +
+        unpackHalf2x16(triAttributes[2].texCoords) * bary.z;
+    hitNormal = comb(unpackOctahedral(triAttributes[0].normal), unpackOctahedral(triAttributes[1].normal),
+        unpackOctahedral(triAttributes[2].normal), bary);
+    hitNormal = normalize((vec4(hitNormal, 0) * instances[hit.y].worldToObject).xyz);
+}
+
+//Texture of a hit, triangle materials index the textures following the instance's
+int hitTexture(ivec2 hit)
+{
+    return instances[hit.y].textureUnit + int(tris[hit.x].material & TRIANGLE_MATERIAL_MASK);
+}
+
+uint hashPixel(uvec2 pixel, uint seed)
+{
+    uint h = pixel.x * 1973u + pixel.y * 9277u + seed * 26699u;
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return h;
+}
+
+/*Mirror reflection tilted by a random direction scaled by roughness squared.  The same
+  pixel and seed give the same ray in every shader, so the tile culling cones hold the rays
+  the reflection pass casts.  seed is frame * 8 + bounce.  Directions tilted below the
+  surface fall back to the mirror.*/
+vec3 glossyReflect(vec3 dir, vec3 normal, float roughness, uvec2 pixel, uint seed)
+{
+    vec3 mirror = reflect(dir, normal);
+    if(roughness <= 0) return mirror;
+    
+    uint h = hashPixel(pixel, seed);
+    float z = float(h & 0xffffu) / 32768.0 - 1;
+    float phi = float(h >> 16) / 65536.0 * 6.2831853;
+    vec3 jitter = vec3(sqrt(1 - z * z) * vec2(cos(phi), sin(phi)), z);
+    vec3 glossy = normalize(mirror + roughness * roughness * jitter);
+    
+    return dot(glossy, normal) > 0 ? glossy : mirror;
+}
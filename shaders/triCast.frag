@@ -1,158 +1,295 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
-
-#define EPSILON 0.01
-
-struct StorageVertex
-{
-    vec4 positionU;
-    vec4 normalV;
-    ivec4 textureUnit;
-};
-
-struct Triangle
-{
-    int verts[3];
-    float dist;
-};
+#extension GL_GOOGLE_include_directive : require
+#extension GL_KHR_shader_subgroup_ballot : require
+#extension GL_KHR_shader_subgroup_arithmetic : require
 
 layout(constant_id = 0)const uint numObjs = 1;
 layout(constant_id = 1)const uint numVerts = 3;
 layout(constant_id = 2)const uint numTris = 1;
+layout(constant_id = 5)const uint width = 1;
+layout(constant_id = 6)const uint height = 1;
+
+//Must match tileCull.hpp
+#define TILE_SIZE 8
+#define TILE_OVERFLOW 0xffffffffu
+#define TILE_LEAF_INSTANCE_MASK 0xffffffu
+#define TILE_LEAF_COUNT_SHIFT 24
+
+//Closest the end of a screen space ray may get to the camera
+#define SCREEN_SPACE_NEAR 0.01
+
+#include "trace.glsl"
 
 layout(input_attachment_index = 0, set = 0, binding = 0)uniform subpassInput inColor;
 layout(input_attachment_index = 1, set = 0, binding = 1)uniform subpassInput posNY;
 layout(input_attachment_index = 2, set = 0, binding = 2)uniform subpassInput nXZ;
 
+//Matches ReflectionUniforms in uniformBuffer.hpp
 layout(set = 0, binding = 3)uniform CamPos
 {
     vec3 cameraPosition;
+    uint bounceDepth;
+    uint rayBudget;
+    uint frame;
+    uint screenSpaceSteps;
+    float maxDistance;
+    mat4 prevViewProj;
+    mat4 viewProj;
 };
 
 layout(set = 0, binding = 4)uniform sampler2D textures[8];
 
-layout(location = 0)out vec4 color;
+//First leaf and number of leaves of each tile, see tileCull.comp
+layout(std430, set = 0, binding = 5)buffer TileRanges
+{
+    uvec2 tileRanges[];
+};
 
-layout(std430, set = 1, binding = 0)buffer VertexBuffer
+layout(std430, set = 0, binding = 6)buffer TileLeaves
 {
-    StorageVertex verts[numVerts];
+    uvec2 tileLeaves[];
 };
 
-layout(std430, set = 1, binding = 1)buffer IndexBuffer
+//Cleared every frame and read back by rendererUpdateBounceDepth, each subgroup adds its lanes' counts with one atomic
+layout(std430, set = 0, binding = 7)buffer RayStats
 {
-    Triangle tris[numTris];
+    uint raysRequested;
+    uint raysTraced;
+    uint raysScreenSpace;
+    uint raysTraversed;
 };
 
-vec3 comb(vec3 a, vec3 b, vec3 c, vec3 m)
+//Depth, color, position and normal, read at other pixels than this one by the screen space march
+layout(set = 0, binding = 8)uniform sampler2D gBuffer[4];
+
+//Mip chain filtered on the host, rougher surfaces read blurrier levels
+layout(set = 0, binding = 9)uniform samplerCube environment;
+
+layout(location = 0)out vec4 color;
+
+//Closest hit among the BLAS leaves the culling prepass kept for this tile
+ivec2 traceTile(uvec2 range, vec3 origin, vec3 dir, inout float minR, out vec3 minBary)
 {
-    return a * m.x + b * m.y + c * m.z;
+    ivec2 hit = ivec2(-1);
+    minBary = vec3(0);
+    
+    for(uint i = range.x; i < range.x + range.y; ++i)
+    {
+        uvec2 leaf = tileLeaves[i];
+        int instance = int(leaf.y & TILE_LEAF_INSTANCE_MASK);
+        int first = int(leaf.x);
+        int end = first + int(leaf.y >> TILE_LEAF_COUNT_SHIFT);
+        mat4 worldToObject = instances[instance].worldToObject;
+        vec3 objectOrigin = (worldToObject * vec4(origin, 1)).xyz;
+        vec3 objectDir = (worldToObject * vec4(dir, 0)).xyz;
+        
+        for(int tri = first; tri < end; ++tri)
+        {
+            intersectTriangle(objectOrigin, objectDir, triRecords[tri], tri, instance, minR, hit, minBary);
+        }
+    }
+    
+    return hit;
 }
 
-float comb(float a, float b, float c, vec3 m)
+//Helper invocations take part in subgroup operations but drop their atomics, so the lowest other lane issues them
+bool countingLane()
 {
-    return a * m.x + b * m.y + c * m.z;
+    return gl_SubgroupInvocationID == subgroupBallotFindLSB(subgroupBallot(!gl_HelperInvocation));
 }
 
-bool intersect(vec3 origin, vec3 direction, StorageVertex tri[3], out float r, out vec3 bary)
+/*Same tickets as an atomicAdd of 1 per lane, handed out in lane order from one atomicAdd
+  of the subgroup's total, so the budget check is unchanged*/
+uint requestRay()
 {
-    vec3 e1 = tri[1].positionU.xyz - tri[0].positionU.xyz; 
-    vec3 e2 = tri[2].positionU.xyz - tri[0].positionU.xyz;
-    vec3 p = cross(direction, e2);
-    float det = dot(e1, p);
-    if(abs(det) < EPSILON)
-    {
-        bary = vec3(0, 0, 0);
-        return false;
-    }
+    uvec4 lanes = subgroupBallot(!gl_HelperInvocation);
+    uint first = 0;
     
-    float invDet = 1/det;
+    if(countingLane()) first = atomicAdd(raysRequested, subgroupBallotBitCount(lanes));
     
-    vec3 t = origin - tri[0].positionU.xyz;
-    vec3 q = cross(t, e1);
+    return subgroupAdd(first) + subgroupBallotExclusiveBitCount(lanes);
+}
+
+vec3 environmentColor(vec3 dir, float roughness)
+{
+    return textureLod(environment, dir, roughness * float(textureQueryLevels(environment) - 1)).xyz;
+}
+
+vec3 toScreen(vec4 clip)
+{
+    return vec3((clip.xy / clip.w * 0.5 + 0.5) * vec2(width, height), clip.z / clip.w);
+}
+
+/*Marches the ray across the depth buffer in screenSpaceSteps even steps up to the distance
+  from the camera to the origin.  The first step that ends behind the depth buffer is a hit
+  when the G-buffer surface there is front facing and within one step of the ray.  Rays that
+  leave the screen, pass behind a surface without matching it or run out of steps return
+  false and trace the triangles instead.*/
+bool screenSpaceTrace(vec3 origin, vec3 dir, out ivec2 hitCoord)
+{
+    float rayLength = min(distance(cameraPosition, origin), maxDistance);
+    vec4 startClip = viewProj * vec4(origin, 1);
+    vec4 endClip = viewProj * vec4(origin + dir * rayLength, 1);
     
-    bary.y = dot(t, p) * invDet;
-    bary.z = dot(direction, q) * invDet;
-    bary.x = 1 - bary.y - bary.z;
+    if(endClip.w < SCREEN_SPACE_NEAR)
+    {
+        rayLength *= (startClip.w - SCREEN_SPACE_NEAR) / (startClip.w - endClip.w);
+        endClip = viewProj * vec4(origin + dir * rayLength, 1);
+    }
     
-    r = dot(e2, q) * invDet;
+    vec3 start = toScreen(startClip);
+    vec3 end = toScreen(endClip);
+    ivec2 startCoord = ivec2(start.xy);
+    float prevT = 0;
+    hitCoord = ivec2(-1);
+    
+    for(uint i = 1; i <= screenSpaceSteps; ++i)
+    {
+        float s = float(i) / float(screenSpaceSteps);
+        vec3 p = mix(start, end, s);
+        
+        if(any(lessThan(p.xy, vec2(0))) || any(greaterThanEqual(p.xy, vec2(width, height)))) return false;
+        
+        ivec2 coord = ivec2(p.xy);
+        
+        //Screen space is linear in 1/w, so the distance along the ray is interpolated through it
+        float t = s * rayLength / endClip.w / mix(1 / startClip.w, 1 / endClip.w, s);
+        float stepLength = t - prevT;
+        prevT = t;
+        
+        if(coord == startCoord || p.z <= texelFetch(gBuffer[0], coord, 0).x) continue;
+        
+        vec4 scenePos = texelFetch(gBuffer[2], coord, 0);
+        vec2 sceneNorm = texelFetch(gBuffer[3], coord, 0).xy;
+        
+        if(distance(scenePos.xyz, origin + dir * t) > stepLength) return false;
+        if(dot(vec3(sceneNorm.x, scenePos.w, sceneNorm.y), dir) >= 0) return false;
+        
+        hitCoord = coord;
+        return true;
+    }
     
-    return r > EPSILON && bary.x >= 0 && bary.y >= 0 && bary.z >= 0;
+    return false;
 }
 
 void main()
 {
+    vec4 norm = subpassLoad(nXZ);
     vec4 pos = subpassLoad(posNY);
-    vec2 norm = subpassLoad(nXZ).xy;
     vec4 loadedColor = subpassLoad(inColor);
     vec3 worldPos = pos.xyz;
     vec3 worldNorm = vec3(norm.x, pos.w, norm.y);
+    float reflectivity = norm.z;
     vec3 l = normalize(cameraPosition - worldPos);
     
-    
-    vec4 castColor = loadedColor;
-    
-    StorageVertex triVerts[3];
-    
     if(loadedColor.xyz == vec3(0) && worldPos == vec3(0) && worldNorm == vec3(0))
     {
         discard;
         return;
     }
     
+    //Diffuse and back facing pixels are shaded before any ray state is set up
     vec3 rayDir = normalize(worldPos - cameraPosition);
-    if(dot(rayDir, worldNorm) > 0)
+    if(reflectivity <= 0 || dot(rayDir, worldNorm) > 0)
     {
         color = vec4(max(dot(worldNorm, l), 0.0f) * loadedColor.xyz, 1);
         return;
     }
     
-    vec3 refDir = reflect(rayDir, worldNorm);
+    uvec2 pixel = uvec2(gl_FragCoord.xy);
+    vec3 origin = worldPos;
+    vec3 refDir = glossyReflect(rayDir, worldNorm, norm.w, pixel, frame * 8u);
+    uvec2 tileCoord = pixel / TILE_SIZE;
+    uint tile = tileCoord.y * ((width + TILE_SIZE - 1) / TILE_SIZE) + tileCoord.x;
+    uvec2 tileRange = tileRanges[tile];
     
-    vec3 bary;
-    vec3 minBary;
-    float minR = 100000;
-    float r;
-    int idx = -1;
-    vec3 avgNormal;
+    //Every surface keeps 1 - reflectivity of its own color and reflects the rest, a miss reflects the environment
+    vec3 reflected = vec3(0);
+    vec3 surfaceColor = loadedColor.xyz;
+    float weight = 1;
+    float roughness = norm.w;
     
-    for(int i = 0; i < numTris; ++i)
+    //Traced, screen space and traversed rays of this pixel, added to RayStats once per subgroup after the loop
+    uvec3 rayCounts = uvec3(0);
+    
+    for(uint bounce = 0; bounce < bounceDepth; ++bounce)
     {
-        triVerts[0] = verts[tris[i].verts[0]];
-        triVerts[1] = verts[tris[i].verts[1]];
-        triVerts[2] = verts[tris[i].verts[2]];
+        //The budget only drops bounces after the first reflection
+        if(requestRay() >= rayBudget && bounce > 0) break;
+        ++rayCounts.x;
+        
+        vec3 hitPos;
+        vec3 hitNormal;
+        vec3 hitColor;
+        vec2 hitMaterial;
+        ivec2 hitCoord;
         
-        if(intersect(worldPos, refDir, triVerts, r, bary) && r < minR)
+        //Surfaces already on screen are read from the G-buffer
+        if(screenSpaceSteps > 0 && screenSpaceTrace(origin, refDir, hitCoord))
+        {
+            ++rayCounts.y;
+            
+            vec4 hitPosNY = texelFetch(gBuffer[2], hitCoord, 0);
+            vec4 hitNXZ = texelFetch(gBuffer[3], hitCoord, 0);
+            hitPos = hitPosNY.xyz;
+            hitNormal = vec3(hitNXZ.x, hitPosNY.w, hitNXZ.y);
+            hitColor = texelFetch(gBuffer[1], hitCoord, 0).xyz;
+            hitMaterial = hitNXZ.zw;
+        }
+        else
         {
-            avgNormal = comb(triVerts[0].normalV.xyz, triVerts[1].normalV.xyz, triVerts[2].normalV.xyz, vec3(0.333));
-            if(dot(avgNormal, refDir) < 0)
+            ++rayCounts.z;
+            
+            vec3 minBary;
+            float minR = maxDistance;
+            
+            //Tile lists only hold the leaves reachable by the first reflection
+            ivec2 hit = bounce > 0 || tileRange.y == TILE_OVERFLOW ?
+                traceClosest(origin, refDir, minR, minBary) :
+                traceTile(tileRange, origin, refDir, minR, minBary);
+            
+            //Rays cut off at maxDistance end the path like misses
+            if(hit.x < 0)
             {
-                idx = i;
-                minR = r;
-                minBary = bary;
+                reflected += weight * (1 - reflectivity) * surfaceColor;
+                weight *= reflectivity;
+                surfaceColor = environmentColor(refDir, roughness);
+                break;
             }
+            
+            vec2 texUV;
+            hitAttributes(hit, minBary, texUV, hitNormal);
+            hitPos = origin + refDir * minR;
+            hitColor = texture(textures[hitTexture(hit)], texUV).xyz;
+            hitMaterial = vec2(instances[hit.y].reflectivity, instances[hit.y].roughness);
         }
+        
+        float nDotL = max(dot(hitNormal, l), 0);
+        nDotL = max(nDotL, -dot(hitNormal, refDir));
+        
+        reflected += weight * (1 - reflectivity) * surfaceColor;
+        weight *= reflectivity;
+        surfaceColor = nDotL * hitColor;
+        reflectivity = hitMaterial.x;
+        
+        //A diffuse hit ends the path like a miss
+        if(reflectivity <= 0) break;
+        
+        origin = hitPos;
+        roughness = hitMaterial.y;
+        refDir = glossyReflect(refDir, hitNormal, roughness, pixel, frame * 8u + bounce + 1);
     }
     
-    int hitTex;
-    vec2 texCoord;
-    vec2 texUV;
-    vec3 hitNormal;
-    float nDotL;
+    uvec3 subgroupCounts = subgroupAdd(gl_HelperInvocation ? uvec3(0) : rayCounts);
     
-    if(idx > 0)
+    if(countingLane() && subgroupCounts.x > 0)
     {
-        triVerts[0] = verts[tris[idx].verts[0]];
-        triVerts[1] = verts[tris[idx].verts[1]];
-        triVerts[2] = verts[tris[idx].verts[2]];
-        hitTex = triVerts[0].textureUnit.x;
-        texUV.x = comb(triVerts[0].positionU.w, triVerts[1].positionU.w, triVerts[2].positionU.w, minBary);
-        texUV.y = comb(triVerts[0].normalV.w, triVerts[1].normalV.w, triVerts[2].normalV.w, minBary);
-        hitNormal = normalize(comb(triVerts[0].normalV.xyz, triVerts[1].normalV.xyz, triVerts[2].normalV.xyz, bary));
-        nDotL = max(dot(hitNormal, l), 0);
-        nDotL = max(nDotL, -dot(hitNormal, refDir));
-        castColor = nDotL * vec4(texture(textures[hitTex], texUV).xyz, 1);
+        atomicAdd(raysTraced, subgroupCounts.x);
+        atomicAdd(raysScreenSpace, subgroupCounts.y);
+        atomicAdd(raysTraversed, subgroupCounts.z);
     }
-    nDotL = max(dot(worldNorm, l), 0.0f);
-    color = nDotL * mix(loadedColor, castColor, 0.5);
-    color.w = 1;
+    
+    reflected += weight * surfaceColor;
+    color = vec4(max(dot(worldNorm, l), 0.0f) * reflected, 1);
 }
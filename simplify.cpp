@@ -0,0 +1,310 @@
+#include "simplify.hpp"
+
+#include <stdint.h>
+#include <algorithm>
+#include <map>
+#include <queue>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "vertex.hpp"
+
+/*Weight of the plane through an open edge perpendicular to its triangle*/
+#define SIMPLIFY_BOUNDARY_WEIGHT 100.0
+/*Smallest cosine between a triangle's normal before and after a collapse*/
+#define SIMPLIFY_MIN_NORMAL_COS 0.2f
+
+/*Symmetric 4x4 error quadric, the upper triangle row by row*/
+typedef struct
+{
+    double q[10];
+}
+Quadric;
+
+typedef struct
+{
+    double cost;
+    uint32_t from;
+    uint32_t to;
+    uint32_t fromVersion;
+    uint32_t toVersion;
+}
+Collapse;
+
+struct CollapseOrder
+{
+    bool operator()(const Collapse& a, const Collapse& b) const
+    {
+        return a.cost > b.cost;
+    }
+};
+
+static inline void addPlane(Quadric* quadric, glm::dvec3 n, double d, double weight)
+{
+    double plane[4] = {n.x, n.y, n.z, d};
+    uint32_t k = 0;
+    
+    for(uint32_t i = 0; i < 4; ++i)
+    {
+        for(uint32_t j = i; j < 4; ++j)
+        {
+            quadric->q[k++] += weight * plane[i] * plane[j];
+        }
+    }
+}
+
+static inline double quadricError(const Quadric* quadric, glm::vec3 p)
+{
+    double v[4] = {p.x, p.y, p.z, 1.0};
+    double error = 0;
+    uint32_t k = 0;
+    
+    for(uint32_t i = 0; i < 4; ++i)
+    {
+        for(uint32_t j = i; j < 4; ++j)
+        {
+            error += (i == j ? 1.0 : 2.0) * quadric->q[k++] * v[i] * v[j];
+        }
+    }
+    
+    return std::max(error, 0.0);
+}
+
+static inline glm::vec3 faceNormal(glm::vec3 a, glm::vec3 b, glm::vec3 c)
+{
+    return glm::cross(b - a, c - a);
+}
+
+uint32_t simplifyMesh(const Vertex* vertices, uint32_t numVertices, const uint32_t* indices, uint32_t numTris,
+    uint32_t targetTris, uint32_t* outIndices)
+{
+    std::map<std::pair<std::pair<float, float>, float>, uint32_t> positions;
+    std::vector<uint32_t> canon(numVertices);
+    std::vector<std::vector<uint32_t> > copies(numVertices);
+    std::vector<std::vector<uint32_t> > vertexTris(numVertices);
+    std::vector<Quadric> quadrics(numVertices);
+    std::vector<uint32_t> versions(numVertices, 0);
+    std::vector<bool> removed(numVertices, false);
+    std::vector<bool> liveTris(numTris, true);
+    std::vector<uint32_t> corners(indices, indices + 3 * numTris);
+    std::map<std::pair<uint32_t, uint32_t>, uint32_t> edgeUses;
+    std::priority_queue<Collapse, std::vector<Collapse>, CollapseOrder> heap;
+    uint32_t numLive = numTris;
+    uint32_t numOut = 0;
+    
+    /*Seams split vertices by normal or texture coordinates, welding them keeps the surface closed*/
+    for(uint32_t i = 0; i < numVertices; ++i)
+    {
+        glm::vec3 p = glm::vec3(vertices[i].position);
+        std::pair<std::map<std::pair<std::pair<float, float>, float>, uint32_t>::iterator, bool> inserted =
+            positions.insert(std::make_pair(std::make_pair(std::make_pair(p.x, p.y), p.z), i));
+        
+        canon[i] = inserted.first->second;
+        copies[canon[i]].push_back(i);
+        quadrics[i] = {};
+    }
+    
+    for(uint32_t t = 0; t < numTris; ++t)
+    {
+        uint32_t c[3] = {canon[corners[3 * t]], canon[corners[3 * t + 1]], canon[corners[3 * t + 2]]};
+        glm::dvec3 p[3];
+        
+        for(uint32_t k = 0; k < 3; ++k)
+        {
+            p[k] = glm::dvec3(glm::vec3(vertices[c[k]].position));
+        }
+        
+        glm::dvec3 n = glm::cross(p[1] - p[0], p[2] - p[0]);
+        double area = glm::length(n);
+        
+        if(area > 0) n /= area;
+        
+        for(uint32_t k = 0; k < 3; ++k)
+        {
+            addPlane(&quadrics[c[k]], n, -glm::dot(n, p[0]), area);
+            vertexTris[c[k]].push_back(t);
+            ++edgeUses[std::make_pair(std::min(c[k], c[(k + 1) % 3]), std::max(c[k], c[(k + 1) % 3]))];
+        }
+    }
+    
+    for(uint32_t t = 0; t < numTris; ++t)
+    {
+        uint32_t c[3] = {canon[corners[3 * t]], canon[corners[3 * t + 1]], canon[corners[3 * t + 2]]};
+        glm::dvec3 n = glm::cross(glm::dvec3(glm::vec3(vertices[c[1]].position - vertices[c[0]].position)),
+            glm::dvec3(glm::vec3(vertices[c[2]].position - vertices[c[0]].position)));
+        
+        for(uint32_t k = 0; k < 3; ++k)
+        {
+            uint32_t a = c[k];
+            uint32_t b = c[(k + 1) % 3];
+            
+            if(edgeUses[std::make_pair(std::min(a, b), std::max(a, b))] != 1) continue;
+            
+            glm::dvec3 pa = glm::dvec3(glm::vec3(vertices[a].position));
+            glm::dvec3 edge = glm::dvec3(glm::vec3(vertices[b].position)) - pa;
+            glm::dvec3 side = glm::cross(edge, n);
+            double length = glm::length(side);
+            
+            if(length <= 0) continue;
+            
+            side /= length;
+            addPlane(&quadrics[a], side, -glm::dot(side, pa), SIMPLIFY_BOUNDARY_WEIGHT * glm::dot(edge, edge));
+            addPlane(&quadrics[b], side, -glm::dot(side, pa), SIMPLIFY_BOUNDARY_WEIGHT * glm::dot(edge, edge));
+        }
+    }
+    
+    for(uint32_t t = 0; t < numTris; ++t)
+    {
+        for(uint32_t k = 0; k < 3; ++k)
+        {
+            uint32_t a = canon[corners[3 * t + k]];
+            uint32_t b = canon[corners[3 * t + (k + 1) % 3]];
+            Quadric sum;
+            
+            for(uint32_t i = 0; i < 10; ++i) sum.q[i] = quadrics[a].q[i] + quadrics[b].q[i];
+            
+            heap.push({quadricError(&sum, glm::vec3(vertices[b].position)), a, b, 0, 0});
+            heap.push({quadricError(&sum, glm::vec3(vertices[a].position)), b, a, 0, 0});
+        }
+    }
+    
+    while(numLive > targetTris && !heap.empty())
+    {
+        Collapse collapse = heap.top();
+        uint32_t from = collapse.from;
+        uint32_t to = collapse.to;
+        glm::vec3 target = glm::vec3(vertices[to].position);
+        bool valid = true;
+        
+        heap.pop();
+        
+        if(removed[from] || removed[to] || collapse.fromVersion != versions[from] || collapse.toVersion != versions[to]) continue;
+        
+        /*Moving from onto to must not turn any of the triangles that survive around*/
+        for(uint32_t i = 0; i < vertexTris[from].size() && valid; ++i)
+        {
+            uint32_t t = vertexTris[from][i];
+            glm::vec3 before[3];
+            glm::vec3 after[3];
+            bool hasTo = false;
+            
+            if(!liveTris[t]) continue;
+            
+            for(uint32_t k = 0; k < 3; ++k)
+            {
+                uint32_t c = canon[corners[3 * t + k]];
+                
+                before[k] = glm::vec3(vertices[c].position);
+                after[k] = c == from ? target : before[k];
+                hasTo |= c == to;
+            }
+            
+            if(hasTo) continue;
+            
+            glm::vec3 nBefore = faceNormal(before[0], before[1], before[2]);
+            glm::vec3 nAfter = faceNormal(after[0], after[1], after[2]);
+            float lengths = glm::length(nBefore) * glm::length(nAfter);
+            
+            valid = lengths > 0 && glm::dot(nBefore, nAfter) > SIMPLIFY_MIN_NORMAL_COS * lengths;
+        }
+        
+        if(!valid) continue;
+        
+        for(uint32_t i = 0; i < vertexTris[from].size(); ++i)
+        {
+            uint32_t t = vertexTris[from][i];
+            bool hasTo = false;
+            
+            if(!liveTris[t]) continue;
+            
+            for(uint32_t k = 0; k < 3; ++k)
+            {
+                hasTo |= canon[corners[3 * t + k]] == to;
+            }
+            
+            if(hasTo)
+            {
+                liveTris[t] = false;
+                --numLive;
+                continue;
+            }
+            
+            for(uint32_t k = 0; k < 3; ++k)
+            {
+                uint32_t* corner = &corners[3 * t + k];
+                glm::vec3 normal = glm::vec3(vertices[*corner].normal);
+                uint32_t best = to;
+                float bestCos = -2.0f;
+                
+                if(canon[*corner] != from) continue;
+                
+                for(uint32_t j = 0; j < copies[to].size(); ++j)
+                {
+                    float cosine = glm::dot(normal, glm::vec3(vertices[copies[to][j]].normal));
+                    
+                    if(cosine > bestCos)
+                    {
+                        best = copies[to][j];
+                        bestCos = cosine;
+                    }
+                }
+                
+                *corner = best;
+            }
+            
+            vertexTris[to].push_back(t);
+        }
+        
+        for(uint32_t i = 0; i < 10; ++i) quadrics[to].q[i] += quadrics[from].q[i];
+        
+        removed[from] = true;
+        vertexTris[from].clear();
+        
+        /*Every edge around to changed its cost, stale entries are skipped by their versions*/
+        ++versions[to];
+        
+        for(uint32_t i = 0; i < vertexTris[to].size(); ++i)
+        {
+            uint32_t t = vertexTris[to][i];
+            
+            if(!liveTris[t]) continue;
+            
+            for(uint32_t k = 0; k < 3; ++k)
+            {
+                uint32_t c = canon[corners[3 * t + k]];
+                if(c != to) ++versions[c];
+            }
+        }
+        
+        for(uint32_t i = 0; i < vertexTris[to].size(); ++i)
+        {
+            uint32_t t = vertexTris[to][i];
+            
+            if(!liveTris[t]) continue;
+            
+            for(uint32_t k = 0; k < 3; ++k)
+            {
+                uint32_t a = canon[corners[3 * t + k]];
+                uint32_t b = canon[corners[3 * t + (k + 1) % 3]];
+                Quadric sum;
+                
+                for(uint32_t j = 0; j < 10; ++j) sum.q[j] = quadrics[a].q[j] + quadrics[b].q[j];
+                
+                heap.push({quadricError(&sum, glm::vec3(vertices[b].position)), a, b, versions[a], versions[b]});
+                heap.push({quadricError(&sum, glm::vec3(vertices[a].position)), b, a, versions[b], versions[a]});
+            }
+        }
+    }
+    
+    for(uint32_t t = 0; t < numTris; ++t)
+    {
+        if(!liveTris[t]) continue;
+        
+        outIndices[3 * numOut] = corners[3 * t];
+        outIndices[3 * numOut + 1] = corners[3 * t + 1];
+        outIndices[3 * numOut + 2] = corners[3 * t + 2];
+        ++numOut;
+    }
+    
+    return numOut;
+}
@@ -0,0 +1,21 @@
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include <stdint.h>
+
+#include "vertex.hpp"
+
+/*Reduces the triangles in indices to at most targetTris by collapsing edges in order of their
+  quadric error and writes the remaining triangles to outIndices, which needs room for
+  3 * numTris indices.  Returns the number of triangles written, which stays above
+  targetTris when no further collapse is allowed.
+
+  Every collapse moves one vertex onto a neighbour, so the result only indexes existing
+  vertices and can share the vertex buffer of the full mesh.  Vertices at the same position
+  are welded while simplifying, a corner moved across an attribute seam takes the copy of
+  the target whose normal is closest to its own.  Collapses that would flip a triangle are
+  rejected and open edges are weighted to stay in place.*/
+uint32_t simplifyMesh(const Vertex* vertices, uint32_t numVertices, const uint32_t* indices, uint32_t numTris,
+    uint32_t targetTris, uint32_t* outIndices);
+
+#endif //SIMPLIFY_H
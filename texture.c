@@ -2,6 +2,7 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <vulkan/vulkan.h>
 
@@ -30,6 +31,7 @@ int32_t textureCreate(Texture* texture, Context* context, void* data, int width,
     uint32_t memoryTypeBits;
     VkMemoryPropertyFlags desiredFlags = {VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT};
     VkResult result;
+    uint32_t familyIndices[3];
     
     textureInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
     textureInfo.imageType = VK_IMAGE_TYPE_2D;
@@ -42,6 +44,9 @@ int32_t textureCreate(Texture* texture, Context* context, void* data, int width,
     textureInfo.samples = VK_SAMPLE_COUNT_1_BIT;
     textureInfo.tiling = VK_IMAGE_TILING_LINEAR;
     textureInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT;
+    textureInfo.sharingMode = getSharingMode(context);
+    textureInfo.queueFamilyIndexCount = getFamilies(context, familyIndices);
+    textureInfo.pQueueFamilyIndices = familyIndices;
     textureInfo.initialLayout = VK_IMAGE_LAYOUT_PREINITIALIZED;
     
     result = vkCreateImage(context->device, &textureInfo, NULL, &texture->_image);
@@ -208,3 +213,277 @@ void textureDestroy(Texture* texture, Context* context)
     texture->_memory = VK_NULL_HANDLE;
     texture->_image = VK_NULL_HANDLE;
 }
+
+static inline int32_t findMemoryType(Context* context, uint32_t memoryTypeBits, VkMemoryPropertyFlags desiredFlags)
+{
+    for(int i = 0; i < 32; ++i)
+    {
+        VkMemoryType memoryType = context->physicalDeviceMemory.memoryTypes[i];
+        if(memoryTypeBits & 1 && (memoryType.propertyFlags & desiredFlags) == desiredFlags) return i;
+        
+        memoryTypeBits >>= 1;
+    }
+    
+    return -1;
+}
+
+/*Each level is the 2x2 box filtered previous one, so a level covers twice the solid angle per
+  texel of the one before.  This stands in for a cone filter of the environment.*/
+static inline void downsampleFace(const uint8_t* src, uint8_t* dst, uint32_t dstSize)
+{
+    uint32_t srcSize = dstSize * 2;
+    
+    for(uint32_t y = 0; y < dstSize; ++y)
+    {
+        for(uint32_t x = 0; x < dstSize; ++x)
+        {
+            const uint8_t* s = &src[4 * (2 * y * srcSize + 2 * x)];
+            
+            for(uint32_t c = 0; c < 4; ++c)
+            {
+                uint32_t sum = s[c] + s[4 + c] + s[4 * srcSize + c] + s[4 * srcSize + 4 + c];
+                dst[4 * (y * dstSize + x) + c] = (uint8_t)((sum + 2) / 4);
+            }
+        }
+    }
+}
+
+int32_t textureCreateCube(Texture* texture, Context* context, void** faces, int size)
+{
+    VkBufferCreateInfo stagingInfo = {};
+    VkImageCreateInfo textureInfo = {};
+    VkMemoryRequirements memoryReqs = {};
+    VkMemoryAllocateInfo allocInfo = {};
+    VkBuffer staging;
+    VkDeviceMemory stagingMemory;
+    VkBufferImageCopy* regions;
+    uint8_t* mapped;
+    VkCommandBufferBeginInfo beginInfo = {};
+    VkImageMemoryBarrier layoutBarrier = {};
+    VkSubmitInfo submitInfo = {};
+    VkImageViewCreateInfo viewInfo = {};
+    VkFence fence;
+    VkFenceCreateInfo fenceInfo = {};
+    VkSamplerCreateInfo samplerInfo = {};
+    VkResult result;
+    uint32_t familyIndices[3];
+    uint32_t mipLevels = 1;
+    VkDeviceSize faceSize = 0;
+    VkDeviceSize offset = 0;
+    int32_t memoryType;
+    
+    while((size >> mipLevels) > 0) ++mipLevels;
+    
+    for(uint32_t level = 0; level < mipLevels; ++level)
+    {
+        uint32_t levelSize = size >> level;
+        faceSize += levelSize * levelSize * 4;
+    }
+    
+    stagingInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    stagingInfo.size = 6 * faceSize;
+    stagingInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    stagingInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    
+    result = vkCreateBuffer(context->device, &stagingInfo, NULL, &staging);
+    if(result != VK_SUCCESS) return -1;
+    
+    vkGetBufferMemoryRequirements(context->device, staging, &memoryReqs);
+    memoryType = findMemoryType(context, memoryReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    if(memoryType < 0) return -2;
+    
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = memoryReqs.size;
+    allocInfo.memoryTypeIndex = memoryType;
+    
+    result = vkAllocateMemory(context->device, &allocInfo, NULL, &stagingMemory);
+    if(result != VK_SUCCESS) return -2;
+    
+    result = vkBindBufferMemory(context->device, staging, stagingMemory, 0);
+    if(result != VK_SUCCESS) return -3;
+    
+    result = vkMapMemory(context->device, stagingMemory, 0, VK_WHOLE_SIZE, 0, (void**)&mapped);
+    if(result != VK_SUCCESS) return -4;
+    
+    regions = (VkBufferImageCopy*)malloc(6 * mipLevels * sizeof(VkBufferImageCopy));
+    
+    /*Faces are +X, -X, +Y, -Y, +Z, -Z with every face's mip chain stored together*/
+    for(uint32_t face = 0; face < 6; ++face)
+    {
+        memcpy(&mapped[offset], faces[face], size * size * 4);
+        
+        for(uint32_t level = 0; level < mipLevels; ++level)
+        {
+            uint32_t levelSize = size >> level;
+            VkBufferImageCopy* region = &regions[face * mipLevels + level];
+            
+            if(level > 0) downsampleFace(&mapped[offset - 4 * levelSize * levelSize * 4], &mapped[offset], levelSize);
+            
+            region->bufferOffset = offset;
+            region->bufferRowLength = 0;
+            region->bufferImageHeight = 0;
+            region->imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            region->imageSubresource.mipLevel = level;
+            region->imageSubresource.baseArrayLayer = face;
+            region->imageSubresource.layerCount = 1;
+            region->imageOffset.x = 0;
+            region->imageOffset.y = 0;
+            region->imageOffset.z = 0;
+            region->imageExtent.width = levelSize;
+            region->imageExtent.height = levelSize;
+            region->imageExtent.depth = 1;
+            
+            offset += levelSize * levelSize * 4;
+        }
+    }
+    
+    vkUnmapMemory(context->device, stagingMemory);
+    
+    textureInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    textureInfo.flags = VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT;
+    textureInfo.imageType = VK_IMAGE_TYPE_2D;
+    textureInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+    textureInfo.extent.width = size;
+    textureInfo.extent.height = size;
+    textureInfo.extent.depth = 1;
+    textureInfo.mipLevels = mipLevels;
+    textureInfo.arrayLayers = 6;
+    textureInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    textureInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    textureInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    textureInfo.sharingMode = getSharingMode(context);
+    textureInfo.queueFamilyIndexCount = getFamilies(context, familyIndices);
+    textureInfo.pQueueFamilyIndices = familyIndices;
+    textureInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    
+    result = vkCreateImage(context->device, &textureInfo, NULL, &texture->_image);
+    if(result != VK_SUCCESS) return -5;
+    
+    vkGetImageMemoryRequirements(context->device, texture->_image, &memoryReqs);
+    memoryType = findMemoryType(context, memoryReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    if(memoryType < 0) return -6;
+    
+    allocInfo.allocationSize = memoryReqs.size;
+    allocInfo.memoryTypeIndex = memoryType;
+    
+    result = vkAllocateMemory(context->device, &allocInfo, NULL, &texture->_memory);
+    if(result != VK_SUCCESS) return -6;
+    
+    result = vkBindImageMemory(context->device, texture->_image, texture->_memory, 0);
+    if(result != VK_SUCCESS) return -7;
+    
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    
+    layoutBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    layoutBarrier.srcAccessMask = 0;
+    layoutBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    layoutBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    layoutBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    layoutBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    layoutBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    layoutBarrier.image = texture->_image;
+    layoutBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    layoutBarrier.subresourceRange.baseMipLevel = 0;
+    layoutBarrier.subresourceRange.levelCount = mipLevels;
+    layoutBarrier.subresourceRange.baseArrayLayer = 0;
+    layoutBarrier.subresourceRange.layerCount = 6;
+    
+    vkBeginCommandBuffer(context->setupCmdBuffer, &beginInfo);
+    vkCmdPipelineBarrier(context->setupCmdBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &layoutBarrier);
+    
+    vkCmdCopyBufferToImage(context->setupCmdBuffer, staging, texture->_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        6 * mipLevels, regions);
+    
+    layoutBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    layoutBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    layoutBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    layoutBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    
+    vkCmdPipelineBarrier(context->setupCmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, 1, &layoutBarrier);
+    
+    vkEndCommandBuffer(context->setupCmdBuffer);
+    
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    result = vkCreateFence(context->device, &fenceInfo, NULL, &fence);
+    if(result != VK_SUCCESS) return -8;
+    
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &context->setupCmdBuffer;
+    
+    result = vkQueueSubmit(context->gfxQueue, 1, &submitInfo, fence);
+    if(result != VK_SUCCESS) return -9;
+    
+    vkWaitForFences(context->device, 1, &fence, VK_TRUE, 0xffffffffffffffff);
+    vkResetCommandBuffer(context->setupCmdBuffer, 0);
+    vkDestroyFence(context->device, fence, NULL);
+    
+    free(regions);
+    vkDestroyBuffer(context->device, staging, NULL);
+    vkFreeMemory(context->device, stagingMemory, NULL);
+    
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = texture->_image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_CUBE;
+    viewInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+    viewInfo.components.r = VK_COMPONENT_SWIZZLE_R;
+    viewInfo.components.g = VK_COMPONENT_SWIZZLE_G;
+    viewInfo.components.b = VK_COMPONENT_SWIZZLE_B;
+    viewInfo.components.a = VK_COMPONENT_SWIZZLE_A;
+    viewInfo.subresourceRange = layoutBarrier.subresourceRange;
+    
+    result = vkCreateImageView(context->device, &viewInfo, NULL, &texture->_view);
+    if(result != VK_SUCCESS) return -10;
+    
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = VK_FILTER_LINEAR;
+    samplerInfo.minFilter = VK_FILTER_LINEAR;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.mipLodBias = 0;
+    samplerInfo.minLod = 0;
+    samplerInfo.maxLod = (float)mipLevels;
+    samplerInfo.anisotropyEnable = VK_FALSE;
+    samplerInfo.maxAnisotropy = 1.0f;
+    samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK;
+    samplerInfo.unnormalizedCoordinates = VK_FALSE;
+    
+    result = vkCreateSampler(context->device, &samplerInfo, NULL, &texture->sampler);
+    if(result != VK_SUCCESS) return -11;
+    
+    return 0;
+}
+
+int32_t textureCreateCubeFromFiles(Texture* texture, Context* context, const char* const* files)
+{
+    int32_t width, height, nc, res = 0;
+    int32_t size = 0;
+    uint8_t* data[6] = {};
+    
+    for(uint32_t face = 0; face < 6; ++face)
+    {
+        data[face] = stbi_load(files[face], &width, &height, &nc, 4);
+        
+        if(data[face] == NULL || width != height || (width & (width - 1)) || (face > 0 && width != size))
+        {
+            res = -12;
+            break;
+        }
+        
+        size = width;
+    }
+    
+    if(!res) res = textureCreateCube(texture, context, (void**)data, size);
+    
+    for(uint32_t face = 0; face < 6; ++face)
+    {
+        if(data[face]) stbi_image_free(data[face]);
+    }
+    
+    return res;
+}
@@ -25,6 +25,10 @@ Texture;
 
 int32_t textureCreate(Texture* texture, Context* context, void* data, int width, int height);
 int32_t textureCreateFromFile(Texture* texture, Context* context, const char* file);
+/*Cubemap from six square power of two RGBA faces in the order +X, -X, +Y, -Y, +Z, -Z.  The full
+  mip chain is filtered on the host so blurrier levels can stand in for rougher reflections.*/
+int32_t textureCreateCube(Texture* texture, Context* context, void** faces, int size);
+int32_t textureCreateCubeFromFiles(Texture* texture, Context* context, const char* const* files);
 
 void textureUpdateDescriptor(Texture* texture, Context* context, VkDescriptorSet descriptorSet, uint32_t index, uint32_t baseIndex);
 
@@ -0,0 +1,125 @@
+#include "threadPool.hpp"
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+static inline void runJob(ThreadPoolJob* job)
+{
+    job->func(job->data);
+    if(job->counter) job->counter->fetch_sub(1);
+}
+
+static void workerMain(ThreadPool* pool)
+{
+    ThreadPoolJob job;
+    
+    while(true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(pool->_mutex);
+            pool->_jobAvailable.wait(lock, [pool]{return pool->_stop || !pool->_jobs.empty();});
+            
+            if(pool->_jobs.empty()) return;
+            
+            job = pool->_jobs.front();
+            pool->_jobs.pop_front();
+        }
+        
+        runJob(&job);
+    }
+}
+
+int32_t threadPoolCreate(ThreadPool* pool, uint32_t numThreads)
+{
+    if(numThreads == 0)
+    {
+        numThreads = std::thread::hardware_concurrency();
+        numThreads = numThreads > 1 ? numThreads - 1 : 1;
+    }
+    
+    pool->_stop = false;
+    pool->numThreads = numThreads;
+    pool->_threads = new std::thread[numThreads];
+    if(!pool->_threads) return -1;
+    
+    for(uint32_t i = 0; i < numThreads; ++i)
+    {
+        pool->_threads[i] = std::thread(workerMain, pool);
+    }
+    
+    return 0;
+}
+
+void threadPoolSubmit(ThreadPool* pool, ThreadPoolFunc func, void* data, std::atomic<int32_t>* counter)
+{
+    ThreadPoolJob job = {func, data, counter};
+    
+    if(counter) counter->fetch_add(1);
+    
+    if(!pool)
+    {
+        runJob(&job);
+        return;
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(pool->_mutex);
+        pool->_jobs.push_back(job);
+    }
+    
+    pool->_jobAvailable.notify_one();
+}
+
+void threadPoolWait(ThreadPool* pool, std::atomic<int32_t>* counter)
+{
+    ThreadPoolJob job;
+    bool hasJob;
+    
+    while(counter->load() > 0)
+    {
+        hasJob = false;
+        
+        if(pool)
+        {
+            std::lock_guard<std::mutex> lock(pool->_mutex);
+            if(!pool->_jobs.empty())
+            {
+                job = pool->_jobs.back();
+                pool->_jobs.pop_back();
+                hasJob = true;
+            }
+        }
+        
+        if(hasJob)
+        {
+            runJob(&job);
+        }
+        else
+        {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void threadPoolDestroy(ThreadPool* pool)
+{
+    {
+        std::lock_guard<std::mutex> lock(pool->_mutex);
+        pool->_stop = true;
+    }
+    
+    pool->_jobAvailable.notify_all();
+    
+    for(uint32_t i = 0; i < pool->numThreads; ++i)
+    {
+        pool->_threads[i].join();
+    }
+    
+    delete[] pool->_threads;
+    pool->_threads = NULL;
+    pool->numThreads = 0;
+}
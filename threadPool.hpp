@@ -0,0 +1,40 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+typedef void (*ThreadPoolFunc)(void* data);
+
+typedef struct
+{
+    ThreadPoolFunc func;
+    void* data;
+    std::atomic<int32_t>* counter;
+}
+ThreadPoolJob;
+
+/*Jobs are fire and forget.  Anything that has to wait on a batch of jobs passes the same
+  counter to threadPoolSubmit and threadPoolWait.  Waiting threads run queued jobs instead
+  of blocking, so jobs may submit and wait on jobs of their own.*/
+typedef struct
+{
+    std::thread* _threads;
+    uint32_t numThreads;
+    std::mutex _mutex;
+    std::condition_variable _jobAvailable;
+    std::deque<ThreadPoolJob> _jobs;
+    bool _stop;
+}
+ThreadPool;
+
+int32_t threadPoolCreate(ThreadPool* pool, uint32_t numThreads);
+void threadPoolSubmit(ThreadPool* pool, ThreadPoolFunc func, void* data, std::atomic<int32_t>* counter);
+void threadPoolWait(ThreadPool* pool, std::atomic<int32_t>* counter);
+void threadPoolDestroy(ThreadPool* pool);
+
+#endif //THREAD_POOL_H
@@ -0,0 +1,262 @@
+#include "tileCull.hpp"
+
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+#include "context.h"
+#include "utilMacros.h"
+
+static inline int32_t createDescriptors(TileCuller* culler, Context* context, const VkImageView* gBufferViews,
+    VkBuffer camPosBuffer, VkBuffer tileRanges, VkBuffer tileLeaves)
+{
+    VkDescriptorSetLayoutBinding bindings[8] = {};
+    VkDescriptorSetLayoutCreateInfo setLayoutInfo = {};
+    VkDescriptorPoolSize poolSizes[3] = {};
+    VkDescriptorPoolCreateInfo descriptorPoolInfo = {};
+    VkDescriptorSetAllocateInfo descriptorAllocInfo = {};
+    VkSamplerCreateInfo samplerInfo = {};
+    VkDescriptorImageInfo gBufferInfos[3] = {};
+    VkDescriptorBufferInfo camPosInfo = {};
+    VkDescriptorBufferInfo tileInfos[4] = {};
+    VkWriteDescriptorSet writeDescriptors[3] = {};
+    VkResult result;
+    
+    /*G-buffer color, position and normal, camera position, the scan and total of the leaf counts and the tile ranges and leaves*/
+    for(int32_t i = 0; i < LENGTH_OF(bindings); ++i)
+    {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = i < 3 ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+    
+    bindings[3].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    
+    setLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    setLayoutInfo.bindingCount = LENGTH_OF(bindings);
+    setLayoutInfo.pBindings = bindings;
+    
+    result = vkCreateDescriptorSetLayout(context->device, &setLayoutInfo, NULL, &culler->_descLayout);
+    if(result != VK_SUCCESS) return -1;
+    
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSizes[0].descriptorCount = 3;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    poolSizes[1].descriptorCount = 1;
+    poolSizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[2].descriptorCount = 4;
+    
+    descriptorPoolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descriptorPoolInfo.maxSets = 1;
+    descriptorPoolInfo.poolSizeCount = LENGTH_OF(poolSizes);
+    descriptorPoolInfo.pPoolSizes = poolSizes;
+    
+    result = vkCreateDescriptorPool(context->device, &descriptorPoolInfo, NULL, &culler->_descPool);
+    if(result != VK_SUCCESS) return -2;
+    
+    descriptorAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    descriptorAllocInfo.descriptorPool = culler->_descPool;
+    descriptorAllocInfo.descriptorSetCount = 1;
+    descriptorAllocInfo.pSetLayouts = &culler->_descLayout;
+    
+    result = vkAllocateDescriptorSets(context->device, &descriptorAllocInfo, &culler->_descSet);
+    if(result != VK_SUCCESS) return -3;
+    
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = VK_FILTER_NEAREST;
+    samplerInfo.minFilter = VK_FILTER_NEAREST;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.maxAnisotropy = 1.0f;
+    samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK;
+    samplerInfo.unnormalizedCoordinates = VK_FALSE;
+    
+    result = vkCreateSampler(context->device, &samplerInfo, NULL, &culler->_gBufferSampler);
+    if(result != VK_SUCCESS) return -4;
+    
+    for(int32_t i = 0; i < 3; ++i)
+    {
+        gBufferInfos[i].sampler = culler->_gBufferSampler;
+        gBufferInfos[i].imageView = gBufferViews[i];
+        gBufferInfos[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    }
+    
+    camPosInfo.buffer = camPosBuffer;
+    camPosInfo.offset = 0;
+    camPosInfo.range = VK_WHOLE_SIZE;
+    
+    tileInfos[0].buffer = culler->_prims->scan.buffer;
+    tileInfos[1].buffer = culler->_prims->total.buffer;
+    tileInfos[2].buffer = tileRanges;
+    tileInfos[3].buffer = tileLeaves;
+    
+    for(int32_t i = 0; i < LENGTH_OF(tileInfos); ++i)
+    {
+        tileInfos[i].offset = 0;
+        tileInfos[i].range = VK_WHOLE_SIZE;
+    }
+    
+    for(int32_t i = 0; i < LENGTH_OF(writeDescriptors); ++i)
+    {
+        writeDescriptors[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writeDescriptors[i].dstSet = culler->_descSet;
+        writeDescriptors[i].dstArrayElement = 0;
+    }
+    
+    writeDescriptors[0].dstBinding = 0;
+    writeDescriptors[0].descriptorCount = 3;
+    writeDescriptors[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    writeDescriptors[0].pImageInfo = gBufferInfos;
+    
+    writeDescriptors[1].dstBinding = 3;
+    writeDescriptors[1].descriptorCount = 1;
+    writeDescriptors[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    writeDescriptors[1].pBufferInfo = &camPosInfo;
+    
+    writeDescriptors[2].dstBinding = 4;
+    writeDescriptors[2].descriptorCount = LENGTH_OF(tileInfos);
+    writeDescriptors[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writeDescriptors[2].pBufferInfo = tileInfos;
+    
+    vkUpdateDescriptorSets(context->device, LENGTH_OF(writeDescriptors), writeDescriptors, 0, NULL);
+    
+    return 0;
+}
+
+int32_t tileCullerCreate(TileCuller* culler, Context* context, const char* src, uint32_t len, VkDescriptorSetLayout sharedLayout,
+    const uint32_t* specData, const VkImageView* gBufferViews, VkBuffer camPosBuffer, GPUPrimitives* prims,
+    VkBuffer tileRanges, VkBuffer tileLeaves)
+{
+    VkShaderModuleCreateInfo shaderInfo = {};
+    VkPipelineLayoutCreateInfo layoutInfo = {};
+    VkDescriptorSetLayout descLayouts[2] = {};
+    VkComputePipelineCreateInfo pipelineInfo = {};
+    VkSpecializationInfo specMap = {};
+    VkSpecializationMapEntry specEntries[7] = {};
+    uint32_t cullSpecData[7] = {specData[0], specData[1], specData[2], TILE_CULL_GROUP_SIZE, 0, context->width, context->height};
+    VkResult result;
+    
+    culler->_numTiles = tileCullNumTiles(context);
+    culler->_prims = prims;
+    
+    if(prims->maxElements < culler->_numTiles) return -1;
+    if(createDescriptors(culler, context, gBufferViews, camPosBuffer, tileRanges, tileLeaves)) return -1;
+    
+    shaderInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    shaderInfo.codeSize = len;
+    shaderInfo.pCode = (uint32_t*)src;
+    
+    result = vkCreateShaderModule(context->device, &shaderInfo, NULL, &culler->_shader);
+    if(result != VK_SUCCESS) return -2;
+    
+    descLayouts[0] = culler->_descLayout;
+    descLayouts[1] = sharedLayout;
+    
+    layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    layoutInfo.setLayoutCount = 2;
+    layoutInfo.pSetLayouts = descLayouts;
+    
+    result = vkCreatePipelineLayout(context->device, &layoutInfo, NULL, &culler->_pipelineLayout);
+    if(result != VK_SUCCESS) return -3;
+    
+    /*Same constant ids as wavefront.comp, 4 selects the stage*/
+    for(int32_t i = 0; i < LENGTH_OF(specEntries); ++i)
+    {
+        specEntries[i].constantID = i;
+        specEntries[i].offset = i * sizeof(uint32_t);
+        specEntries[i].size = sizeof(uint32_t);
+    }
+    
+    specMap.mapEntryCount = LENGTH_OF(specEntries);
+    specMap.pMapEntries = specEntries;
+    specMap.dataSize = sizeof(cullSpecData);
+    specMap.pData = cullSpecData;
+    
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = culler->_shader;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.stage.pSpecializationInfo = &specMap;
+    pipelineInfo.layout = culler->_pipelineLayout;
+    pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+    pipelineInfo.basePipelineIndex = 0;
+    
+    for(uint32_t i = 0; i < TILE_CULL_NUM_STAGES; ++i)
+    {
+        cullSpecData[4] = i;
+        result = vkCreateComputePipelines(context->device, VK_NULL_HANDLE, 1, &pipelineInfo, NULL, &culler->_pipelines[i]);
+        if(result != VK_SUCCESS) return -4;
+    }
+    
+    return 0;
+}
+
+void tileCullerSetLeaves(TileCuller* culler, Context* context, VkBuffer tileLeaves)
+{
+    VkDescriptorBufferInfo leafInfo = {};
+    VkWriteDescriptorSet writeDescriptor = {};
+    
+    leafInfo.buffer = tileLeaves;
+    leafInfo.offset = 0;
+    leafInfo.range = VK_WHOLE_SIZE;
+    
+    writeDescriptor.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writeDescriptor.dstSet = culler->_descSet;
+    writeDescriptor.dstBinding = 7;
+    writeDescriptor.dstArrayElement = 0;
+    writeDescriptor.descriptorCount = 1;
+    writeDescriptor.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writeDescriptor.pBufferInfo = &leafInfo;
+    
+    vkUpdateDescriptorSets(context->device, 1, &writeDescriptor, 0, NULL);
+}
+
+static inline void bindStage(TileCuller* culler, VkCommandBuffer cmdBuffer, VkDescriptorSet sharedSet, uint32_t stage)
+{
+    vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, culler->_pipelines[stage]);
+    vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+        culler->_pipelineLayout, 0, 1, &culler->_descSet, 0, NULL);
+    vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+        culler->_pipelineLayout, 1, 1, &sharedSet, 0, NULL);
+}
+
+void tileCullerRecord(TileCuller* culler, VkCommandBuffer cmdBuffer, VkDescriptorSet sharedSet)
+{
+    VkMemoryBarrier bvhBarrier = {};
+    
+    /*The instances may have just been written by the device TLAS build*/
+    bvhBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    bvhBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    bvhBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    
+    vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &bvhBarrier, 0, NULL, 0, NULL);
+    
+    bindStage(culler, cmdBuffer, sharedSet, TILE_CULL_STAGE_COUNT);
+    vkCmdDispatch(cmdBuffer, culler->_numTiles, 1, 1);
+    
+    /*The scan binds its own pipelines and set 0, so the write stage binds everything again*/
+    gpuPrimitivesRecordScan(culler->_prims, cmdBuffer, culler->_numTiles);
+    
+    bindStage(culler, cmdBuffer, sharedSet, TILE_CULL_STAGE_WRITE);
+    vkCmdDispatch(cmdBuffer, culler->_numTiles, 1, 1);
+}
+
+void tileCullerDestroy(TileCuller* culler, Context* context)
+{
+    for(uint32_t i = 0; i < TILE_CULL_NUM_STAGES; ++i)
+    {
+        vkDestroyPipeline(context->device, culler->_pipelines[i], NULL);
+    }
+    
+    vkDestroyPipelineLayout(context->device, culler->_pipelineLayout, NULL);
+    vkDestroyShaderModule(context->device, culler->_shader, NULL);
+    
+    vkResetDescriptorPool(context->device, culler->_descPool, 0);
+    vkDestroyDescriptorPool(context->device, culler->_descPool, NULL);
+    vkDestroyDescriptorSetLayout(context->device, culler->_descLayout, NULL);
+    vkDestroySampler(context->device, culler->_gBufferSampler, NULL);
+}
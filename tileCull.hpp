@@ -0,0 +1,66 @@
+#ifndef TILE_CULL_H
+#define TILE_CULL_H
+
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+#include "context.h"
+#include "gpuPrimitives.hpp"
+
+/*Must match tileCull.comp and triCast.frag*/
+#define TILE_CULL_SIZE 8
+#define TILE_CULL_GROUP_SIZE (TILE_CULL_SIZE * TILE_CULL_SIZE)
+#define TILE_CULL_OVERFLOW 0xffffffff
+#define TILE_CULL_STAGE_COUNT 0
+#define TILE_CULL_STAGE_WRITE 1
+#define TILE_CULL_NUM_STAGES 2
+
+/*Leaves per tile the renderer allocates before the first frame reports how many it needs*/
+#define TILE_CULL_INITIAL_LEAVES 16
+
+/*Prepass between the G-buffer and reflection passes, like tiled light culling for reflection
+  rays.  Each group bounds the ray origins of one screen tile and the cone of its reflection
+  directions, tests the world space bounding spheres of the instances against that cone and
+  walks the BLAS of every instance that passes the same way, keeping the leaves that pass.
+  triCast.frag then tests only the triangles of its tile's leaves.
+
+  The count stage writes the number of leaves of every tile to the scan buffer of prims, which
+  turns them into each tile's offset in the leaf buffer and their sum into prims->total.  The
+  write stage repeats the walk and stores the leaves at those offsets.  Tiles whose leaves do
+  not fit the leaf buffer store TILE_CULL_OVERFLOW as their count and trace the BVH as before.
+
+  The range and leaf buffers are owned by the renderer so the reflection pass can bind them
+  without the culler.  Ranges hold a first leaf and a count per tile and leaves hold the first
+  triangle of a BLAS leaf and its instance, with the leaf's triangle count in the top 8 bits.*/
+typedef struct
+{
+    VkShaderModule _shader;
+    VkDescriptorSetLayout _descLayout;
+    VkDescriptorPool _descPool;
+    VkDescriptorSet _descSet;
+    VkPipelineLayout _pipelineLayout;
+    VkPipeline _pipelines[TILE_CULL_NUM_STAGES];
+    VkSampler _gBufferSampler;
+    GPUPrimitives* _prims;
+    
+    uint32_t _numTiles;
+}
+TileCuller;
+
+static inline uint32_t tileCullNumTiles(Context* context)
+{
+    return ((context->width + TILE_CULL_SIZE - 1) / TILE_CULL_SIZE) * ((context->height + TILE_CULL_SIZE - 1) / TILE_CULL_SIZE);
+}
+
+/*specData holds numObjs, numVerts and numTris like the graphics pipelines.  gBufferViews are
+  the color, position and normal views in SHADER_READ_ONLY_OPTIMAL after the G-buffer pass.
+  prims must hold at least one element per tile and outlive the culler.*/
+int32_t tileCullerCreate(TileCuller* culler, Context* context, const char* src, uint32_t len, VkDescriptorSetLayout sharedLayout,
+    const uint32_t* specData, const VkImageView* gBufferViews, VkBuffer camPosBuffer, GPUPrimitives* prims,
+    VkBuffer tileRanges, VkBuffer tileLeaves);
+/*Points the write stage at a new leaf buffer, the command buffers using the old one must have completed*/
+void tileCullerSetLeaves(TileCuller* culler, Context* context, VkBuffer tileLeaves);
+void tileCullerRecord(TileCuller* culler, VkCommandBuffer cmdBuffer, VkDescriptorSet sharedSet);
+void tileCullerDestroy(TileCuller* culler, Context* context);
+
+#endif //TILE_CULL_H
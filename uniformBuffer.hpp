@@ -8,15 +8,41 @@
 
 #include "context.h"
 
+/*reflectivity is the share of light a surface reflects instead of its own color, 0 never
+  casts a reflection ray.  roughness spreads the reflection rays of a surface.  normalMatrix is
+  filled in by the renderer whenever the uniforms pass through it.*/
 typedef struct
 {
     glm::mat4 model;
     glm::mat4 vp;
     glm::vec3 camPos;
     uint32_t texture;
+    float reflectivity;
+    float roughness;
+    float _padding[2];
+    glm::mat4 normalMatrix;
 }
 StandardUniforms;
 
+/*Matches CamPos in the reflection shaders.  bounceDepth is the number of reflection rays a
+  pixel may follow and rayBudget caps the rays traced by all pixels in one frame.  frame and
+  prevViewProj schedule and reproject temporal reflections in the compute backends.  The
+  raster reflection pass marches up to screenSpaceSteps steps across the depth buffer with
+  viewProj before tracing triangles, 0 always traces.  Reflection rays ignore hits further
+  than maxDistance.*/
+typedef struct
+{
+    glm::vec3 camPos;
+    uint32_t bounceDepth;
+    uint32_t rayBudget;
+    uint32_t frame;
+    uint32_t screenSpaceSteps;
+    float maxDistance;
+    glm::mat4 prevViewProj;
+    glm::mat4 viewProj;
+}
+ReflectionUniforms;
+
 typedef struct
 {
     VkBuffer buffer;
@@ -36,13 +62,16 @@ static inline int32_t uniformBufferCreate(UniformBuffer* uniforms, Context* cont
     uint32_t memoryTypeBits;
     VkMemoryPropertyFlags desiredFlags = {VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT};
     VkResult result;
+    uint32_t familyIndices[3];
     
     uniforms->_dataSize = numUniforms * sizeof(T);
     
     bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
     bufferInfo.size = numUniforms * sizeof(T);
     bufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
-    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    bufferInfo.sharingMode = getSharingMode(context);
+    bufferInfo.queueFamilyIndexCount = getFamilies(context, familyIndices);
+    bufferInfo.pQueueFamilyIndices = familyIndices;
     
     result = vkCreateBuffer(context->device, &bufferInfo, NULL, &uniforms->buffer);
     if(result != VK_SUCCESS) return -1;
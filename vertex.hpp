@@ -1,7 +1,15 @@
 #ifndef VERTEX_H
 #define VERTEX_H
 
+#include <stdint.h>
+#include <math.h>
 #include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+/*The last word of every ray tracing triangle holds its material ID in the low bits and
+  TRIANGLE_FLIPPED when its winding disagrees with its vertex normals.  Must match trace.glsl.*/
+#define TRIANGLE_FLIPPED 0x80000000
+#define TRIANGLE_MATERIAL_MASK 0x7fffffff
 
 typedef struct
 {
@@ -12,4 +20,80 @@ typedef struct
 }
 Vertex;
 
+/*How the raster pass reads a mesh's vertices.  Packed vertices halve the positions and pack the
+  normal and texture coordinates like VertexAttributes, ray tracing always reads full positions.*/
+typedef enum
+{
+    VERTEX_FORMAT_FULL,
+    VERTEX_FORMAT_PACKED,
+    VERTEX_NUM_FORMATS
+}
+VertexFormat;
+
+/*Raster vertex of VERTEX_FORMAT_PACKED meshes, 16 bytes.  The position as four halfs with w 1, an
+  octahedral normal as two snorm16 and the texture coordinates as two halfs.*/
+typedef struct
+{
+    uint32_t position[2];
+    uint32_t normal;
+    uint32_t texCoords;
+}
+PackedVertex;
+
+/*Matches StorageVertex in the shaders (std430).  Only the object space position, which is
+  all a ray-triangle test fetches per vertex.*/
+typedef struct
+{
+    glm::vec3 position;
+}
+StorageVertex;
+
+/*Matches VertexAttributes in the shaders (std430).  An octahedral normal as two snorm16 and
+  the texture coordinates as two halfs, read only for the closest hit.*/
+typedef struct
+{
+    uint32_t normal;
+    uint32_t texCoords;
+}
+VertexAttributes;
+
+/*Matches TriangleRecord in the shaders (std430).  The first vertex and both edges of a
+  ray tracing triangle in leaf order, so an intersection test is one contiguous fetch.
+  v0.w is 1, or -1 when the triangle is TRIANGLE_FLIPPED.*/
+typedef struct
+{
+    glm::vec4 v0;
+    glm::vec4 e1;
+    glm::vec4 e2;
+}
+TriangleRecord;
+
+static inline uint32_t packOctahedral(glm::vec3 n)
+{
+    glm::vec2 p;
+    
+    n /= fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+    p = glm::vec2(n.x, n.y);
+    
+    if(n.z < 0)
+    {
+        p.x = (1.0f - fabsf(n.y)) * (n.x >= 0 ? 1.0f : -1.0f);
+        p.y = (1.0f - fabsf(n.x)) * (n.y >= 0 ? 1.0f : -1.0f);
+    }
+    
+    return glm::packSnorm2x16(p);
+}
+
+static inline PackedVertex packVertex(const Vertex* vertex)
+{
+    PackedVertex packed;
+    
+    packed.position[0] = glm::packHalf2x16(glm::vec2(vertex->position.x, vertex->position.y));
+    packed.position[1] = glm::packHalf2x16(glm::vec2(vertex->position.z, 1.0f));
+    packed.normal = packOctahedral(glm::normalize(glm::vec3(vertex->normal)));
+    packed.texCoords = glm::packHalf2x16(glm::vec2(vertex->texCoords));
+    
+    return packed;
+}
+
 #endif //VERTEX_H
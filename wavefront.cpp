@@ -0,0 +1,485 @@
+#include "wavefront.hpp"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <vulkan/vulkan.h>
+
+#include "context.h"
+#include "shaderStorageBuffer.hpp"
+#include "texture.h"
+#include "utilMacros.h"
+
+static_assert(WAVEFRONT_GROUP_SIZE == WAVEFRONT_TILE_SIZE * WAVEFRONT_TILE_SIZE, "One tile per group");
+
+static inline int32_t createBuffers(WavefrontTracer* tracer, Context* context)
+{
+    if(shaderStorageBufferCreate(&tracer->_rays, context, tracer->_numPixels * 8 * sizeof(uint32_t))) return -1;
+    if(shaderStorageBufferCreate(&tracer->_hits, context, tracer->_numPixels * 8 * sizeof(uint32_t))) return -1;
+    if(shaderStorageBufferCreate(&tracer->_queueState, context, sizeof(WavefrontQueueState), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT)) return -1;
+    if(shaderStorageBufferCreate(&tracer->_reflections, context, tracer->_numPixels * 4 * sizeof(float))) return -1;
+    if(shaderStorageBufferCreate(&tracer->_history, context, 2 * tracer->_numPixels * 8 * sizeof(uint32_t))) return -1;
+    
+    return 0;
+}
+
+static inline int32_t createOutputImage(WavefrontTracer* tracer, Context* context)
+{
+    VkImageCreateInfo imageInfo = {};
+    VkMemoryRequirements memoryReqs = {};
+    VkMemoryAllocateInfo allocInfo = {};
+    VkMemoryType memoryType;
+    VkMemoryPropertyFlags desiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    VkImageViewCreateInfo viewInfo = {};
+    VkCommandBufferBeginInfo beginInfo = {};
+    VkImageMemoryBarrier layoutBarrier = {};
+    VkImageSubresourceRange resourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    VkSubmitInfo submitInfo = {};
+    VkFenceCreateInfo fenceInfo = {};
+    VkFence fence;
+    uint32_t memoryTypeBits;
+    uint32_t familyIndices[3];
+    VkResult result;
+    
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+    imageInfo.extent = {context->width, context->height, 1};
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    imageInfo.sharingMode = getSharingMode(context);
+    imageInfo.queueFamilyIndexCount = getFamilies(context, familyIndices);
+    imageInfo.pQueueFamilyIndices = familyIndices;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    
+    result = vkCreateImage(context->device, &imageInfo, NULL, &tracer->outputImage);
+    if(result != VK_SUCCESS) return -1;
+    
+    vkGetImageMemoryRequirements(context->device, tracer->outputImage, &memoryReqs);
+    
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = memoryReqs.size;
+    memoryTypeBits = memoryReqs.memoryTypeBits;
+    
+    for(int i = 0; i < 32; ++i)
+    {
+        memoryType = context->physicalDeviceMemory.memoryTypes[i];
+        if(memoryTypeBits & 1 && (memoryType.propertyFlags & desiredFlags) == desiredFlags)
+        {
+            allocInfo.memoryTypeIndex = i;
+            break;
+        }
+        
+        memoryTypeBits >>= 1;
+    }
+    
+    result = vkAllocateMemory(context->device, &allocInfo, NULL, &tracer->_outputMemory);
+    if(result != VK_SUCCESS) return -2;
+    
+    result = vkBindImageMemory(context->device, tracer->outputImage, tracer->_outputMemory, 0);
+    if(result != VK_SUCCESS) return -3;
+    
+    /*The output image stays in the general layout for both the composite stage and the blit*/
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    
+    layoutBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    layoutBarrier.srcAccessMask = 0;
+    layoutBarrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    layoutBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    layoutBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    layoutBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    layoutBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    layoutBarrier.image = tracer->outputImage;
+    layoutBarrier.subresourceRange = resourceRange;
+    
+    vkBeginCommandBuffer(context->setupCmdBuffer, &beginInfo);
+    vkCmdPipelineBarrier(context->setupCmdBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, NULL, 0, NULL, 1, &layoutBarrier);
+    
+    /*A zero normal never matches, so the first frame traces every cell*/
+    vkCmdFillBuffer(context->setupCmdBuffer, tracer->_history.buffer, 0, VK_WHOLE_SIZE, 0);
+    vkEndCommandBuffer(context->setupCmdBuffer);
+    
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    result = vkCreateFence(context->device, &fenceInfo, NULL, &fence);
+    if(result != VK_SUCCESS) return -4;
+    
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &context->setupCmdBuffer;
+    
+    result = vkQueueSubmit(context->gfxQueue, 1, &submitInfo, fence);
+    
+    vkWaitForFences(context->device, 1, &fence, VK_TRUE, 0xffffffffffffffff);
+    vkResetCommandBuffer(context->setupCmdBuffer, 0);
+    vkDestroyFence(context->device, fence, NULL);
+    
+    if(result != VK_SUCCESS) return -5;
+    
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = tracer->outputImage;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = imageInfo.format;
+    viewInfo.components = {VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_G, VK_COMPONENT_SWIZZLE_B, VK_COMPONENT_SWIZZLE_A};
+    viewInfo.subresourceRange = resourceRange;
+    
+    result = vkCreateImageView(context->device, &viewInfo, NULL, &tracer->_outputView);
+    if(result != VK_SUCCESS) return -6;
+    
+    return 0;
+}
+
+static inline int32_t createDescriptors(WavefrontTracer* tracer, Context* context, const VkImageView* gBufferViews, VkBuffer camPosBuffer)
+{
+    VkDescriptorSetLayoutBinding bindings[11] = {};
+    VkDescriptorSetLayoutCreateInfo setLayoutInfo = {};
+    VkDescriptorPoolSize poolSizes[4] = {};
+    VkDescriptorPoolCreateInfo descriptorPoolInfo = {};
+    VkDescriptorSetAllocateInfo descriptorAllocInfo = {};
+    VkSamplerCreateInfo samplerInfo = {};
+    VkDescriptorImageInfo gBufferInfos[3] = {};
+    VkDescriptorImageInfo outputInfo = {};
+    VkDescriptorBufferInfo camPosInfo = {};
+    VkDescriptorBufferInfo queueInfos[4] = {};
+    VkDescriptorBufferInfo historyInfo = {};
+    VkWriteDescriptorSet writeDescriptors[5] = {};
+    ShaderStorageBuffer* buffers[4] =
+    {
+        &tracer->_rays,
+        &tracer->_hits,
+        &tracer->_queueState,
+        &tracer->_reflections
+    };
+    VkResult result;
+    
+    for(int32_t i = 0; i < LENGTH_OF(bindings); ++i)
+    {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+    
+    /*G-buffer color, position and normal*/
+    for(int32_t i = 0; i < 3; ++i)
+    {
+        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    }
+    
+    bindings[3].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    bindings[4].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    bindings[4].descriptorCount = MAX_TEXTURES;
+    bindings[9].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    
+    setLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    setLayoutInfo.bindingCount = LENGTH_OF(bindings);
+    setLayoutInfo.pBindings = bindings;
+    
+    result = vkCreateDescriptorSetLayout(context->device, &setLayoutInfo, NULL, &tracer->_descLayout);
+    if(result != VK_SUCCESS) return -1;
+    
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSizes[0].descriptorCount = 3 + MAX_TEXTURES;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    poolSizes[1].descriptorCount = 1;
+    poolSizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[2].descriptorCount = LENGTH_OF(buffers) + 1;
+    poolSizes[3].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    poolSizes[3].descriptorCount = 1;
+    
+    descriptorPoolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descriptorPoolInfo.maxSets = 1;
+    descriptorPoolInfo.poolSizeCount = LENGTH_OF(poolSizes);
+    descriptorPoolInfo.pPoolSizes = poolSizes;
+    
+    result = vkCreateDescriptorPool(context->device, &descriptorPoolInfo, NULL, &tracer->_descPool);
+    if(result != VK_SUCCESS) return -2;
+    
+    descriptorAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    descriptorAllocInfo.descriptorPool = tracer->_descPool;
+    descriptorAllocInfo.descriptorSetCount = 1;
+    descriptorAllocInfo.pSetLayouts = &tracer->_descLayout;
+    
+    result = vkAllocateDescriptorSets(context->device, &descriptorAllocInfo, &tracer->descSet);
+    if(result != VK_SUCCESS) return -3;
+    
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = VK_FILTER_NEAREST;
+    samplerInfo.minFilter = VK_FILTER_NEAREST;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.maxAnisotropy = 1.0f;
+    samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK;
+    samplerInfo.unnormalizedCoordinates = VK_FALSE;
+    
+    result = vkCreateSampler(context->device, &samplerInfo, NULL, &tracer->_gBufferSampler);
+    if(result != VK_SUCCESS) return -4;
+    
+    for(int32_t i = 0; i < 3; ++i)
+    {
+        gBufferInfos[i].sampler = tracer->_gBufferSampler;
+        gBufferInfos[i].imageView = gBufferViews[i];
+        gBufferInfos[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    }
+    
+    camPosInfo.buffer = camPosBuffer;
+    camPosInfo.offset = 0;
+    camPosInfo.range = VK_WHOLE_SIZE;
+    
+    for(int32_t i = 0; i < LENGTH_OF(buffers); ++i)
+    {
+        queueInfos[i].buffer = buffers[i]->buffer;
+        queueInfos[i].offset = 0;
+        queueInfos[i].range = buffers[i]->size;
+    }
+    
+    historyInfo.buffer = tracer->_history.buffer;
+    historyInfo.offset = 0;
+    historyInfo.range = tracer->_history.size;
+    
+    outputInfo.imageView = tracer->_outputView;
+    outputInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    
+    for(int32_t i = 0; i < LENGTH_OF(writeDescriptors); ++i)
+    {
+        writeDescriptors[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writeDescriptors[i].dstSet = tracer->descSet;
+        writeDescriptors[i].dstArrayElement = 0;
+    }
+    
+    writeDescriptors[0].dstBinding = 0;
+    writeDescriptors[0].descriptorCount = 3;
+    writeDescriptors[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    writeDescriptors[0].pImageInfo = gBufferInfos;
+    
+    writeDescriptors[1].dstBinding = 3;
+    writeDescriptors[1].descriptorCount = 1;
+    writeDescriptors[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    writeDescriptors[1].pBufferInfo = &camPosInfo;
+    
+    writeDescriptors[2].dstBinding = 5;
+    writeDescriptors[2].descriptorCount = LENGTH_OF(queueInfos);
+    writeDescriptors[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writeDescriptors[2].pBufferInfo = queueInfos;
+    
+    writeDescriptors[3].dstBinding = 9;
+    writeDescriptors[3].descriptorCount = 1;
+    writeDescriptors[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    writeDescriptors[3].pImageInfo = &outputInfo;
+    
+    writeDescriptors[4].dstBinding = 10;
+    writeDescriptors[4].descriptorCount = 1;
+    writeDescriptors[4].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writeDescriptors[4].pBufferInfo = &historyInfo;
+    
+    vkUpdateDescriptorSets(context->device, LENGTH_OF(writeDescriptors), writeDescriptors, 0, NULL);
+    
+    return 0;
+}
+
+int32_t wavefrontTracerCreate(WavefrontTracer* tracer, Context* context, const char* src, uint32_t len,
+    VkDescriptorSetLayout sharedLayout, const uint32_t* specData, const VkImageView* gBufferViews, VkBuffer camPosBuffer)
+{
+    VkShaderModuleCreateInfo shaderInfo = {};
+    VkPipelineLayoutCreateInfo layoutInfo = {};
+    VkPushConstantRange scheduleRange = {VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(WavefrontSchedule)};
+    VkDescriptorSetLayout descLayouts[2] = {};
+    VkComputePipelineCreateInfo pipelineInfo = {};
+    VkSpecializationInfo specMap = {};
+    VkSpecializationMapEntry specEntries[7] = {};
+    uint32_t stageSpecData[7] = {specData[0], specData[1], specData[2], WAVEFRONT_GROUP_SIZE, 0, context->width, context->height};
+    VkResult result;
+    
+    tracer->_width = context->width;
+    tracer->_height = context->height;
+    tracer->_numPixels = context->width * context->height;
+    tracer->_numPixelGroups = (tracer->_numPixels + WAVEFRONT_GROUP_SIZE - 1) / WAVEFRONT_GROUP_SIZE;
+    
+    if(createBuffers(tracer, context)) return -1;
+    if(createOutputImage(tracer, context)) return -2;
+    if(createDescriptors(tracer, context, gBufferViews, camPosBuffer)) return -3;
+    
+    shaderInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    shaderInfo.codeSize = len;
+    shaderInfo.pCode = (uint32_t*)src;
+    
+    result = vkCreateShaderModule(context->device, &shaderInfo, NULL, &tracer->_shader);
+    if(result != VK_SUCCESS) return -4;
+    
+    descLayouts[0] = tracer->_descLayout;
+    descLayouts[1] = sharedLayout;
+    
+    layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    layoutInfo.setLayoutCount = 2;
+    layoutInfo.pSetLayouts = descLayouts;
+    layoutInfo.pushConstantRangeCount = 1;
+    layoutInfo.pPushConstantRanges = &scheduleRange;
+    
+    result = vkCreatePipelineLayout(context->device, &layoutInfo, NULL, &tracer->_pipelineLayout);
+    if(result != VK_SUCCESS) return -5;
+    
+    for(int32_t i = 0; i < LENGTH_OF(specEntries); ++i)
+    {
+        specEntries[i].constantID = i;
+        specEntries[i].offset = i * sizeof(uint32_t);
+        specEntries[i].size = sizeof(uint32_t);
+    }
+    
+    specMap.mapEntryCount = LENGTH_OF(specEntries);
+    specMap.pMapEntries = specEntries;
+    specMap.dataSize = sizeof(stageSpecData);
+    specMap.pData = stageSpecData;
+    
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = tracer->_shader;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.stage.pSpecializationInfo = &specMap;
+    pipelineInfo.layout = tracer->_pipelineLayout;
+    pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+    pipelineInfo.basePipelineIndex = 0;
+    
+    /*Every stage is the same module specialized on constant 4*/
+    for(uint32_t i = 0; i < WAVEFRONT_NUM_STAGES; ++i)
+    {
+        stageSpecData[4] = i;
+        result = vkCreateComputePipelines(context->device, VK_NULL_HANDLE, 1, &pipelineInfo, NULL, &tracer->_pipelines[i]);
+        if(result != VK_SUCCESS) return -6;
+    }
+    
+    return 0;
+}
+
+static inline void computeBarrier(VkCommandBuffer cmdBuffer, VkPipelineStageFlags srcStage, VkAccessFlags srcAccess)
+{
+    VkMemoryBarrier barrier = {};
+    
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    
+    vkCmdPipelineBarrier(cmdBuffer, srcStage, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        0, 1, &barrier, 0, NULL, 0, NULL);
+}
+
+static inline void dispatchStage(WavefrontTracer* tracer, VkCommandBuffer cmdBuffer, uint32_t stage, uint32_t numGroups)
+{
+    vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, tracer->_pipelines[stage]);
+    vkCmdDispatch(cmdBuffer, numGroups, 1, 1);
+    computeBarrier(cmdBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+}
+
+static inline void dispatchQueue(WavefrontTracer* tracer, VkCommandBuffer cmdBuffer, uint32_t stage, VkDeviceSize argOffset)
+{
+    vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, tracer->_pipelines[stage]);
+    vkCmdDispatchIndirect(cmdBuffer, tracer->_queueState.buffer, argOffset);
+    computeBarrier(cmdBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+}
+
+void wavefrontTracerRecord(WavefrontTracer* tracer, VkCommandBuffer cmdBuffer, VkDescriptorSet sharedSet, bool tiled, uint32_t traceScale, bool temporal)
+{
+    WavefrontSchedule schedule = {traceScale, temporal};
+    uint32_t traceWidth = (tracer->_width + traceScale - 1) / traceScale;
+    uint32_t traceHeight = (tracer->_height + traceScale - 1) / traceScale;
+    uint32_t numTraceGroups = (traceWidth * traceHeight + WAVEFRONT_GROUP_SIZE - 1) / WAVEFRONT_GROUP_SIZE;
+    uint32_t numTiles = ((traceWidth + WAVEFRONT_TILE_SIZE - 1) / WAVEFRONT_TILE_SIZE) *
+        ((traceHeight + WAVEFRONT_TILE_SIZE - 1) / WAVEFRONT_TILE_SIZE);
+    
+    vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+        tracer->_pipelineLayout, 0, 1, &tracer->descSet, 0, NULL);
+    vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+        tracer->_pipelineLayout, 1, 1, &sharedSet, 0, NULL);
+    vkCmdPushConstants(cmdBuffer, tracer->_pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(schedule), &schedule);
+    
+    vkCmdFillBuffer(cmdBuffer, tracer->_queueState.buffer, offsetof(WavefrontQueueState, numRays), 2 * sizeof(uint32_t), 0);
+    vkCmdFillBuffer(cmdBuffer, tracer->_reflections.buffer, 0, VK_WHOLE_SIZE, 0);
+    computeBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+    
+    if(tiled)
+    {
+        dispatchStage(tracer, cmdBuffer, WAVEFRONT_STAGE_TRACE_TILED, numTiles);
+    }
+    else
+    {
+        dispatchStage(tracer, cmdBuffer, WAVEFRONT_STAGE_RAYGEN, numTraceGroups);
+        dispatchStage(tracer, cmdBuffer, WAVEFRONT_STAGE_TRACE_ARGS, 1);
+        dispatchQueue(tracer, cmdBuffer, WAVEFRONT_STAGE_TRACE, offsetof(WavefrontQueueState, traceArgs));
+    }
+    
+    dispatchStage(tracer, cmdBuffer, WAVEFRONT_STAGE_SHADE_ARGS, 1);
+    dispatchQueue(tracer, cmdBuffer, WAVEFRONT_STAGE_SHADE, offsetof(WavefrontQueueState, shadeArgs));
+    dispatchStage(tracer, cmdBuffer, WAVEFRONT_STAGE_HISTORY, numTraceGroups);
+    
+    vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, tracer->_pipelines[WAVEFRONT_STAGE_COMPOSITE]);
+    vkCmdDispatch(cmdBuffer, tracer->_numPixelGroups, 1, 1);
+}
+
+void wavefrontTracerRecordPresent(WavefrontTracer* tracer, Context* context, VkCommandBuffer cmdBuffer, VkImage presentImage)
+{
+    VkImageMemoryBarrier layoutBarrier = {};
+    VkImageSubresourceRange resourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    VkImageBlit blit = {};
+    
+    /*Every pixel is overwritten so the previous contents are discarded*/
+    layoutBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    layoutBarrier.srcAccessMask = 0;
+    layoutBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    layoutBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    layoutBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    layoutBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    layoutBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    layoutBarrier.image = presentImage;
+    layoutBarrier.subresourceRange = resourceRange;
+    
+    vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &layoutBarrier);
+    
+    blit.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    blit.srcOffsets[1] = {(int32_t)context->width, (int32_t)context->height, 1};
+    blit.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    blit.dstOffsets[1] = {(int32_t)context->width, (int32_t)context->height, 1};
+    
+    vkCmdBlitImage(cmdBuffer, tracer->outputImage, VK_IMAGE_LAYOUT_GENERAL,
+        presentImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_NEAREST);
+    
+    layoutBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    layoutBarrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+    layoutBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    layoutBarrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    
+    vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 0, NULL, 1, &layoutBarrier);
+}
+
+void wavefrontTracerDestroy(WavefrontTracer* tracer, Context* context)
+{
+    for(uint32_t i = 0; i < WAVEFRONT_NUM_STAGES; ++i)
+    {
+        vkDestroyPipeline(context->device, tracer->_pipelines[i], NULL);
+    }
+    
+    vkDestroyPipelineLayout(context->device, tracer->_pipelineLayout, NULL);
+    vkDestroyShaderModule(context->device, tracer->_shader, NULL);
+    
+    vkResetDescriptorPool(context->device, tracer->_descPool, 0);
+    vkDestroyDescriptorPool(context->device, tracer->_descPool, NULL);
+    vkDestroyDescriptorSetLayout(context->device, tracer->_descLayout, NULL);
+    vkDestroySampler(context->device, tracer->_gBufferSampler, NULL);
+    
+    vkDestroyImageView(context->device, tracer->_outputView, NULL);
+    vkDestroyImage(context->device, tracer->outputImage, NULL);
+    vkFreeMemory(context->device, tracer->_outputMemory, NULL);
+    
+    shaderStorageBufferDestroy(&tracer->_rays, context);
+    shaderStorageBufferDestroy(&tracer->_hits, context);
+    shaderStorageBufferDestroy(&tracer->_queueState, context);
+    shaderStorageBufferDestroy(&tracer->_reflections, context);
+    shaderStorageBufferDestroy(&tracer->_history, context);
+}
@@ -0,0 +1,105 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+#include "context.h"
+#include "shaderStorageBuffer.hpp"
+
+#define WAVEFRONT_GROUP_SIZE 64
+/*The tiled trace stage runs one WAVEFRONT_TILE_SIZE squared tile per group*/
+#define WAVEFRONT_TILE_SIZE 8
+
+/*Must match the stage constants in wavefront.comp*/
+#define WAVEFRONT_STAGE_RAYGEN 0
+#define WAVEFRONT_STAGE_TRACE_ARGS 1
+#define WAVEFRONT_STAGE_TRACE 2
+#define WAVEFRONT_STAGE_SHADE_ARGS 3
+#define WAVEFRONT_STAGE_SHADE 4
+#define WAVEFRONT_STAGE_COMPOSITE 5
+#define WAVEFRONT_STAGE_TRACE_TILED 6
+#define WAVEFRONT_STAGE_HISTORY 7
+#define WAVEFRONT_NUM_STAGES 8
+
+/*Matches TraceSchedule in wavefront.comp*/
+typedef struct
+{
+    uint32_t traceScale;
+    uint32_t temporal;
+}
+WavefrontSchedule;
+
+/*Matches QueueState in wavefront.comp*/
+typedef struct
+{
+    VkDispatchIndirectCommand traceArgs;
+    VkDispatchIndirectCommand shadeArgs;
+    uint32_t numRays;
+    uint32_t numHits;
+}
+WavefrontQueueState;
+
+/*Compute replacement for the reflection pass recorded for the compute queue.  Ray generation
+  reads the G-buffer and appends one ray per front facing pixel to the ray queue, trace
+  appends only the rays that hit something to the hit queue and shade only runs over those
+  hits, so every stage works on a compacted queue instead of a divergent fullscreen pass.
+  The trace and shade stages are dispatched indirectly with group counts written on the
+  device from the queue lengths.  Composite applies the same lighting as triCast.frag and
+  writes outputImage, which is blitted to the back buffer on the graphics queue.
+  
+  The tiled variant replaces ray generation and traversal with one stage per screen tile
+  that tests the tile's rays against the triangles of every reachable instance, loading
+  each chunk of triangles into shared memory once for the whole tile.  It writes the same
+  hit queue so shading and composite are shared and both can be compared on one frame.
+  
+  Both variants can trace one pixel out of every traceScale squared block.  Composite then
+  upsamples the reduced reflections with weights from the full resolution G-buffer normals
+  and positions, so edges between surfaces stay sharp.
+  
+  In temporal mode only one cell of every 2x2 block of traced cells is scheduled each
+  frame, rotating through the block every four frames.  The other cells reproject their
+  surface with the previous frame's view projection from the CamPos uniform and copy the
+  reflection stored there by the history stage, as long as the stored position and normal
+  still match.  Cells that fail the test are traced anyway.  The history holds two frames
+  of width * height cells and is written every frame so temporal mode can be turned on at
+  any time.*/
+typedef struct
+{
+    VkShaderModule _shader;
+    VkDescriptorSetLayout _descLayout;
+    VkDescriptorPool _descPool;
+    VkDescriptorSet descSet;
+    VkPipelineLayout _pipelineLayout;
+    VkPipeline _pipelines[WAVEFRONT_NUM_STAGES];
+    VkSampler _gBufferSampler;
+    
+    ShaderStorageBuffer _rays;
+    ShaderStorageBuffer _hits;
+    ShaderStorageBuffer _queueState;
+    ShaderStorageBuffer _reflections;
+    ShaderStorageBuffer _history;
+    
+    VkDeviceMemory _outputMemory;
+    VkImage outputImage;
+    VkImageView _outputView;
+    
+    uint32_t _width;
+    uint32_t _height;
+    uint32_t _numPixels;
+    uint32_t _numPixelGroups;
+}
+WavefrontTracer;
+
+/*specData holds numObjs, numVerts and numTris like the graphics pipelines.  gBufferViews are
+  the color, position and normal views in SHADER_READ_ONLY_OPTIMAL after the G-buffer pass.
+  Textures are bound to binding 4 of descSet with textureUpdateDescriptor.*/
+int32_t wavefrontTracerCreate(WavefrontTracer* tracer, Context* context, const char* src, uint32_t len,
+    VkDescriptorSetLayout sharedLayout, const uint32_t* specData, const VkImageView* gBufferViews, VkBuffer camPosBuffer);
+/*traceScale is 1, 2 or 4 for rays at full, half or quarter resolution*/
+void wavefrontTracerRecord(WavefrontTracer* tracer, VkCommandBuffer cmdBuffer, VkDescriptorSet sharedSet, bool tiled, uint32_t traceScale, bool temporal);
+/*Copies the output image to a swapchain image, which needs VK_IMAGE_USAGE_TRANSFER_DST_BIT*/
+void wavefrontTracerRecordPresent(WavefrontTracer* tracer, Context* context, VkCommandBuffer cmdBuffer, VkImage presentImage);
+void wavefrontTracerDestroy(WavefrontTracer* tracer, Context* context);
+
+#endif //WAVEFRONT_H